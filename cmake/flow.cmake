@@ -71,6 +71,7 @@ target_include_directories(${TARGET} PUBLIC ${CMAKE_CURRENT_LIST_DIR}/../src)
 target_sources(
   ${TARGET}
   PRIVATE ${CMAKE_CURRENT_LIST_DIR}/../src/mesh.cpp
+          ${CMAKE_CURRENT_LIST_DIR}/../src/energy.cpp
           ${CMAKE_CURRENT_LIST_DIR}/../src/low_power.cpp
           ${CMAKE_CURRENT_LIST_DIR}/../src/publisher.cpp)
 
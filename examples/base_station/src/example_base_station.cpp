@@ -22,6 +22,7 @@
 
 #include <util/delay.h>
 
+#include "energy.hpp"
 #include "mesh.hpp"
 
 // These are from the env file in the top of the examples folder:
@@ -80,6 +81,25 @@ broadcast_callback(__attribute__((unused)) const uint16_t source_address,
            data);
 }
 
+static void
+energy_report_callback(const uint16_t source_address,
+                       __attribute__((unused))
+                       const char source_device_name[DEVICE_NAME_LENGTH],
+                       uint8_t* data,
+                       uint8_t size) {
+
+    energy::Report report;
+
+    if (!energy::unpack_report(data, size, report)) {
+        return;
+    }
+
+    printf("Energy report from %04X: %lu uAh in total, %lu uC last cycle\r\n",
+           source_address,
+           report.total_charge,
+           report.cycle_charge);
+}
+
 constexpr const size_t NUMBER_OF_RESET_CAUSES = 5;
 
 constexpr const char* RESET_CAUSE[] = {"Power-on",
@@ -128,6 +148,23 @@ auto main() -> int {
     // Register broadcast callback on endpoint 2
     mesh::register_listener(mesh::Endpoint::Endpoint2, broadcast_callback);
 
+    // Register energy report callback on endpoint 3
+    mesh::register_listener(mesh::Endpoint::Endpoint3, energy_report_callback);
+
+    // Move the network to a quieter channel if more than 30 % of at least 20
+    // transmissions within a minute fail. The nodes are given 10 seconds to
+    // relay the switch command before the switch happens
+    mesh::enable_channel_migration(mesh::ChannelMigrationConfiguration{
+        60,
+        20,
+        30,
+        10,
+    });
+
+    // Spread the publishers over 8 transmit slots, the publishers have to
+    // enable slotted mode with the same number of slots
+    mesh::enable_slot_assignment(8);
+
     // Setup watchdog
     wdt_set_timeout_period(WDT_TIMEOUT_PERIOD_1024KCLK);
     wdt_enable(SYSTEM_RESET_MODE);
@@ -14,15 +14,24 @@
 #define NWK_BUFFERS_AMOUNT                 10
 #define NWK_DUPLICATE_REJECTION_TABLE_SIZE 50
 #define NWK_DUPLICATE_REJECTION_TTL        2000 /* ms */
+#define NWK_DUPLICATE_REJECTION_HASH_BITS  5
 #define NWK_ROUTE_TABLE_SIZE               100
+#define NWK_ROUTE_HASH_BITS                7
 #define NWK_ROUTE_DEFAULT_SCORE            3
 #define NWK_ACK_WAIT_TIME                  1000 /* ms */
 #define NWK_GROUPS_AMOUNT                  3
 #define NWK_ROUTE_DISCOVERY_TABLE_SIZE     5
 #define NWK_ROUTE_DISCOVERY_TIMEOUT        1000 /* ms */
+#define NWK_SECURITY_REPLAY_TABLE_SIZE     100
+#define NWK_SECURITY_REPLAY_HASH_BITS      7
 #define APP_RX_BUF_SIZE                    20
 #define NWK_ENABLE_ROUTING
 #define NWK_ENABLE_SECURITY
 #define NWK_ENABLE_ROUTE_DISCOVERY
+#define NWK_ENABLE_CHANNEL_SWITCH
+#define NWK_ENABLE_KEY_SWITCH
+#define NWK_ENABLE_TX_POWER_CONTROL
+#define NWK_ENABLE_ROUTE_REPAIR
+#define SYS_ENABLE_TICKLESS_TIMER
 
 #endif
@@ -300,9 +300,9 @@ static inline void macsc_sleep_clk_disable(void) { ASSR &= ~(1 << AS2); }
  */
 static inline void macsc_write_clock_source(enum macsc_xtal source) {
     if (source == MACSC_16MHz) {
-        SCCR0 |= (source << SCCKSEL);
-    } else if (source == MACSC_32KHz) {
         SCCR0 &= ~(1 << SCCKSEL);
+    } else if (source == MACSC_32KHz) {
+        SCCR0 |= (1 << SCCKSEL);
     }
 }
 
@@ -313,7 +313,7 @@ static inline void macsc_write_clock_source(enum macsc_xtal source) {
  * \return macsc_xtal enum Clock source selection
  */
 static inline enum macsc_xtal macsc_read_clock_source(void) {
-    return (enum macsc_xtal)(SCCR0 & (1 << SCCKSEL));
+    return (enum macsc_xtal)((SCCR0 >> SCCKSEL) & 1);
 }
 
 /**
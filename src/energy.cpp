@@ -0,0 +1,187 @@
+#include "energy.hpp"
+
+#include "sleep_mgr.h"
+
+namespace energy {
+
+    /**
+     * @brief Current drawn in each state, nullptr if accounting is disabled.
+     */
+    static const CurrentTable* currents = nullptr;
+
+    /**
+     * @brief Accumulated timestamp ticks spent in each state.
+     */
+    static uint64_t radio_ticks[PHY_RADIO_STATES_AMOUNT];
+    static uint64_t mcu_ticks[static_cast<uint8_t>(McuState::Amount)];
+
+    static uint8_t radio_state;
+    static McuState mcu_state;
+
+    /**
+     * @brief Timestamps of the last state changes.
+     */
+    static uint32_t radio_state_start;
+    static uint32_t mcu_state_start;
+
+    /**
+     * @brief Total charge at the start of the current cycle (in
+     * microcoulombs).
+     */
+    static uint64_t cycle_start_charge = 0;
+
+    static uint32_t last_cycle_charge = 0;
+
+    static void radio_state_handler(const uint8_t state) {
+        const uint32_t now = sm_timestamp();
+
+        // Unsigned arithmetic handles the wrap-around of the timestamp
+        radio_ticks[radio_state] += now - radio_state_start;
+
+        radio_state       = state;
+        radio_state_start = now;
+    }
+
+    void initialise(const CurrentTable& current_table) {
+
+        currents = &current_table;
+
+        for (uint64_t& ticks : radio_ticks) { ticks = 0; }
+        for (uint64_t& ticks : mcu_ticks) { ticks = 0; }
+
+        radio_state       = PHY_RADIO_STATE_RX_ON;
+        mcu_state         = McuState::Active;
+        radio_state_start = mcu_state_start = sm_timestamp();
+
+        cycle_start_charge = 0;
+        last_cycle_charge  = 0;
+
+        PHY_SetRadioStateHandler(radio_state_handler);
+    }
+
+    void set_mcu_state(const McuState state) {
+
+        if (currents == nullptr) {
+            return;
+        }
+
+        const uint32_t now = sm_timestamp();
+
+        mcu_ticks[static_cast<uint8_t>(mcu_state)] += now - mcu_state_start;
+
+        mcu_state       = state;
+        mcu_state_start = now;
+    }
+
+    /**
+     * @brief Adds the time spent in the current states up until now.
+     */
+    static void update() {
+        radio_state_handler(radio_state);
+        set_mcu_state(mcu_state);
+    }
+
+    auto radio_state_time(const uint8_t state) -> uint32_t {
+
+        if (currents == nullptr || state >= PHY_RADIO_STATES_AMOUNT) {
+            return 0;
+        }
+
+        update();
+
+        return static_cast<uint32_t>(radio_ticks[state] /
+                                     sm_timestamp_frequency());
+    }
+
+    auto mcu_state_time(const McuState state) -> uint32_t {
+
+        if (currents == nullptr) {
+            return 0;
+        }
+
+        update();
+
+        return static_cast<uint32_t>(mcu_ticks[static_cast<uint8_t>(state)] /
+                                     sm_timestamp_frequency());
+    }
+
+    /**
+     * @return The charge consumed since #initialise (in microcoulombs).
+     */
+    static auto charge() -> uint64_t {
+
+        update();
+
+        // Microamperes times ticks, converted to microcoulombs at the end to
+        // not lose precision
+        uint64_t charge = 0;
+
+        for (uint8_t i = 0; i < PHY_RADIO_STATES_AMOUNT; i++) {
+            charge += radio_ticks[i] * currents->radio[i];
+        }
+
+        for (uint8_t i = 0; i < static_cast<uint8_t>(McuState::Amount); i++) {
+            charge += mcu_ticks[i] * currents->mcu[i];
+        }
+
+        return charge / sm_timestamp_frequency();
+    }
+
+    auto total_charge() -> uint32_t {
+
+        if (currents == nullptr) {
+            return 0;
+        }
+
+        return static_cast<uint32_t>(charge() / 3600);
+    }
+
+    void start_cycle() {
+
+        if (currents == nullptr) {
+            return;
+        }
+
+        const uint64_t now = charge();
+
+        last_cycle_charge  = static_cast<uint32_t>(now - cycle_start_charge);
+        cycle_start_charge = now;
+    }
+
+    auto cycle_charge() -> uint32_t { return last_cycle_charge; }
+
+    static void pack(uint8_t* data, const uint32_t value) {
+        for (uint8_t i = 0; i < sizeof(value); i++) {
+            data[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    static auto unpack(const uint8_t* data) -> uint32_t {
+        uint32_t value = 0;
+
+        for (uint8_t i = 0; i < sizeof(value); i++) {
+            value |= static_cast<uint32_t>(data[i]) << (8 * i);
+        }
+
+        return value;
+    }
+
+    void pack_report(uint8_t* data) {
+        pack(data, total_charge());
+        pack(data + sizeof(uint32_t), cycle_charge());
+    }
+
+    auto unpack_report(const uint8_t* data, const uint8_t size, Report& report)
+        -> bool {
+
+        if (size != REPORT_SIZE) {
+            return false;
+        }
+
+        report.total_charge = unpack(data);
+        report.cycle_charge = unpack(data + sizeof(uint32_t));
+
+        return true;
+    }
+
+} // namespace energy
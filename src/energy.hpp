@@ -0,0 +1,128 @@
+/**
+ * @brief Estimates the energy consumption of the device by accounting for the
+ * time spent in every radio state and MCU sleep mode, and multiplying it with
+ * the current drawn by the board in that state.
+ */
+
+#ifndef ENERGY_HPP
+#define ENERGY_HPP
+
+#include <stdint.h>
+
+#include "phy.h"
+
+namespace energy {
+
+    /**
+     * @brief The states of the MCU which are accounted for. Idle is the
+     * halted MCU of low_power::idle, Sleeping the power save mode of
+     * low_power::sleep.
+     */
+    enum class McuState { Active = 0, Idle, Sleeping, Amount };
+
+    /**
+     * @brief Current drawn by the board in each state (in microamperes). The
+     * radio and MCU currents are added together.
+     */
+    struct CurrentTable {
+        /**
+         * @brief Indexed by PHY_RADIO_STATE_SLEEP, PHY_RADIO_STATE_TRX_OFF,
+         * PHY_RADIO_STATE_RX_ON and PHY_RADIO_STATE_BUSY_TX.
+         */
+        uint16_t radio[PHY_RADIO_STATES_AMOUNT];
+
+        /**
+         * @brief Indexed by #McuState.
+         */
+        uint16_t mcu[static_cast<uint8_t>(McuState::Amount)];
+    };
+
+    /**
+     * @brief Typical values from the data sheets. Measure the board for more
+     * accurate estimates.
+     */
+    constexpr CurrentTable ATMEGA256RFR2_CURRENTS = {{0, 400, 12500, 14500},
+                                                     {4100, 1500, 1}};
+
+    constexpr CurrentTable XMEGA_RF233_ZIGBIT_CURRENTS = {
+        {0, 300, 11800, 13800},
+        {10000, 3800, 1}};
+
+    /**
+     * @brief Starts the accounting with the currents in @p current_table.
+     * Requires low_power::initialize to have been called, as the time is
+     * measured with the timer of the sleep manager. Should be called after the
+     * mesh has been initialised, as the radio is assumed to be receiving.
+     */
+    void initialise(const CurrentTable& current_table);
+
+    /**
+     * @brief Called when the MCU enters or leaves a sleep mode.
+     */
+    void set_mcu_state(McuState state);
+
+    /**
+     * @return Time spent in the radio @p state (in seconds).
+     */
+    [[nodiscard]] auto radio_state_time(uint8_t state) -> uint32_t;
+
+    /**
+     * @return Time spent in the MCU @p state (in seconds).
+     */
+    [[nodiscard]] auto mcu_state_time(McuState state) -> uint32_t;
+
+    /**
+     * @return The estimated charge consumed since #initialise (in microampere
+     * hours).
+     */
+    [[nodiscard]] auto total_charge() -> uint32_t;
+
+    /**
+     * @brief Marks the start of a new cycle, e.g. a publish cycle.
+     */
+    void start_cycle();
+
+    /**
+     * @return The estimated charge consumed in the last complete cycle (in
+     * microcoulombs).
+     */
+    [[nodiscard]] auto cycle_charge() -> uint32_t;
+
+    /**
+     * @brief Size of an energy report.
+     */
+    constexpr uint8_t REPORT_SIZE = 8;
+
+    /**
+     * @brief Energy report sent to the base station. Encoded as the total
+     * charge followed by the cycle charge, both as 32 bit little endian.
+     */
+    struct Report {
+        /**
+         * @brief See #total_charge.
+         */
+        uint32_t total_charge;
+
+        /**
+         * @brief See #cycle_charge.
+         */
+        uint32_t cycle_charge;
+    };
+
+    /**
+     * @brief Writes a report of the current estimates to @p data, which has to
+     * hold #REPORT_SIZE bytes.
+     */
+    void pack_report(uint8_t* data);
+
+    /**
+     * @brief Decodes a report created by #pack_report.
+     *
+     * @return false if the report is malformed.
+     */
+    [[nodiscard]] auto
+    unpack_report(const uint8_t* data, uint8_t size, Report& report) -> bool;
+
+} // namespace energy
+
+#endif
@@ -42,10 +42,13 @@
 #define _NWK_H_
 
 /*- Includes ---------------------------------------------------------------*/
+#include "nwkChannelSwitch.h"
 #include "nwkDataReq.h"
 #include "nwkGroup.h"
+#include "nwkKeySwitch.h"
 #include "nwkRoute.h"
 #include "nwkSecurity.h"
+#include "nwkTxPower.h"
 #include "sysConfig.h"
 #include <stdbool.h>
 #include <stdint.h>
@@ -61,6 +64,8 @@ extern "C" {
 
 /*- Definitions ------------------------------------------------------------*/
 #define NWK_MAX_PAYLOAD_SIZE (127 - 16 /*NwkFrameHeader_t*/ - 2 /*crc*/)
+#define NWK_MAX_SECURED_PAYLOAD_SIZE \
+    (NWK_MAX_PAYLOAD_SIZE - NWK_SECURITY_HEADER_SIZE - NWK_SECURITY_MIC_SIZE)
 
 #define NWK_BROADCAST_PANID 0xffff
 #define NWK_BROADCAST_ADDR  0xffff
@@ -86,9 +91,6 @@ typedef struct NwkIb_t {
     uint8_t nwkSeqNum;
     uint8_t macSeqNum;
     bool (*endpoint[NWK_ENDPOINTS_AMOUNT])(NWK_DataInd_t* ind);
-#ifdef NWK_ENABLE_SECURITY
-    uint32_t key[4];
-#endif
     uint16_t lock;
 } NwkIb_t;
 
@@ -106,6 +108,7 @@ void NWK_Unlock(void);
 void NWK_SleepReq(void);
 void NWK_WakeupReq(void);
 void NWK_TaskHandler(void);
+bool NWK_TaskPending(void);
 
 uint8_t NWK_LinearizeLqi(uint8_t lqi);
 
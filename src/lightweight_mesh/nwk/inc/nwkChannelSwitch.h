@@ -0,0 +1,36 @@
+/**
+ * \file nwkChannelSwitch.h
+ *
+ * \brief Coordinated channel switch interface
+ */
+
+#ifndef _NWK_CHANNEL_SWITCH_H_
+#define _NWK_CHANNEL_SWITCH_H_
+
+/*- Includes ---------------------------------------------------------------*/
+#include "nwkRx.h"
+#include "sysConfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef NWK_ENABLE_CHANNEL_SWITCH
+
+/*- Prototypes -------------------------------------------------------------*/
+bool NWK_ChannelSwitchReq(uint8_t channel, uint16_t delay);
+bool NWK_ChannelSwitchPending(uint8_t* channel);
+void NWK_SetChannelSwitchHandler(void (*handler)(uint8_t channel));
+
+void nwkChannelSwitchInit(void);
+bool nwkChannelSwitchReceived(NWK_DataInd_t* ind);
+
+#endif /* NWK_ENABLE_CHANNEL_SWITCH */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NWK_CHANNEL_SWITCH_H_ */
@@ -50,10 +50,12 @@ extern "C" {
 
 /*- Types ------------------------------------------------------------------*/
 enum {
-    NWK_COMMAND_ACK           = 0x00,
-    NWK_COMMAND_ROUTE_ERROR   = 0x01,
-    NWK_COMMAND_ROUTE_REQUEST = 0x02,
-    NWK_COMMAND_ROUTE_REPLY   = 0x03,
+    NWK_COMMAND_ACK            = 0x00,
+    NWK_COMMAND_ROUTE_ERROR    = 0x01,
+    NWK_COMMAND_ROUTE_REQUEST  = 0x02,
+    NWK_COMMAND_ROUTE_REPLY    = 0x03,
+    NWK_COMMAND_CHANNEL_SWITCH = 0x04,
+    NWK_COMMAND_KEY_SWITCH     = 0x05,
 };
 COMPILER_PACK_SET(1)
 typedef struct NwkCommandAck_t {
@@ -85,6 +87,19 @@ typedef struct NwkCommandRouteReply_t {
     uint8_t forwardLinkQuality;
     uint8_t reverseLinkQuality;
 } NwkCommandRouteReply_t;
+
+typedef struct NwkCommandChannelSwitch_t {
+    uint8_t id;
+    uint8_t channel;
+    uint16_t delay;
+} NwkCommandChannelSwitch_t;
+
+typedef struct NwkCommandKeySwitch_t {
+    uint8_t id;
+    uint8_t keyId;
+    uint8_t key[NWK_SECURITY_KEY_SIZE];
+    uint16_t delay;
+} NwkCommandKeySwitch_t;
 COMPILER_PACK_RESET()
 
 #ifdef __cplusplus
@@ -87,6 +87,7 @@ typedef struct NWK_DataReq_t {
 void NWK_DataReq(NWK_DataReq_t* req);
 
 void nwkDataReqInit(void);
+bool nwkDataReqPending(void);
 void nwkDataReqTaskHandler(void);
 
 #ifdef __cplusplus
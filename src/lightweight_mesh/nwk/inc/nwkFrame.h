@@ -43,6 +43,7 @@
 
 /*- Includes ---------------------------------------------------------------*/
 #include "compiler.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -66,7 +67,7 @@ typedef struct NwkFrameHeader_t {
         uint8_t security : 1;
         uint8_t linkLocal : 1;
         uint8_t multicast : 1;
-        uint8_t reserved : 4;
+        uint8_t txPower : 4; /* Power level of the last hop, see nwkTxPower.c */
     } nwkFcf;
     uint8_t nwkSeq;
     uint16_t nwkSrcAddr;
@@ -82,7 +83,17 @@ typedef struct NwkFrameMulticastHeader_t {
     uint16_t maxMemberRadius : 4;
 } NwkFrameMulticastHeader_t;
 
+typedef struct NwkFrameQueue_t {
+    struct NwkFrame_t* head;
+    struct NwkFrame_t* tail;
+} NwkFrameQueue_t;
+
 typedef struct NwkFrame_t {
+    /* Internal data */
+    struct NwkFrame_t* next;
+    struct NwkFrame_t* prev;
+    NwkFrameQueue_t* queue;
+
     uint8_t state;
     uint8_t size;
 
@@ -111,9 +122,15 @@ COMPILER_PACK_RESET()
 /*- Prototypes -------------------------------------------------------------*/
 void nwkFrameInit(void);
 NwkFrame_t* nwkFrameAlloc(void);
+bool nwkFrameAvailable(void);
 void nwkFrameFree(NwkFrame_t* frame);
-NwkFrame_t* nwkFrameNext(NwkFrame_t* frame);
 void nwkFrameCommandInit(NwkFrame_t* frame);
+void nwkFrameQueueInit(NwkFrameQueue_t* queue);
+void nwkFrameEnqueue(NwkFrameQueue_t* queue, NwkFrame_t* frame);
+void nwkFrameInsert(NwkFrameQueue_t* queue,
+                    NwkFrame_t* prev,
+                    NwkFrame_t* frame);
+void nwkFrameDequeue(NwkFrame_t* frame);
 
 /*- Implementations --------------------------------------------------------*/
 
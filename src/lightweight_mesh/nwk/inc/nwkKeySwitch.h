@@ -0,0 +1,37 @@
+/**
+ * \file nwkKeySwitch.h
+ *
+ * \brief Coordinated network key switch interface
+ */
+
+#ifndef _NWK_KEY_SWITCH_H_
+#define _NWK_KEY_SWITCH_H_
+
+/*- Includes ---------------------------------------------------------------*/
+#include "nwkRx.h"
+#include "sysConfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef NWK_ENABLE_KEY_SWITCH
+
+/*- Prototypes -------------------------------------------------------------*/
+bool NWK_KeySwitchReq(uint8_t keyId, uint8_t* key, uint16_t delay);
+bool NWK_KeySwitchPending(uint8_t* keyId);
+void NWK_SetKeySwitchHandler(void (*handler)(uint8_t keyId));
+
+void nwkKeySwitchInit(void);
+bool nwkKeySwitchReceived(NWK_DataInd_t* ind);
+void nwkKeySwitchFrameReceived(uint16_t src);
+
+#endif /* NWK_ENABLE_KEY_SWITCH */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NWK_KEY_SWITCH_H_ */
@@ -60,7 +60,8 @@ extern "C" {
 typedef struct NWK_RouteTableEntry_t {
     uint8_t fixed : 1;
     uint8_t multicast : 1;
-    uint8_t reserved : 2;
+    uint8_t repaired : 1;
+    uint8_t reserved : 1;
     uint8_t score : 4;
     uint16_t dstAddr;
     uint16_t nextHopAddr;
@@ -82,6 +82,7 @@ bool NWK_FilterAddress(uint16_t addr, uint8_t* lqi);
 
 void nwkRxInit(void);
 void nwkRxDecryptConf(NwkFrame_t* frame, bool status);
+bool nwkRxPending(void);
 void nwkRxTaskHandler(void);
 
 #ifdef __cplusplus
@@ -51,17 +51,45 @@ extern "C" {
 #endif
 
 /*- Definitions ------------------------------------------------------------*/
-#define NWK_SECURITY_MIC_SIZE   4
 #define NWK_SECURITY_KEY_SIZE   16
 #define NWK_SECURITY_BLOCK_SIZE 16
 
+/* Auxiliary header in front of the secured payload, holding the key ID and
+ * the frame counter. Secured frames carry NWK_SECURITY_HEADER_SIZE +
+ * NWK_SECURITY_MIC_SIZE bytes on top of the payload. */
+#define NWK_SECURITY_HEADER_SIZE 5
+
+/*- Types ------------------------------------------------------------------*/
+typedef enum {
+    NWK_SECURITY_KEY_NONE    = 0,
+    NWK_SECURITY_KEY_NETWORK = 1, /* Shared by the whole network */
+    NWK_SECURITY_KEY_GROUP   = 2, /* Multicast frames to one group */
+    NWK_SECURITY_KEY_LINK    = 3, /* Unicast frames to and from one node */
+} NWK_SecurityKeyType_t;
+
 /*- Prototypes -------------------------------------------------------------*/
 #ifdef NWK_ENABLE_SECURITY
 
 void NWK_SetSecurityKey(uint8_t* key);
+bool NWK_AddSecurityKey(uint8_t id,
+                        NWK_SecurityKeyType_t type,
+                        uint16_t addr,
+                        uint8_t* key);
+bool NWK_RemoveSecurityKey(uint8_t id);
+bool NWK_SetActiveSecurityKey(uint8_t id);
+uint8_t NWK_ActiveSecurityKey(void);
+NWK_SecurityKeyType_t NWK_SecurityKeyType(uint8_t id);
+bool NWK_SecurityKey(uint8_t id, uint8_t* key);
+void NWK_SetSecurityFrameCounter(uint32_t counter);
+uint32_t NWK_SecurityFrameCounter(void);
+bool NWK_AddSecurityPeer(uint16_t addr, uint32_t counter);
+bool NWK_RemoveSecurityPeer(uint16_t addr);
 
 void nwkSecurityInit(void);
 void nwkSecurityProcess(NwkFrame_t* frame, bool encrypt);
+bool nwkSecurityPending(void);
+bool nwkSecurityPeerKey(uint16_t addr, uint8_t* id);
+bool nwkSecurityKeyInUse(uint8_t id);
 void nwkSecurityTaskHandler(void);
 
 #endif /* NWK_ENABLE_SECURITY */
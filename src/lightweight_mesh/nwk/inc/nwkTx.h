@@ -55,15 +55,26 @@ enum {
     NWK_TX_CONTROL_BROADCAST_PAN_ID = 1 << 0,
     NWK_TX_CONTROL_ROUTING          = 1 << 1,
     NWK_TX_CONTROL_DIRECT_LINK      = 1 << 2,
+    NWK_TX_CONTROL_PEER_KEY         = 1 << 3,
 };
 
+typedef struct NWK_TxStatistics_t {
+    uint16_t frames;
+    uint16_t channelAccessFailures;
+    uint16_t noAcks;
+} NWK_TxStatistics_t;
+
 /*- Prototypes -------------------------------------------------------------*/
+NWK_TxStatistics_t* NWK_TxStatistics(void);
+void NWK_ResetTxStatistics(void);
+
 void nwkTxInit(void);
 void nwkTxFrame(NwkFrame_t* frame);
 void nwkTxBroadcastFrame(NwkFrame_t* frame);
 bool nwkTxAckReceived(NWK_DataInd_t* ind);
 void nwkTxConfirm(NwkFrame_t* frame, uint8_t status);
 void nwkTxEncryptConf(NwkFrame_t* frame);
+bool nwkTxPending(void);
 void nwkTxTaskHandler(void);
 
 #ifdef __cplusplus
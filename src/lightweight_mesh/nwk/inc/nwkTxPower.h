@@ -0,0 +1,49 @@
+/**
+ * \file nwkTxPower.h
+ *
+ * \brief Per-link transmit power control interface
+ */
+
+#ifndef _NWK_TX_POWER_H_
+#define _NWK_TX_POWER_H_
+
+/*- Includes ---------------------------------------------------------------*/
+#include "nwkFrame.h"
+#include "sysConfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef NWK_ENABLE_TX_POWER_CONTROL
+
+/*- Definitions ------------------------------------------------------------*/
+#define NWK_TX_POWER_MAX 0x00
+#define NWK_TX_POWER_MIN 0x0f
+
+/*- Types ------------------------------------------------------------------*/
+typedef struct NWK_TxPowerTableEntry_t {
+    uint16_t addr;
+    uint8_t level;
+    uint8_t limit;
+    uint8_t successes;
+    int8_t rssi; /* As if the neighbour sent at NWK_TX_POWER_MAX */
+} NWK_TxPowerTableEntry_t;
+
+/*- Prototypes -------------------------------------------------------------*/
+NWK_TxPowerTableEntry_t* NWK_TxPowerTable(void);
+
+void nwkTxPowerInit(void);
+void nwkTxPowerFrameReceived(NwkFrame_t* frame);
+void nwkTxPowerPrepareTx(NwkFrame_t* frame);
+bool nwkTxPowerFrameSent(NwkFrame_t* frame, uint8_t status);
+
+#endif /* NWK_ENABLE_TX_POWER_CONTROL */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NWK_TX_POWER_H_ */
@@ -52,6 +52,9 @@
 #include "nwkRoute.h"
 #include "nwkSecurity.h"
 #include "nwkRouteDiscovery.h"
+#include "nwkChannelSwitch.h"
+#include "nwkKeySwitch.h"
+#include "nwkTxPower.h"
 
 /*- Variables --------------------------------------------------------------*/
 NwkIb_t nwkIb;
@@ -92,6 +95,18 @@ void NWK_Init(void)
 #ifdef NWK_ENABLE_ROUTE_DISCOVERY
 	nwkRouteDiscoveryInit();
 #endif
+
+#ifdef NWK_ENABLE_CHANNEL_SWITCH
+	nwkChannelSwitchInit();
+#endif
+
+#ifdef NWK_ENABLE_KEY_SWITCH
+	nwkKeySwitchInit();
+#endif
+
+#ifdef NWK_ENABLE_TX_POWER_CONTROL
+	nwkTxPowerInit();
+#endif
 }
 
 /*************************************************************************//**
@@ -187,14 +202,31 @@ uint8_t NWK_LinearizeLqi(uint8_t lqi)
 }
 
 /*************************************************************************//**
-*  @brief Network layer task handler
+*  @brief Network layer task handler. New requests are admitted before the Tx
+*  module runs, so that their frames reach the security module in the same
+*  pass and are encrypted while the radio sends the frame before them.
 *****************************************************************************/
 void NWK_TaskHandler(void)
 {
 	nwkRxTaskHandler();
-	nwkTxTaskHandler();
 	nwkDataReqTaskHandler();
+	nwkTxTaskHandler();
 #ifdef NWK_ENABLE_SECURITY
 	nwkSecurityTaskHandler();
 #endif
 }
+
+/*************************************************************************//**
+*  @brief Checks if any of the network layer modules have work to do
+*  @return @c true if NWK_TaskHandler() should be called again
+*****************************************************************************/
+bool NWK_TaskPending(void)
+{
+#ifdef NWK_ENABLE_SECURITY
+	if (nwkSecurityPending()) {
+		return true;
+	}
+#endif
+
+	return nwkRxPending() || nwkTxPending() || nwkDataReqPending();
+}
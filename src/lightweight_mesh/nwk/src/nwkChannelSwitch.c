@@ -0,0 +1,167 @@
+/**
+ * \file nwkChannelSwitch.c
+ *
+ * \brief Coordinated channel switch implementation
+ *
+ * A channel switch is announced as a network wide broadcast command carrying
+ * the new channel and a delay (in seconds). Every router relays the command and
+ * arms a local timer, so that all nodes which are awake change channel at
+ * roughly the same time.
+ */
+
+/*- Includes ---------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "phy.h"
+#include "sysConfig.h"
+#include "sysTimer.h"
+#include "nwk.h"
+#include "nwkTx.h"
+#include "nwkFrame.h"
+#include "nwkCommand.h"
+#include "nwkChannelSwitch.h"
+
+#ifdef NWK_ENABLE_CHANNEL_SWITCH
+
+/*- Definitions ------------------------------------------------------------*/
+#define NWK_CHANNEL_SWITCH_DELAY_UNIT    1000ul /* ms */
+
+/*- Prototypes -------------------------------------------------------------*/
+static void nwkChannelSwitchTimerHandler(SYS_Timer_t *timer);
+
+/*- Variables --------------------------------------------------------------*/
+static SYS_Timer_t nwkChannelSwitchTimer;
+static uint8_t nwkChannelSwitchChannel;
+static void (*nwkChannelSwitchHandler)(uint8_t channel);
+
+/*- Implementations --------------------------------------------------------*/
+
+/*************************************************************************//**
+*  @brief Initializes the Channel Switch module
+*****************************************************************************/
+void nwkChannelSwitchInit(void)
+{
+	nwkChannelSwitchChannel = 0;
+	nwkChannelSwitchHandler = NULL;
+
+	nwkChannelSwitchTimer.mode = SYS_TIMER_INTERVAL_MODE;
+	nwkChannelSwitchTimer.handler = nwkChannelSwitchTimerHandler;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkChannelSwitchSchedule(uint8_t channel, uint16_t delay)
+{
+	SYS_TimerStop(&nwkChannelSwitchTimer);
+
+	nwkChannelSwitchChannel = channel;
+	nwkChannelSwitchTimer.interval
+		= (uint32_t)delay * NWK_CHANNEL_SWITCH_DELAY_UNIT + 1;
+
+	SYS_TimerStart(&nwkChannelSwitchTimer);
+}
+
+/*************************************************************************//**
+*  @brief Broadcasts a channel switch command to the whole network and
+*  schedules the local switch
+*  @param[in] channel Channel to switch to
+*  @param[in] delay Time until the switch takes place (in seconds)
+*  @return @c true if the command was queued or @c false otherwise
+*****************************************************************************/
+bool NWK_ChannelSwitchReq(uint8_t channel, uint16_t delay)
+{
+	NwkFrame_t *req;
+	NwkCommandChannelSwitch_t *command;
+
+	if (NULL == (req = nwkFrameAlloc())) {
+		return false;
+	}
+
+	nwkFrameCommandInit(req);
+
+	req->size += sizeof(NwkCommandChannelSwitch_t);
+	req->tx.confirm = NULL;
+
+#ifdef NWK_ENABLE_SECURITY
+	req->header.nwkFcf.security = 1;
+#endif
+	req->header.nwkDstAddr = NWK_BROADCAST_ADDR;
+
+	command = (NwkCommandChannelSwitch_t *)req->payload;
+	command->id = NWK_COMMAND_CHANNEL_SWITCH;
+	command->channel = channel;
+	command->delay = delay;
+
+	nwkTxFrame(req);
+
+	nwkChannelSwitchSchedule(channel, delay);
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Checks if a channel switch has been scheduled, but not yet performed
+*  @param[out] channel Channel that will be switched to (may be NULL)
+*  @return @c true if a switch is pending or @c false otherwise
+*****************************************************************************/
+bool NWK_ChannelSwitchPending(uint8_t *channel)
+{
+	if (!SYS_TimerStarted(&nwkChannelSwitchTimer)) {
+		return false;
+	}
+
+	if (channel) {
+		*channel = nwkChannelSwitchChannel;
+	}
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Registers a callback which is called after the channel was switched
+*  @param[in] handler Pointer to the callback function
+*****************************************************************************/
+void NWK_SetChannelSwitchHandler(void (*handler)(uint8_t channel))
+{
+	nwkChannelSwitchHandler = handler;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+bool nwkChannelSwitchReceived(NWK_DataInd_t *ind)
+{
+	NwkCommandChannelSwitch_t *command
+		= (NwkCommandChannelSwitch_t *)ind->data;
+
+	if (sizeof(NwkCommandChannelSwitch_t) != ind->size) {
+		return false;
+	}
+
+#ifdef NWK_ENABLE_SECURITY
+	/* A forged switch command would take the whole network off the air, so
+	 * only secured commands are accepted */
+	if (0 == (ind->options & NWK_IND_OPT_SECURED)) {
+		return false;
+	}
+#endif
+
+	nwkChannelSwitchSchedule(command->channel, command->delay);
+
+	return true;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkChannelSwitchTimerHandler(SYS_Timer_t *timer)
+{
+	PHY_SetChannel(nwkChannelSwitchChannel);
+
+	if (nwkChannelSwitchHandler) {
+		nwkChannelSwitchHandler(nwkChannelSwitchChannel);
+	}
+
+	(void)timer;
+}
+
+#endif /* NWK_ENABLE_CHANNEL_SWITCH */
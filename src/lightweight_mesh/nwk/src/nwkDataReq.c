@@ -57,11 +57,19 @@ enum {
 	NWK_DATA_REQ_STATE_CONFIRM,
 };
 
+#define NWK_DATA_REQ_STATES_AMOUNT  3
+
+typedef struct NwkDataReqQueue_t {
+	NWK_DataReq_t *head;
+	NWK_DataReq_t *tail;
+} NwkDataReqQueue_t;
+
 /*- Prototypes -------------------------------------------------------------*/
 static void nwkDataReqTxConf(NwkFrame_t *frame);
 
 /*- Variables --------------------------------------------------------------*/
-static NWK_DataReq_t *nwkDataReqQueue;
+/* Requests are kept in first in, first out order in one queue per state */
+static NwkDataReqQueue_t nwkDataReqQueues[NWK_DATA_REQ_STATES_AMOUNT];
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -70,47 +78,118 @@ static NWK_DataReq_t *nwkDataReqQueue;
 *****************************************************************************/
 void nwkDataReqInit(void)
 {
-	nwkDataReqQueue = NULL;
+	for (uint8_t i = 0; i < NWK_DATA_REQ_STATES_AMOUNT; i++) {
+		nwkDataReqQueues[i].head = NULL;
+		nwkDataReqQueues[i].tail = NULL;
+	}
+}
+
+/*************************************************************************//**
+*  @brief Moves request @a req to the tail of the queue for @a state. The
+*  request has to be removed from its previous queue.
+*****************************************************************************/
+static void nwkDataReqSetState(NWK_DataReq_t *req, uint8_t state)
+{
+	NwkDataReqQueue_t *queue = &nwkDataReqQueues[state];
+
+	req->state = state;
+	req->next = NULL;
+
+	if (queue->tail) {
+		queue->tail->next = req;
+	} else {
+		queue->head = req;
+	}
+
+	queue->tail = req;
 }
 
 /*************************************************************************//**
-*  @brief Adds request @a req to the queue of outgoing requests
+*  @brief Removes request @a req from the queue of its state
+*****************************************************************************/
+static void nwkDataReqRemove(NWK_DataReq_t *req)
+{
+	NwkDataReqQueue_t *queue = &nwkDataReqQueues[req->state];
+	NWK_DataReq_t *prev = NULL;
+
+	for (NWK_DataReq_t *r = queue->head; r != req; r = r->next) {
+		prev = r;
+	}
+
+	if (prev) {
+		prev->next = req->next;
+	} else {
+		queue->head = req->next;
+	}
+
+	if (queue->tail == req) {
+		queue->tail = prev;
+	}
+}
+
+/*************************************************************************//**
+*  @return The largest payload that fits in a frame with the options of
+*  request @a req
+*****************************************************************************/
+static uint8_t nwkDataReqMaxSize(NWK_DataReq_t *req)
+{
+	uint8_t size = NWK_MAX_PAYLOAD_SIZE;
+
+#ifdef NWK_ENABLE_SECURITY
+	if (req->options & NWK_OPT_ENABLE_SECURITY) {
+		size = NWK_MAX_SECURED_PAYLOAD_SIZE;
+	}
+#endif
+
+#ifdef NWK_ENABLE_MULTICAST
+	if (req->options & NWK_OPT_MULTICAST) {
+		size -= sizeof(NwkFrameMulticastHeader_t);
+	}
+#endif
+
+	return size;
+}
+
+/*************************************************************************//**
+*  @brief Adds request @a req to the queue of outgoing requests. Requests
+*  with a payload that does not fit in a frame are confirmed with
+*  NWK_ERROR_STATUS without being sent.
 *  @param[in] req Pointer to the request parameters
 *****************************************************************************/
 void NWK_DataReq(NWK_DataReq_t *req)
 {
-	req->state = NWK_DATA_REQ_STATE_INITIAL;
 	req->status = NWK_SUCCESS_STATUS;
 	req->frame = NULL;
 
 	nwkIb.lock++;
 
-	if (NULL == nwkDataReqQueue) {
-		req->next = NULL;
-		nwkDataReqQueue = req;
-	} else {
-		req->next = nwkDataReqQueue;
-		nwkDataReqQueue = req;
+	if (req->size > nwkDataReqMaxSize(req)) {
+		req->status = NWK_ERROR_STATUS;
+		nwkDataReqSetState(req, NWK_DATA_REQ_STATE_CONFIRM);
+		return;
 	}
+
+	nwkDataReqSetState(req, NWK_DATA_REQ_STATE_INITIAL);
 }
 
 /*************************************************************************//**
 *  @brief Prepares and send outgoing frame based on the request @a req
 * parameters
 *  @param[in] req Pointer to the request parameters
+*  @return @c false if there are no free frames, the request is then left in
+*  the queue
 *****************************************************************************/
-static void nwkDataReqSendFrame(NWK_DataReq_t *req)
+static bool nwkDataReqSendFrame(NWK_DataReq_t *req)
 {
 	NwkFrame_t *frame;
 
 	if (NULL == (frame = nwkFrameAlloc())) {
-		req->state = NWK_DATA_REQ_STATE_CONFIRM;
-		req->status = NWK_OUT_OF_MEMORY_STATUS;
-		return;
+		return false;
 	}
 
+	nwkDataReqRemove(req);
+	nwkDataReqSetState(req, NWK_DATA_REQ_STATE_WAIT_CONF);
 	req->frame = frame;
-	req->state = NWK_DATA_REQ_STATE_WAIT_CONF;
 
 	frame->tx.confirm = nwkDataReqTxConf;
 	frame->tx.control = req->options &
@@ -156,6 +235,8 @@ static void nwkDataReqSendFrame(NWK_DataReq_t *req)
 	frame->size += req->size;
 
 	nwkTxFrame(frame);
+
+	return true;
 }
 
 /*************************************************************************//**
@@ -164,11 +245,17 @@ static void nwkDataReqSendFrame(NWK_DataReq_t *req)
 *****************************************************************************/
 static void nwkDataReqTxConf(NwkFrame_t *frame)
 {
-	for (NWK_DataReq_t *req = nwkDataReqQueue; req; req = req->next) {
+	NwkDataReqQueue_t *queue =
+			&nwkDataReqQueues[NWK_DATA_REQ_STATE_WAIT_CONF];
+
+	/* Frames are mostly confirmed in the order they were sent, so the
+	 * request is usually found at the head */
+	for (NWK_DataReq_t *req = queue->head; req; req = req->next) {
 		if (req->frame == frame) {
 			req->status = frame->tx.status;
 			req->control = frame->tx.control;
-			req->state = NWK_DATA_REQ_STATE_CONFIRM;
+			nwkDataReqRemove(req);
+			nwkDataReqSetState(req, NWK_DATA_REQ_STATE_CONFIRM);
 			break;
 		}
 	}
@@ -182,45 +269,48 @@ static void nwkDataReqTxConf(NwkFrame_t *frame)
 *****************************************************************************/
 static void nwkDataReqConfirm(NWK_DataReq_t *req)
 {
-	if (nwkDataReqQueue == req) {
-		nwkDataReqQueue = nwkDataReqQueue->next;
-	} else {
-		NWK_DataReq_t *prev = nwkDataReqQueue;
-		while (prev->next != req) {
-			prev = prev->next;
-		}
-		prev->next = ((NWK_DataReq_t *)prev->next)->next;
-	}
+	nwkDataReqRemove(req);
 
 	nwkIb.lock--;
 	req->confirm(req);
 }
 
 /*************************************************************************//**
-*  @brief Data Request module task handler
+*  @brief Checks if there are requests to send or confirm
+*****************************************************************************/
+bool nwkDataReqPending(void)
+{
+	if (nwkDataReqQueues[NWK_DATA_REQ_STATE_CONFIRM].head) {
+		return true;
+	}
+
+	return nwkDataReqQueues[NWK_DATA_REQ_STATE_INITIAL].head &&
+			nwkFrameAvailable();
+}
+
+/*************************************************************************//**
+*  @brief Data Request module task handler. Delivers pending confirmations
+*  and sends new requests for as long as there are free frames, both up to
+*  NWK_DATA_REQ_PASS_LIMIT requests per call.
 *****************************************************************************/
 void nwkDataReqTaskHandler(void)
 {
-	for (NWK_DataReq_t *req = nwkDataReqQueue; req; req = req->next) {
-		switch (req->state) {
-		case NWK_DATA_REQ_STATE_INITIAL:
-		{
-			nwkDataReqSendFrame(req);
-			return;
-		}
-		break;
+	NWK_DataReq_t *req;
 
-		case NWK_DATA_REQ_STATE_WAIT_CONF:
-			break;
+	for (uint8_t i = 0; i < NWK_DATA_REQ_PASS_LIMIT; i++) {
+		req = nwkDataReqQueues[NWK_DATA_REQ_STATE_CONFIRM].head;
 
-		case NWK_DATA_REQ_STATE_CONFIRM:
-		{
-			nwkDataReqConfirm(req);
-			return;
+		if (NULL == req) {
+			break;
 		}
-		break;
 
-		default:
+		nwkDataReqConfirm(req);
+	}
+
+	for (uint8_t i = 0; i < NWK_DATA_REQ_PASS_LIMIT; i++) {
+		req = nwkDataReqQueues[NWK_DATA_REQ_STATE_INITIAL].head;
+
+		if (NULL == req || !nwkDataReqSendFrame(req)) {
 			break;
 		}
 	}
@@ -54,6 +54,7 @@ enum {
 
 /*- Variables --------------------------------------------------------------*/
 static NwkFrame_t nwkFrameFrames[NWK_BUFFERS_AMOUNT];
+static NwkFrameQueue_t nwkFrameFreeQueue;
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -62,8 +63,12 @@ static NwkFrame_t nwkFrameFrames[NWK_BUFFERS_AMOUNT];
 *****************************************************************************/
 void nwkFrameInit(void)
 {
+	nwkFrameQueueInit(&nwkFrameFreeQueue);
+
 	for (uint8_t i = 0; i < NWK_BUFFERS_AMOUNT; i++) {
 		nwkFrameFrames[i].state = NWK_FRAME_STATE_FREE;
+		nwkFrameFrames[i].queue = NULL;
+		nwkFrameEnqueue(&nwkFrameFreeQueue, &nwkFrameFrames[i]);
 	}
 }
 
@@ -73,17 +78,27 @@ void nwkFrameInit(void)
 *****************************************************************************/
 NwkFrame_t *nwkFrameAlloc(void)
 {
-	for (uint8_t i = 0; i < NWK_BUFFERS_AMOUNT; i++) {
-		if (NWK_FRAME_STATE_FREE == nwkFrameFrames[i].state) {
-			memset(&nwkFrameFrames[i], 0, sizeof(NwkFrame_t));
-			nwkFrameFrames[i].size = sizeof(NwkFrameHeader_t);
-			nwkFrameFrames[i].payload = nwkFrameFrames[i].data +
-					sizeof(NwkFrameHeader_t);
-			nwkIb.lock++;
-			return &nwkFrameFrames[i];
-		}
+	NwkFrame_t *frame = nwkFrameFreeQueue.head;
+
+	if (NULL == frame) {
+		return NULL;
 	}
-	return NULL;
+
+	nwkFrameDequeue(frame);
+
+	memset(frame, 0, sizeof(NwkFrame_t));
+	frame->size = sizeof(NwkFrameHeader_t);
+	frame->payload = frame->data + sizeof(NwkFrameHeader_t);
+	nwkIb.lock++;
+	return frame;
+}
+
+/*************************************************************************//**
+*  @brief Checks if nwkFrameAlloc() would succeed
+*****************************************************************************/
+bool nwkFrameAvailable(void)
+{
+	return NULL != nwkFrameFreeQueue.head;
 }
 
 /*************************************************************************//**
@@ -93,42 +108,101 @@ NwkFrame_t *nwkFrameAlloc(void)
 void nwkFrameFree(NwkFrame_t *frame)
 {
 	frame->state = NWK_FRAME_STATE_FREE;
+	nwkFrameEnqueue(&nwkFrameFreeQueue, frame);
 	nwkIb.lock--;
 }
 
 /*************************************************************************//**
-*  @brief Cycles through the allocated frames starting from the specified @a
-* frame
-*  @param[in] frame Pointer to the current frame or @c NULL for the first frame
-*  @return Next allocated frame or @c NULL if there are no more frames
+*  @brief Sets default parameters for the the command @a frame
+*  @param[in] frame Pointer to the command frame
 *****************************************************************************/
-NwkFrame_t *nwkFrameNext(NwkFrame_t *frame)
+void nwkFrameCommandInit(NwkFrame_t *frame)
 {
-	if (NULL == frame) {
-		frame = nwkFrameFrames;
+	frame->tx.status = NWK_SUCCESS_STATUS;
+	frame->header.nwkSeq = ++nwkIb.nwkSeqNum;
+	frame->header.nwkSrcAddr = nwkIb.addr;
+#ifdef NWK_ENABLE_SECURE_COMMANDS
+	frame->header.nwkFcf.security = 1;
+#endif
+}
+
+/*************************************************************************//**
+*  @brief Initializes an empty frame @a queue
+*  @param[in] queue Pointer to the queue
+*****************************************************************************/
+void nwkFrameQueueInit(NwkFrameQueue_t *queue)
+{
+	queue->head = NULL;
+	queue->tail = NULL;
+}
+
+/*************************************************************************//**
+*  @brief Moves a @a frame to the end of a @a queue, taking it out of the
+*  queue it was in. Frames are normally queued by the state they are in, so
+*  that each task handler only visits the frames it has to process.
+*  @param[in] queue Pointer to the queue
+*  @param[in] frame Pointer to the frame
+*****************************************************************************/
+void nwkFrameEnqueue(NwkFrameQueue_t *queue, NwkFrame_t *frame)
+{
+	nwkFrameDequeue(frame);
+	nwkFrameInsert(queue, queue->tail, frame);
+}
+
+/*************************************************************************//**
+*  @brief Moves a @a frame to a @a queue right after the frame @a prev,
+*  taking it out of the queue it was in
+*  @param[in] queue Pointer to the queue
+*  @param[in] prev Pointer to a frame in the queue, or @c NULL to insert the
+*  frame at the head of the queue
+*  @param[in] frame Pointer to the frame
+*****************************************************************************/
+void nwkFrameInsert(NwkFrameQueue_t *queue, NwkFrame_t *prev,
+		NwkFrame_t *frame)
+{
+	nwkFrameDequeue(frame);
+
+	frame->prev = prev;
+	frame->next = prev ? prev->next : queue->head;
+
+	if (frame->next) {
+		frame->next->prev = frame;
 	} else {
-		frame++;
+		queue->tail = frame;
 	}
 
-	for (; frame < &nwkFrameFrames[NWK_BUFFERS_AMOUNT]; frame++) {
-		if (NWK_FRAME_STATE_FREE != frame->state) {
-			return frame;
-		}
+	if (prev) {
+		prev->next = frame;
+	} else {
+		queue->head = frame;
 	}
 
-	return NULL;
+	frame->queue = queue;
 }
 
 /*************************************************************************//**
-*  @brief Sets default parameters for the the command @a frame
-*  @param[in] frame Pointer to the command frame
+*  @brief Takes a @a frame out of the queue it is in, if any
+*  @param[in] frame Pointer to the frame
 *****************************************************************************/
-void nwkFrameCommandInit(NwkFrame_t *frame)
+void nwkFrameDequeue(NwkFrame_t *frame)
 {
-	frame->tx.status = NWK_SUCCESS_STATUS;
-	frame->header.nwkSeq = ++nwkIb.nwkSeqNum;
-	frame->header.nwkSrcAddr = nwkIb.addr;
-#ifdef NWK_ENABLE_SECURE_COMMANDS
-	frame->header.nwkFcf.security = 1;
-#endif
+	NwkFrameQueue_t *queue = frame->queue;
+
+	if (NULL == queue) {
+		return;
+	}
+
+	if (frame->prev) {
+		frame->prev->next = frame->next;
+	} else {
+		queue->head = frame->next;
+	}
+
+	if (frame->next) {
+		frame->next->prev = frame->prev;
+	} else {
+		queue->tail = frame->prev;
+	}
+
+	frame->queue = NULL;
 }
@@ -0,0 +1,310 @@
+/**
+ * \file nwkKeySwitch.c
+ *
+ * \brief Coordinated network key switch implementation
+ *
+ * A key switch is announced as a network wide broadcast command carrying the
+ * next network key and a delay (in seconds). The command is secured with the
+ * current network key, so the next key never goes over the air in the clear.
+ * Every router relays the command, adds the next key to its key table and
+ * arms a local timer. When the timer fires, the next key is used for outgoing
+ * frames, while frames secured with the previous key are still accepted for
+ * NWK_KEY_SWITCH_GRACE_TIME, and for as long as a known peer still uses it,
+ * up to NWK_KEY_SWITCH_MAX_GRACE_TIME. Nodes which switch a bit late are
+ * therefore never cut off.
+ *
+ * Sleeping nodes miss the broadcast. When a frame secured with the previous
+ * key arrives during the grace time, the command is sent once more to its
+ * source, secured with the previous key and without delay, while the source
+ * is still awake waiting for the acknowledgement.
+ */
+
+/*- Includes ---------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "sysConfig.h"
+#include "sysTimer.h"
+#include "nwk.h"
+#include "nwkTx.h"
+#include "nwkFrame.h"
+#include "nwkCommand.h"
+#include "nwkKeySwitch.h"
+
+#ifdef NWK_ENABLE_KEY_SWITCH
+
+/*- Definitions ------------------------------------------------------------*/
+#define NWK_KEY_SWITCH_DELAY_UNIT    1000ul /* ms */
+
+/*- Prototypes -------------------------------------------------------------*/
+static void nwkKeySwitchTimerHandler(SYS_Timer_t *timer);
+
+/*- Variables --------------------------------------------------------------*/
+static SYS_Timer_t nwkKeySwitchTimer;
+static uint8_t nwkKeySwitchKeyId;
+static uint8_t nwkKeySwitchKey[NWK_SECURITY_KEY_SIZE];
+static uint8_t nwkKeySwitchPreviousKeyId;
+static bool nwkKeySwitchGrace;
+/* Grace time which may still be added while the previous key is in use */
+static uint32_t nwkKeySwitchGraceLeft;
+static void (*nwkKeySwitchHandler)(uint8_t keyId);
+
+/*- Implementations --------------------------------------------------------*/
+
+/*************************************************************************//**
+*  @brief Initializes the Key Switch module
+*****************************************************************************/
+void nwkKeySwitchInit(void)
+{
+	nwkKeySwitchGrace = false;
+	nwkKeySwitchHandler = NULL;
+
+	nwkKeySwitchTimer.mode = SYS_TIMER_INTERVAL_MODE;
+	nwkKeySwitchTimer.handler = nwkKeySwitchTimerHandler;
+}
+
+/*************************************************************************//**
+*  @brief Drops the previous network key once nothing is secured with it
+*****************************************************************************/
+static void nwkKeySwitchEndGrace(void)
+{
+	if (nwkKeySwitchGrace) {
+		(void)NWK_RemoveSecurityKey(nwkKeySwitchPreviousKeyId);
+		nwkKeySwitchGrace = false;
+	}
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkKeySwitchSchedule(uint8_t keyId, uint8_t *key, uint16_t delay)
+{
+	SYS_TimerStop(&nwkKeySwitchTimer);
+
+	/* A new switch cuts the grace window of the previous one short, so that
+	 * at most two network keys are in use. The previous key stays if it is
+	 * the one switched to. */
+	if (keyId == nwkKeySwitchPreviousKeyId) {
+		nwkKeySwitchGrace = false;
+	}
+
+	nwkKeySwitchEndGrace();
+
+	nwkKeySwitchKeyId = keyId;
+	memcpy(nwkKeySwitchKey, key, NWK_SECURITY_KEY_SIZE);
+	nwkKeySwitchTimer.interval
+		= (uint32_t)delay * NWK_KEY_SWITCH_DELAY_UNIT + 1;
+
+	SYS_TimerStart(&nwkKeySwitchTimer);
+}
+
+/*************************************************************************//**
+*  @brief Checks if the key with ID @a keyId may become a network key
+*  @return @c false if the ID belongs to a group or link key, which would
+*  otherwise be replaced
+*****************************************************************************/
+static bool nwkKeySwitchKeyIdFree(uint8_t keyId)
+{
+	NWK_SecurityKeyType_t type = NWK_SecurityKeyType(keyId);
+
+	return NWK_SECURITY_KEY_NONE == type || NWK_SECURITY_KEY_NETWORK == type;
+}
+
+/*************************************************************************//**
+*  @brief Sends the key switch command for the next key to @a dst
+*  @param[in] dst Destination, NWK_BROADCAST_ADDR for the whole network
+*  @param[in] control NWK_TX_CONTROL_PEER_KEY to secure a unicast command
+*  with the key used by @a dst
+*  @param[in] delay Time until the switch takes place (in seconds)
+*  @return @c true if the command was queued or @c false otherwise
+*****************************************************************************/
+static bool nwkKeySwitchSendCommand(uint16_t dst, uint8_t control,
+		uint16_t delay)
+{
+	NwkFrame_t *req;
+	NwkCommandKeySwitch_t *command;
+
+	if (NULL == (req = nwkFrameAlloc())) {
+		return false;
+	}
+
+	nwkFrameCommandInit(req);
+
+	req->size += sizeof(NwkCommandKeySwitch_t);
+	req->tx.confirm = NULL;
+	req->tx.control = control;
+
+	req->header.nwkFcf.security = 1;
+	req->header.nwkDstAddr = dst;
+
+	command = (NwkCommandKeySwitch_t *)req->payload;
+	command->id = NWK_COMMAND_KEY_SWITCH;
+	command->keyId = nwkKeySwitchKeyId;
+	memcpy(command->key, nwkKeySwitchKey, NWK_SECURITY_KEY_SIZE);
+	command->delay = delay;
+
+	nwkTxFrame(req);
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Broadcasts the next network key to the whole network and schedules
+*  the local switch to it
+*  @param[in] keyId ID of the next key, different from the active one and
+*  not used by a group or link key
+*  @param[in] key Value of the next key
+*  @param[in] delay Time until the switch takes place (in seconds)
+*  @return @c true if the command was queued or @c false otherwise
+*****************************************************************************/
+bool NWK_KeySwitchReq(uint8_t keyId, uint8_t *key, uint16_t delay)
+{
+	if (keyId == NWK_ActiveSecurityKey() || !nwkKeySwitchKeyIdFree(keyId)) {
+		return false;
+	}
+
+	if (!nwkFrameAvailable()) {
+		return false;
+	}
+
+	if (!NWK_AddSecurityKey(keyId, NWK_SECURITY_KEY_NETWORK, 0, key)) {
+		return false;
+	}
+
+	nwkKeySwitchSchedule(keyId, key, delay);
+
+	return nwkKeySwitchSendCommand(NWK_BROADCAST_ADDR, 0, delay);
+}
+
+/*************************************************************************//**
+*  @brief Checks if a key switch has been scheduled, but not yet performed
+*  @param[out] keyId ID of the key that will be switched to (may be NULL)
+*  @return @c true if a switch is pending or @c false otherwise
+*****************************************************************************/
+bool NWK_KeySwitchPending(uint8_t *keyId)
+{
+	if (nwkKeySwitchGrace || !SYS_TimerStarted(&nwkKeySwitchTimer)) {
+		return false;
+	}
+
+	if (keyId) {
+		*keyId = nwkKeySwitchKeyId;
+	}
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Registers a callback which is called after the key was switched
+*  @param[in] handler Pointer to the callback function
+*****************************************************************************/
+void NWK_SetKeySwitchHandler(void (*handler)(uint8_t keyId))
+{
+	nwkKeySwitchHandler = handler;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+bool nwkKeySwitchReceived(NWK_DataInd_t *ind)
+{
+	NwkCommandKeySwitch_t *command = (NwkCommandKeySwitch_t *)ind->data;
+	uint8_t keyId;
+
+	if (sizeof(NwkCommandKeySwitch_t) != ind->size) {
+		return false;
+	}
+
+	/* Holders of a group or link key must not be able to hand out network
+	 * keys. Broadcasts are always secured with a network key, the command
+	 * for a node which missed the switch is checked for it. */
+	if (0 == (ind->options & NWK_IND_OPT_SECURED)) {
+		return false;
+	}
+
+	if (NWK_BROADCAST_ADDR != ind->dstAddr) {
+		if (!nwkSecurityPeerKey(ind->srcAddr, &keyId)) {
+			return false;
+		}
+
+		if (NWK_SECURITY_KEY_NETWORK != NWK_SecurityKeyType(keyId)) {
+			return false;
+		}
+	}
+
+	/* Relayed copies of a command which has already been handled */
+	if (command->keyId == NWK_ActiveSecurityKey() ||
+			(NWK_KeySwitchPending(NULL) &&
+			command->keyId == nwkKeySwitchKeyId)) {
+		return true;
+	}
+
+	if (!nwkKeySwitchKeyIdFree(command->keyId)) {
+		return false;
+	}
+
+	if (!NWK_AddSecurityKey(command->keyId, NWK_SECURITY_KEY_NETWORK, 0,
+			command->key)) {
+		return false;
+	}
+
+	nwkKeySwitchSchedule(command->keyId, command->key, command->delay);
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Hands the active network key to the source of a frame which was
+*  secured with the previous one during the grace time
+*****************************************************************************/
+void nwkKeySwitchFrameReceived(uint16_t src)
+{
+	uint8_t keyId;
+
+	if (!nwkKeySwitchGrace || !nwkSecurityPeerKey(src, &keyId) ||
+			keyId != nwkKeySwitchPreviousKeyId) {
+		return;
+	}
+
+	(void)nwkKeySwitchSendCommand(src, NWK_TX_CONTROL_PEER_KEY, 0);
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkKeySwitchTimerHandler(SYS_Timer_t *timer)
+{
+	if (nwkKeySwitchGrace) {
+		if (nwkKeySwitchGraceLeft > 0 &&
+				nwkSecurityKeyInUse(nwkKeySwitchPreviousKeyId)) {
+			timer->interval = nwkKeySwitchGraceLeft;
+
+			if (timer->interval > NWK_KEY_SWITCH_GRACE_TIME) {
+				timer->interval = NWK_KEY_SWITCH_GRACE_TIME;
+			}
+
+			nwkKeySwitchGraceLeft -= timer->interval;
+			SYS_TimerStart(timer);
+			return;
+		}
+
+		nwkKeySwitchEndGrace();
+		return;
+	}
+
+	nwkKeySwitchPreviousKeyId = NWK_ActiveSecurityKey();
+
+	if (!NWK_SetActiveSecurityKey(nwkKeySwitchKeyId)) {
+		return;
+	}
+
+	nwkKeySwitchGrace = true;
+	nwkKeySwitchGraceLeft = NWK_KEY_SWITCH_MAX_GRACE_TIME -
+			NWK_KEY_SWITCH_GRACE_TIME;
+	timer->interval = NWK_KEY_SWITCH_GRACE_TIME;
+	SYS_TimerStart(timer);
+
+	if (nwkKeySwitchHandler) {
+		nwkKeySwitchHandler(nwkKeySwitchKeyId);
+	}
+}
+
+#endif /* NWK_ENABLE_KEY_SWITCH */
@@ -54,19 +54,185 @@
 #ifdef NWK_ENABLE_ROUTING
 
 /*- Definitions ------------------------------------------------------------*/
-#define NWK_ROUTE_MAX_RANK         255
-#define NWK_ROUTE_DEFAULT_RANK     128
+#define NWK_ROUTE_REFERENCED       1
+#define NWK_ROUTE_HASH_SIZE        (1 << NWK_ROUTE_HASH_BITS)
+#define NWK_ROUTE_INDEX_END        0xff
 
 /*- Prototypes -------------------------------------------------------------*/
 static void nwkRouteSendRouteError(uint16_t src, uint16_t dst,
 		uint8_t multicast);
-static void nwkRouteNormalizeRanks(void);
+
+/*- Types ------------------------------------------------------------------*/
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+typedef struct NwkRouteParent_t {
+	uint16_t addr;
+	uint8_t lqi;
+} NwkRouteParent_t;
+#endif
 
 /*- Variables --------------------------------------------------------------*/
 static NWK_RouteTableEntry_t nwkRouteTable[NWK_ROUTE_TABLE_SIZE];
 
+/* Hash index over (dstAddr, multicast). Every bucket is a chain of table
+ * entries linked through nwkRouteNext. */
+static uint8_t nwkRouteBuckets[NWK_ROUTE_HASH_SIZE];
+static uint8_t nwkRouteNext[NWK_ROUTE_TABLE_SIZE];
+static uint8_t nwkRouteBucketOf[NWK_ROUTE_TABLE_SIZE];
+
+/* Entry returned by NWK_RouteNewEntry(), which is indexed once the caller
+ * has filled in the destination */
+static NWK_RouteTableEntry_t *nwkRoutePending;
+
+/* Set when the table has been handed out and might have been modified */
+static bool nwkRouteIndexStale;
+
+/* Unused entries, linked through nwkRouteNext. An unused entry is never in a
+ * bucket chain, so the links can be shared. */
+static uint8_t nwkRouteFreeHead;
+
+/* Position of the second-chance sweep used to find an entry to evict. The
+ * rank of an entry is its reference bit. */
+static uint8_t nwkRouteClockHand;
+
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+static NwkRouteParent_t nwkRouteParents[NWK_ROUTE_PARENT_TABLE_SIZE];
+#endif
+
 /*- Implementations --------------------------------------------------------*/
 
+/*************************************************************************//**
+*****************************************************************************/
+static inline uint8_t nwkRouteHash(uint16_t dst, uint8_t multicast)
+{
+	uint16_t key = multicast ? (dst ^ 0x8000) : dst;
+
+	return (uint16_t)(key * 40503u) >> (16 - NWK_ROUTE_HASH_BITS);
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkRouteIndexAdd(uint8_t i)
+{
+	uint8_t bucket;
+
+	if (NWK_ROUTE_UNKNOWN == nwkRouteTable[i].dstAddr) {
+		return;
+	}
+
+	bucket = nwkRouteHash(nwkRouteTable[i].dstAddr,
+			nwkRouteTable[i].multicast);
+
+	nwkRouteNext[i] = nwkRouteBuckets[bucket];
+	nwkRouteBuckets[bucket] = i;
+	nwkRouteBucketOf[i] = bucket;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkRouteIndexRemove(uint8_t i)
+{
+	uint8_t *link;
+
+	if (NWK_ROUTE_INDEX_END == nwkRouteBucketOf[i]) {
+		return;
+	}
+
+	link = &nwkRouteBuckets[nwkRouteBucketOf[i]];
+
+	while (*link != i) {
+		link = &nwkRouteNext[*link];
+	}
+
+	*link = nwkRouteNext[i];
+	nwkRouteBucketOf[i] = NWK_ROUTE_INDEX_END;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkRouteFreeListPush(uint8_t i)
+{
+	nwkRouteNext[i] = nwkRouteFreeHead;
+	nwkRouteFreeHead = i;
+}
+
+/*************************************************************************//**
+*  @brief Rebuilds the whole index and the list of unused entries from the
+*  table
+*****************************************************************************/
+static void nwkRouteIndexRebuild(void)
+{
+	for (uint16_t i = 0; i < NWK_ROUTE_HASH_SIZE; i++) {
+		nwkRouteBuckets[i] = NWK_ROUTE_INDEX_END;
+	}
+
+	nwkRouteFreeHead = NWK_ROUTE_INDEX_END;
+
+	for (uint8_t i = NWK_ROUTE_TABLE_SIZE; i > 0; i--) {
+		nwkRouteBucketOf[i - 1] = NWK_ROUTE_INDEX_END;
+
+		if (NWK_ROUTE_UNKNOWN == nwkRouteTable[i - 1].dstAddr) {
+			nwkRouteFreeListPush(i - 1);
+		} else {
+			nwkRouteIndexAdd(i - 1);
+		}
+	}
+
+	nwkRoutePending = NULL;
+	nwkRouteIndexStale = false;
+}
+
+/*************************************************************************//**
+*  @brief Brings the index up to date with changes made to the table entries
+*  outside of this module
+*****************************************************************************/
+static void nwkRouteIndexUpdate(void)
+{
+	if (nwkRouteIndexStale) {
+		nwkRouteIndexRebuild();
+	} else if (nwkRoutePending) {
+		uint8_t i = nwkRoutePending - nwkRouteTable;
+
+		/* The caller might not have used the entry after all */
+		if (NWK_ROUTE_UNKNOWN == nwkRoutePending->dstAddr) {
+			nwkRouteFreeListPush(i);
+		} else {
+			nwkRouteIndexAdd(i);
+		}
+
+		nwkRoutePending = NULL;
+	}
+}
+
+/*************************************************************************//**
+*  @brief Finds an entry to evict with a second-chance sweep. Entries
+*  referenced since the last pass of the hand are spared once, fixed entries
+*  are never evicted.
+*****************************************************************************/
+static NWK_RouteTableEntry_t *nwkRouteEvict(void)
+{
+	for (uint16_t n = 0; n < 2 * NWK_ROUTE_TABLE_SIZE; n++) {
+		NWK_RouteTableEntry_t *entry = &nwkRouteTable[nwkRouteClockHand];
+
+		if (++nwkRouteClockHand == NWK_ROUTE_TABLE_SIZE) {
+			nwkRouteClockHand = 0;
+		}
+
+		if (entry->fixed) {
+			continue;
+		}
+
+		if (entry->rank) {
+			entry->rank = 0;
+			continue;
+		}
+
+		nwkRouteIndexRemove(entry - nwkRouteTable);
+		return entry;
+	}
+
+	return NULL;
+}
+
 /*************************************************************************//**
 *  @brief Initializes the Routing module
 *****************************************************************************/
@@ -77,13 +243,25 @@ void nwkRouteInit(void)
 		nwkRouteTable[i].fixed = 0;
 		nwkRouteTable[i].rank = 0;
 	}
+
+	nwkRouteIndexRebuild();
+	nwkRouteClockHand = 0;
+
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+	for (uint8_t i = 0; i < NWK_ROUTE_PARENT_TABLE_SIZE; i++) {
+		nwkRouteParents[i].addr = NWK_ROUTE_UNKNOWN;
+	}
+#endif
 }
 
 /*************************************************************************//**
 *****************************************************************************/
 NWK_RouteTableEntry_t *NWK_RouteFindEntry(uint16_t dst, uint8_t multicast)
 {
-	for (uint8_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++) {
+	nwkRouteIndexUpdate();
+
+	for (uint8_t i = nwkRouteBuckets[nwkRouteHash(dst, multicast)];
+			NWK_ROUTE_INDEX_END != i; i = nwkRouteNext[i]) {
 		if (nwkRouteTable[i].dstAddr == dst &&
 				nwkRouteTable[i].multicast == multicast) {
 			return &nwkRouteTable[i];
@@ -97,27 +275,28 @@ NWK_RouteTableEntry_t *NWK_RouteFindEntry(uint16_t dst, uint8_t multicast)
 *****************************************************************************/
 NWK_RouteTableEntry_t *NWK_RouteNewEntry(void)
 {
-	NWK_RouteTableEntry_t *iter = nwkRouteTable;
-	NWK_RouteTableEntry_t *entry = NULL;
+	NWK_RouteTableEntry_t *entry;
 
-	for (uint8_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++, iter++) {
-		if (iter->fixed) {
-			continue;
-		}
+	nwkRouteIndexUpdate();
 
-		if (0 == iter->rank) {
-			entry = iter;
-			break;
-		}
+	if (NWK_ROUTE_INDEX_END != nwkRouteFreeHead) {
+		entry = &nwkRouteTable[nwkRouteFreeHead];
+		nwkRouteFreeHead = nwkRouteNext[nwkRouteFreeHead];
+	} else {
+		entry = nwkRouteEvict();
 
-		if (NULL == entry || iter->rank < entry->rank) {
-			entry = iter;
+		if (NULL == entry) {
+			return NULL;
 		}
 	}
 
+	nwkRoutePending = entry;
+
+	entry->dstAddr = NWK_ROUTE_UNKNOWN;
 	entry->multicast = 0;
+	entry->repaired = 0;
 	entry->score = NWK_ROUTE_DEFAULT_SCORE;
-	entry->rank = NWK_ROUTE_DEFAULT_RANK;
+	entry->rank = NWK_ROUTE_REFERENCED;
 
 	return entry;
 }
@@ -130,6 +309,15 @@ void NWK_RouteFreeEntry(NWK_RouteTableEntry_t *entry)
 		return;
 	}
 
+	nwkRouteIndexUpdate();
+
+	if (NWK_ROUTE_UNKNOWN == entry->dstAddr) {
+		return;
+	}
+
+	nwkRouteIndexRemove(entry - nwkRouteTable);
+	nwkRouteFreeListPush(entry - nwkRouteTable);
+
 	entry->dstAddr = NWK_ROUTE_UNKNOWN;
 	entry->rank = 0;
 }
@@ -152,6 +340,7 @@ uint16_t NWK_RouteNextHop(uint16_t dst, uint8_t multicast)
 *****************************************************************************/
 NWK_RouteTableEntry_t *NWK_RouteTable(void)
 {
+	nwkRouteIndexStale = true;
 	return nwkRouteTable;
 }
 
@@ -166,13 +355,18 @@ void nwkRouteUpdateEntry(uint16_t dst, uint8_t multicast, uint16_t nextHop,
 
 	if (NULL == entry) {
 		entry = NWK_RouteNewEntry();
+
+		if (NULL == entry) {
+			return;
+		}
 	}
 
 	entry->dstAddr = dst;
 	entry->nextHopAddr = nextHop;
 	entry->multicast = multicast;
+	entry->repaired = 0;
 	entry->score = NWK_ROUTE_DEFAULT_SCORE;
-	entry->rank = NWK_ROUTE_DEFAULT_RANK;
+	entry->rank = NWK_ROUTE_REFERENCED;
 	entry->lqi = lqi;
 }
 
@@ -188,10 +382,92 @@ void nwkRouteRemove(uint16_t dst, uint8_t multicast)
 	}
 }
 
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+/*************************************************************************//**
+*  @brief Keeps track of the routing nodes heard directly with the best link
+*  quality, which are the candidates for the next hop when a route fails
+*****************************************************************************/
+static void nwkRouteUpdateParents(NwkFrame_t *frame)
+{
+	uint16_t addr = frame->header.macSrcAddr;
+	NwkRouteParent_t *parent = NULL;
+
+	if (addr & NWK_ROUTE_NON_ROUTING) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < NWK_ROUTE_PARENT_TABLE_SIZE; i++) {
+		if (nwkRouteParents[i].addr == addr) {
+			nwkRouteParents[i].lqi = frame->rx.lqi;
+			return;
+		}
+	}
+
+	/* Replace a free entry, or else the one with the worst link quality */
+	for (uint8_t i = 0; i < NWK_ROUTE_PARENT_TABLE_SIZE; i++) {
+		if (NWK_ROUTE_UNKNOWN == nwkRouteParents[i].addr) {
+			parent = &nwkRouteParents[i];
+			break;
+		}
+
+		if (NULL == parent || nwkRouteParents[i].lqi < parent->lqi) {
+			parent = &nwkRouteParents[i];
+		}
+	}
+
+	if (NWK_ROUTE_UNKNOWN == parent->addr ||
+			frame->rx.lqi > parent->lqi) {
+		parent->addr = addr;
+		parent->lqi = frame->rx.lqi;
+	}
+}
+
+/*************************************************************************//**
+*  @brief Tries to repair a failing route by sending through the parent with
+*  the best link quality instead, before the route is discovered again
+*  @return @c true if a parent was selected
+*****************************************************************************/
+static bool nwkRouteRepair(NWK_RouteTableEntry_t *entry)
+{
+	NwkRouteParent_t *parent = NULL;
+
+	if (entry->repaired || entry->multicast) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < NWK_ROUTE_PARENT_TABLE_SIZE; i++) {
+		if (NWK_ROUTE_UNKNOWN == nwkRouteParents[i].addr ||
+				entry->nextHopAddr == nwkRouteParents[i].addr) {
+			continue;
+		}
+
+		if (NULL == parent || nwkRouteParents[i].lqi > parent->lqi) {
+			parent = &nwkRouteParents[i];
+		}
+	}
+
+	if (NULL == parent) {
+		return false;
+	}
+
+	entry->nextHopAddr = parent->addr;
+	entry->lqi = parent->lqi;
+	entry->score = NWK_ROUTE_DEFAULT_SCORE;
+	entry->repaired = 1;
+
+	return true;
+}
+
+#endif /* NWK_ENABLE_ROUTE_REPAIR */
+
 /*************************************************************************//**
 *****************************************************************************/
 void nwkRouteFrameReceived(NwkFrame_t *frame)
 {
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+	nwkRouteUpdateParents(frame);
+#endif
+
 #ifndef NWK_ENABLE_ROUTE_DISCOVERY
 	NwkFrameHeader_t *header = &frame->header;
 	NWK_RouteTableEntry_t *entry;
@@ -219,6 +495,10 @@ void nwkRouteFrameReceived(NwkFrame_t *frame)
 	} else {
 		entry = NWK_RouteNewEntry();
 
+		if (NULL == entry) {
+			return;
+		}
+
 		entry->dstAddr = header->nwkSrcAddr;
 		entry->nextHopAddr = header->macSrcAddr;
 	}
@@ -242,18 +522,34 @@ void nwkRouteFrameSent(NwkFrame_t *frame)
 	entry = NWK_RouteFindEntry(frame->header.nwkDstAddr,
 			frame->header.nwkFcf.multicast);
 
-	if (NULL == entry || entry->fixed) {
+	if (NULL == entry) {
+		return;
+	}
+
+	if (entry->fixed) {
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+		/* A pinned route is only revalidated when it fails */
+		if (NWK_SUCCESS_STATUS == frame->tx.status) {
+			return;
+		}
+
+		entry->fixed = 0;
+#else
 		return;
+#endif
 	}
 
 	if (NWK_SUCCESS_STATUS == frame->tx.status) {
 		entry->score = NWK_ROUTE_DEFAULT_SCORE;
-
-		if (NWK_ROUTE_MAX_RANK == ++entry->rank) {
-			nwkRouteNormalizeRanks();
-		}
+		entry->repaired = 0;
+		entry->rank = NWK_ROUTE_REFERENCED;
 	} else {
 		if (0 == --entry->score) {
+#ifdef NWK_ENABLE_ROUTE_REPAIR
+			if (nwkRouteRepair(entry)) {
+				return;
+			}
+#endif
 			NWK_RouteFreeEntry(entry);
 		}
 	}
@@ -353,13 +649,4 @@ bool nwkRouteErrorReceived(NWK_DataInd_t *ind)
 	return true;
 }
 
-/*************************************************************************//**
-*****************************************************************************/
-static void nwkRouteNormalizeRanks(void)
-{
-	for (uint8_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++) {
-		nwkRouteTable[i].rank = (nwkRouteTable[i].rank >> 1) + 1;
-	}
-}
-
 #endif /* NWK_ENABLE_ROUTING */
@@ -91,6 +91,7 @@ static uint8_t nwkRouteDiscoveryUpdateLq(uint8_t lqa, uint8_t lqb);
 static NwkRouteDiscoveryTableEntry_t nwkRouteDiscoveryTable[
 	NWK_ROUTE_DISCOVERY_TABLE_SIZE];
 static SYS_Timer_t nwkRouteDiscoveryTimer;
+static NwkFrameQueue_t nwkRouteDiscoveryQueue;
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -106,6 +107,8 @@ void nwkRouteDiscoveryInit(void)
 	nwkRouteDiscoveryTimer.interval = NWK_ROUTE_DISCOVERY_TIMER_INTERVAL;
 	nwkRouteDiscoveryTimer.mode = SYS_TIMER_INTERVAL_MODE;
 	nwkRouteDiscoveryTimer.handler = nwkRouteDiscoveryTimerHandler;
+
+	nwkFrameQueueInit(&nwkRouteDiscoveryQueue);
 }
 
 /*************************************************************************//**
@@ -120,6 +123,7 @@ void nwkRouteDiscoveryRequest(NwkFrame_t *frame)
 
 	if (entry) {
 		frame->state = NWK_RD_STATE_WAIT_FOR_ROUTE;
+		nwkFrameEnqueue(&nwkRouteDiscoveryQueue, frame);
 		return;
 	}
 
@@ -134,6 +138,7 @@ void nwkRouteDiscoveryRequest(NwkFrame_t *frame)
 		if (nwkRouteDiscoverySendRequest(entry,
 				NWK_ROUTE_DISCOVERY_BEST_LINK_QUALITY)) {
 			frame->state = NWK_RD_STATE_WAIT_FOR_ROUTE;
+			nwkFrameEnqueue(&nwkRouteDiscoveryQueue, frame);
 			return;
 		}
 	}
@@ -386,23 +391,26 @@ bool nwkRouteDiscoveryReplyReceived(NWK_DataInd_t *ind)
 static void nwkRouteDiscoveryDone(NwkRouteDiscoveryTableEntry_t *entry,
 		bool status)
 {
-	NwkFrame_t *frame = NULL;
+	NwkFrame_t *frame, *next;
+	NwkFrame_t *last = nwkRouteDiscoveryQueue.tail;
 
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		if (NWK_RD_STATE_WAIT_FOR_ROUTE != frame->state) {
-			continue;
-		}
+	/* Frames sent again might be queued once more, so only the frames which
+	 * were waiting when the discovery finished are visited */
+	for (frame = nwkRouteDiscoveryQueue.head; frame; frame = next) {
+		next = frame->next;
 
-		if (entry->dstAddr != frame->header.nwkDstAddr ||
-				entry->multicast !=
+		if (entry->dstAddr == frame->header.nwkDstAddr &&
+				entry->multicast ==
 				frame->header.nwkFcf.multicast) {
-			continue;
+			if (status) {
+				nwkTxFrame(frame);
+			} else {
+				nwkTxConfirm(frame, NWK_NO_ROUTE_STATUS);
+			}
 		}
 
-		if (status) {
-			nwkTxFrame(frame);
-		} else {
-			nwkTxConfirm(frame, NWK_NO_ROUTE_STATUS);
+		if (frame == last) {
+			break;
 		}
 	}
 }
@@ -54,12 +54,14 @@
 #include "nwkCommand.h"
 #include "nwkSecurity.h"
 #include "nwkRouteDiscovery.h"
+#include "nwkChannelSwitch.h"
+#include "nwkKeySwitch.h"
+#include "nwkTxPower.h"
 
 /*- Definitions ------------------------------------------------------------*/
-#define NWK_RX_DUPLICATE_REJECTION_TIMER_INTERVAL   100 /* ms */
-#define DUPLICATE_REJECTION_TTL	\
-	((NWK_DUPLICATE_REJECTION_TTL /	\
-	NWK_RX_DUPLICATE_REJECTION_TIMER_INTERVAL) + 1)
+#define NWK_RX_DUPLICATE_REJECTION_HASH_SIZE \
+	(1 << NWK_DUPLICATE_REJECTION_HASH_BITS)
+#define NWK_RX_DUPLICATE_REJECTION_END  0xff
 #define NWK_SERVICE_ENDPOINT_ID    0
 
 /*- Types ------------------------------------------------------------------*/
@@ -71,22 +73,35 @@ enum {
 	NWK_RX_STATE_FINISH   = 0x24,
 };
 
+#define NWK_RX_STATES_AMOUNT   5
+
 typedef struct NwkDuplicateRejectionEntry_t {
 	uint16_t src;
 	uint8_t seq;
 	uint8_t mask;
-	uint8_t ttl;
+	uint32_t expiry;
 } NwkDuplicateRejectionEntry_t;
 
 /*- Prototypes -------------------------------------------------------------*/
-static void nwkRxDuplicateRejectionTimerHandler(SYS_Timer_t *timer);
 static bool nwkRxSeriveDataInd(NWK_DataInd_t *ind);
 
 /*- Variables --------------------------------------------------------------*/
 static NwkDuplicateRejectionEntry_t nwkRxDuplicateRejectionTable[
 	NWK_DUPLICATE_REJECTION_TABLE_SIZE];
 static uint8_t nwkRxAckControl;
-static SYS_Timer_t nwkRxDuplicateRejectionTimer;
+static NwkFrameQueue_t nwkRxQueues[NWK_RX_STATES_AMOUNT];
+
+/* Entries in use are chained by the hash of their source address, unused
+ * entries are on the free list. Both are linked through
+ * nwkRxDuplicateRejectionNext. */
+static uint8_t nwkRxDuplicateRejectionBuckets[
+	NWK_RX_DUPLICATE_REJECTION_HASH_SIZE];
+static uint8_t nwkRxDuplicateRejectionNext[
+	NWK_DUPLICATE_REJECTION_TABLE_SIZE];
+static uint8_t nwkRxDuplicateRejectionFree;
+
+/* Position of the search for expired entries when the free list is empty */
+static uint8_t nwkRxDuplicateRejectionHand;
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -95,19 +110,44 @@ static SYS_Timer_t nwkRxDuplicateRejectionTimer;
 *****************************************************************************/
 void nwkRxInit(void)
 {
+	for (uint8_t i = 0; i < NWK_RX_STATES_AMOUNT; i++) {
+		nwkFrameQueueInit(&nwkRxQueues[i]);
+	}
+
+	for (uint16_t i = 0; i < NWK_RX_DUPLICATE_REJECTION_HASH_SIZE; i++) {
+		nwkRxDuplicateRejectionBuckets[i]
+			= NWK_RX_DUPLICATE_REJECTION_END;
+	}
+
 	for (uint8_t i = 0; i < NWK_DUPLICATE_REJECTION_TABLE_SIZE; i++) {
-		nwkRxDuplicateRejectionTable[i].ttl = 0;
+		nwkRxDuplicateRejectionNext[i] = i + 1;
 	}
 
-	nwkRxDuplicateRejectionTimer.interval
-		= NWK_RX_DUPLICATE_REJECTION_TIMER_INTERVAL;
-	nwkRxDuplicateRejectionTimer.mode = SYS_TIMER_INTERVAL_MODE;
-	nwkRxDuplicateRejectionTimer.handler
-		= nwkRxDuplicateRejectionTimerHandler;
+	nwkRxDuplicateRejectionNext[NWK_DUPLICATE_REJECTION_TABLE_SIZE - 1]
+		= NWK_RX_DUPLICATE_REJECTION_END;
+	nwkRxDuplicateRejectionFree = 0;
+	nwkRxDuplicateRejectionHand = 0;
 
 	NWK_OpenEndpoint(NWK_SERVICE_ENDPOINT_ID, nwkRxSeriveDataInd);
 }
 
+/*************************************************************************//**
+*****************************************************************************/
+static inline NwkFrameQueue_t *nwkRxQueue(uint8_t state)
+{
+	return &nwkRxQueues[state - NWK_RX_STATE_RECEIVED];
+}
+
+/*************************************************************************//**
+*  @brief Sets the @a state of a @a frame and moves it to the queue of that
+*  state
+*****************************************************************************/
+static void nwkRxSetState(NwkFrame_t *frame, uint8_t state)
+{
+	frame->state = state;
+	nwkFrameEnqueue(nwkRxQueue(state), frame);
+}
+
 /*************************************************************************//**
 *****************************************************************************/
 void PHY_DataInd(PHY_DataInd_t *ind)
@@ -124,7 +164,7 @@ void PHY_DataInd(PHY_DataInd_t *ind)
 		return;
 	}
 
-	frame->state = NWK_RX_STATE_RECEIVED;
+	nwkRxSetState(frame, NWK_RX_STATE_RECEIVED);
 	frame->size = ind->size;
 	frame->rx.lqi = ind->lqi;
 	frame->rx.rssi = ind->rssi;
@@ -172,9 +212,16 @@ void NWK_SetAckControl(uint8_t control)
 void nwkRxDecryptConf(NwkFrame_t *frame, bool status)
 {
 	if (status) {
-		frame->state = NWK_RX_STATE_INDICATE;
+#ifdef NWK_ENABLE_KEY_SWITCH
+		/* Only data frames, so that the key switch commands sent to
+		 * nodes which missed the switch are never answered */
+		if (NWK_SERVICE_ENDPOINT_ID != frame->header.nwkDstEndpoint) {
+			nwkKeySwitchFrameReceived(frame->header.nwkSrcAddr);
+		}
+#endif
+		nwkRxSetState(frame, NWK_RX_STATE_INDICATE);
 	} else {
-		frame->state = NWK_RX_STATE_FINISH;
+		nwkRxSetState(frame, NWK_RX_STATE_FINISH);
 	}
 }
 
@@ -182,20 +229,58 @@ void nwkRxDecryptConf(NwkFrame_t *frame, bool status)
 
 /*************************************************************************//**
 *****************************************************************************/
-static void nwkRxDuplicateRejectionTimerHandler(SYS_Timer_t *timer)
+static inline uint8_t nwkRxDuplicateRejectionHash(uint16_t src)
 {
-	bool restart = false;
+	return (uint16_t)(src * 40503u) >>
+			(16 - NWK_DUPLICATE_REJECTION_HASH_BITS);
+}
 
-	for (uint8_t i = 0; i < NWK_DUPLICATE_REJECTION_TABLE_SIZE; i++) {
-		if (nwkRxDuplicateRejectionTable[i].ttl) {
-			nwkRxDuplicateRejectionTable[i].ttl--;
-			restart = true;
-		}
+/*************************************************************************//**
+*****************************************************************************/
+static inline bool nwkRxDuplicateRejectionExpired(uint8_t i, uint32_t time)
+{
+	return (int32_t)(nwkRxDuplicateRejectionTable[i].expiry - time) <= 0;
+}
+
+/*************************************************************************//**
+*  @brief Returns an unused entry, or an entry which has expired if there are
+*  none, or NWK_RX_DUPLICATE_REJECTION_END if every entry is in use
+*****************************************************************************/
+static uint8_t nwkRxDuplicateRejectionAlloc(uint32_t time)
+{
+	uint8_t i = nwkRxDuplicateRejectionFree;
+	uint8_t *link;
+
+	if (NWK_RX_DUPLICATE_REJECTION_END != i) {
+		nwkRxDuplicateRejectionFree = nwkRxDuplicateRejectionNext[i];
+		return i;
 	}
 
-	if (restart) {
-		SYS_TimerStart(timer);
+	for (uint8_t n = 0; n < NWK_DUPLICATE_REJECTION_TABLE_SIZE; n++) {
+		i = nwkRxDuplicateRejectionHand;
+
+		if (++nwkRxDuplicateRejectionHand ==
+				NWK_DUPLICATE_REJECTION_TABLE_SIZE) {
+			nwkRxDuplicateRejectionHand = 0;
+		}
+
+		if (!nwkRxDuplicateRejectionExpired(i, time)) {
+			continue;
+		}
+
+		link = &nwkRxDuplicateRejectionBuckets[
+				nwkRxDuplicateRejectionHash(
+				nwkRxDuplicateRejectionTable[i].src)];
+
+		while (*link != i) {
+			link = &nwkRxDuplicateRejectionNext[*link];
+		}
+
+		*link = nwkRxDuplicateRejectionNext[i];
+		return i;
 	}
+
+	return NWK_RX_DUPLICATE_REJECTION_END;
 }
 
 /*************************************************************************//**
@@ -203,12 +288,24 @@ static void nwkRxDuplicateRejectionTimerHandler(SYS_Timer_t *timer)
 static bool nwkRxRejectDuplicate(NwkFrameHeader_t *header)
 {
 	NwkDuplicateRejectionEntry_t *entry;
-	NwkDuplicateRejectionEntry_t *freeEntry = NULL;
+	uint32_t time = SYS_TimerTime();
+	uint8_t bucket = nwkRxDuplicateRejectionHash(header->nwkSrcAddr);
+	uint8_t *link = &nwkRxDuplicateRejectionBuckets[bucket];
+	uint8_t i;
 
-	for (uint8_t i = 0; i < NWK_DUPLICATE_REJECTION_TABLE_SIZE; i++) {
+	while (NWK_RX_DUPLICATE_REJECTION_END != (i = *link)) {
 		entry = &nwkRxDuplicateRejectionTable[i];
 
-		if (entry->ttl && header->nwkSrcAddr == entry->src) {
+		/* Expired entries are released on the way */
+		if (nwkRxDuplicateRejectionExpired(i, time)) {
+			*link = nwkRxDuplicateRejectionNext[i];
+			nwkRxDuplicateRejectionNext[i]
+				= nwkRxDuplicateRejectionFree;
+			nwkRxDuplicateRejectionFree = i;
+			continue;
+		}
+
+		if (header->nwkSrcAddr == entry->src) {
 			uint8_t diff = (int8_t)entry->seq - header->nwkSeq;
 
 			if (diff < 8) {
@@ -230,26 +327,29 @@ static bool nwkRxRejectDuplicate(NwkFrameHeader_t *header)
 
 				entry->seq = header->nwkSeq;
 				entry->mask = (entry->mask << shift) | 1;
-				entry->ttl = DUPLICATE_REJECTION_TTL;
+				entry->expiry = time +
+						NWK_DUPLICATE_REJECTION_TTL;
 				return false;
 			}
 		}
 
-		if (0 == entry->ttl) {
-			freeEntry = entry;
-		}
+		link = &nwkRxDuplicateRejectionNext[i];
 	}
 
-	if (NULL == freeEntry) {
+	i = nwkRxDuplicateRejectionAlloc(time);
+
+	if (NWK_RX_DUPLICATE_REJECTION_END == i) {
 		return true;
 	}
 
-	freeEntry->src = header->nwkSrcAddr;
-	freeEntry->seq = header->nwkSeq;
-	freeEntry->mask = 1;
-	freeEntry->ttl = DUPLICATE_REJECTION_TTL;
+	entry = &nwkRxDuplicateRejectionTable[i];
+	entry->src = header->nwkSrcAddr;
+	entry->seq = header->nwkSeq;
+	entry->mask = 1;
+	entry->expiry = time + NWK_DUPLICATE_REJECTION_TTL;
 
-	SYS_TimerStart(&nwkRxDuplicateRejectionTimer);
+	nwkRxDuplicateRejectionNext[i] = nwkRxDuplicateRejectionBuckets[bucket];
+	nwkRxDuplicateRejectionBuckets[bucket] = i;
 
 	return false;
 }
@@ -285,6 +385,16 @@ static bool nwkRxSeriveDataInd(NWK_DataInd_t *ind)
 		return nwkRouteDiscoveryReplyReceived(ind);
 #endif
 
+#ifdef NWK_ENABLE_CHANNEL_SWITCH
+	case NWK_COMMAND_CHANNEL_SWITCH:
+		return nwkChannelSwitchReceived(ind);
+#endif
+
+#ifdef NWK_ENABLE_KEY_SWITCH
+	case NWK_COMMAND_KEY_SWITCH:
+		return nwkKeySwitchReceived(ind);
+#endif
+
 	default:
 		return false;
 	}
@@ -296,7 +406,7 @@ static void nwkRxHandleReceivedFrame(NwkFrame_t *frame)
 {
 	NwkFrameHeader_t *header = &frame->header;
 
-	frame->state = NWK_RX_STATE_FINISH;
+	nwkRxSetState(frame, NWK_RX_STATE_FINISH);
 
 #ifndef NWK_ENABLE_SECURITY
 	if (header->nwkFcf.security) {
@@ -320,10 +430,10 @@ static void nwkRxHandleReceivedFrame(NwkFrame_t *frame)
 				header->nwkDstAddr) {
     #ifdef NWK_ENABLE_SECURITY
 			if (header->nwkFcf.security) {
-				frame->state = NWK_RX_STATE_DECRYPT;
+				nwkRxSetState(frame, NWK_RX_STATE_DECRYPT);
 			} else
     #endif
-			frame->state = NWK_RX_STATE_INDICATE;
+			nwkRxSetState(frame, NWK_RX_STATE_INDICATE);
 		}
 
 		return;
@@ -348,6 +458,10 @@ static void nwkRxHandleReceivedFrame(NwkFrame_t *frame)
 	nwkRouteFrameReceived(frame);
 #endif
 
+#ifdef NWK_ENABLE_TX_POWER_CONTROL
+	nwkTxPowerFrameReceived(frame);
+#endif
+
 	if (nwkRxRejectDuplicate(header)) {
 		return;
 	}
@@ -379,7 +493,7 @@ static void nwkRxHandleReceivedFrame(NwkFrame_t *frame)
 
     #ifdef NWK_ENABLE_ROUTING
 			else {
-				frame->state = NWK_RX_STATE_ROUTE;
+				nwkRxSetState(frame, NWK_RX_STATE_ROUTE);
 			}
     #endif
 		}
@@ -393,10 +507,10 @@ static void nwkRxHandleReceivedFrame(NwkFrame_t *frame)
 
     #ifdef NWK_ENABLE_SECURITY
 			if (header->nwkFcf.security) {
-				frame->state = NWK_RX_STATE_DECRYPT;
+				nwkRxSetState(frame, NWK_RX_STATE_DECRYPT);
 			} else
     #endif
-			frame->state = NWK_RX_STATE_INDICATE;
+			nwkRxSetState(frame, NWK_RX_STATE_INDICATE);
 		}
 	} else
 #endif /* NWK_ENABLE_MULTICAST */
@@ -411,15 +525,15 @@ static void nwkRxHandleReceivedFrame(NwkFrame_t *frame)
 				header->nwkDstAddr) {
     #ifdef NWK_ENABLE_SECURITY
 			if (header->nwkFcf.security) {
-				frame->state = NWK_RX_STATE_DECRYPT;
+				nwkRxSetState(frame, NWK_RX_STATE_DECRYPT);
 			} else
     #endif
-			frame->state = NWK_RX_STATE_INDICATE;
+			nwkRxSetState(frame, NWK_RX_STATE_INDICATE);
 		}
 
   #ifdef NWK_ENABLE_ROUTING
 		else if (nwkIb.addr == header->macDstAddr) {
-			frame->state = NWK_RX_STATE_ROUTE;
+			nwkRxSetState(frame, NWK_RX_STATE_ROUTE);
 		}
   #endif
 	}
@@ -494,7 +608,21 @@ static void nwkRxHandleIndication(NwkFrame_t *frame)
 		nwkRxSendAck(frame);
 	}
 
-	frame->state = NWK_RX_STATE_FINISH;
+	nwkRxSetState(frame, NWK_RX_STATE_FINISH);
+}
+
+/*************************************************************************//**
+*  @brief Checks if there are received frames to process
+*****************************************************************************/
+bool nwkRxPending(void)
+{
+	for (uint8_t i = 0; i < NWK_RX_STATES_AMOUNT; i++) {
+		if (nwkRxQueues[i].head) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
 /*************************************************************************//**
@@ -502,43 +630,39 @@ static void nwkRxHandleIndication(NwkFrame_t *frame)
 *****************************************************************************/
 void nwkRxTaskHandler(void)
 {
-	NwkFrame_t *frame = NULL;
+	NwkFrame_t *frame, *next;
 
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		switch (frame->state) {
-		case NWK_RX_STATE_RECEIVED:
-		{
-			nwkRxHandleReceivedFrame(frame);
-		}
-		break;
+	for (frame = nwkRxQueue(NWK_RX_STATE_RECEIVED)->head; frame;
+			frame = next) {
+		next = frame->next;
+		nwkRxHandleReceivedFrame(frame);
+	}
 
 #ifdef NWK_ENABLE_SECURITY
-		case NWK_RX_STATE_DECRYPT:
-		{
-			nwkSecurityProcess(frame, false);
-		}
-		break;
+	for (frame = nwkRxQueue(NWK_RX_STATE_DECRYPT)->head; frame;
+			frame = next) {
+		next = frame->next;
+		nwkSecurityProcess(frame, false);
+	}
 #endif
 
-		case NWK_RX_STATE_INDICATE:
-		{
-			nwkRxHandleIndication(frame);
-		}
-		break;
+	for (frame = nwkRxQueue(NWK_RX_STATE_INDICATE)->head; frame;
+			frame = next) {
+		next = frame->next;
+		nwkRxHandleIndication(frame);
+	}
 
 #ifdef NWK_ENABLE_ROUTING
-		case NWK_RX_STATE_ROUTE:
-		{
-			nwkRouteFrame(frame);
-		}
-		break;
+	for (frame = nwkRxQueue(NWK_RX_STATE_ROUTE)->head; frame;
+			frame = next) {
+		next = frame->next;
+		nwkRouteFrame(frame);
+	}
 #endif
 
-		case NWK_RX_STATE_FINISH:
-		{
-			nwkFrameFree(frame);
-		}
-		break;
-		}
+	for (frame = nwkRxQueue(NWK_RX_STATE_FINISH)->head; frame;
+			frame = next) {
+		next = frame->next;
+		nwkFrameFree(frame);
 	}
 }
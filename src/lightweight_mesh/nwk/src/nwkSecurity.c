@@ -52,22 +52,69 @@
 
 #ifdef NWK_ENABLE_SECURITY
 
+/*- Definitions ------------------------------------------------------------*/
+#define NWK_SECURITY_NONCE_SIZE       13
+#define NWK_SECURITY_LENGTH_SIZE      2  /* CCM* L */
+#define NWK_SECURITY_AUTH_HEADER_SIZE 7  /* nwkFcf to the endpoints */
+#define NWK_SECURITY_STREAM_BLOCKS \
+	((NWK_MAX_PAYLOAD_SIZE + NWK_SECURITY_BLOCK_SIZE - 1) / \
+	NWK_SECURITY_BLOCK_SIZE + 1)
+
+#if NWK_SECURITY_MIC_SIZE == 4
+  #define NWK_SECURITY_LEVEL          5  /* ENC-MIC-32 */
+#elif NWK_SECURITY_MIC_SIZE == 8
+  #define NWK_SECURITY_LEVEL          6  /* ENC-MIC-64 */
+#else
+  #define NWK_SECURITY_LEVEL          7  /* ENC-MIC-128 */
+#endif
+
+#define NWK_SECURITY_REPLAY_WINDOW    8  /* bits in NwkSecurityReplay_t.mask */
+#define NWK_SECURITY_REPLAY_HASH_SIZE (1 << NWK_SECURITY_REPLAY_HASH_BITS)
+#define NWK_SECURITY_REPLAY_END       0xff
+
 /*- Types ------------------------------------------------------------------*/
 enum {
 	NWK_SECURITY_STATE_ENCRYPT_PENDING = 0x30,
 	NWK_SECURITY_STATE_DECRYPT_PENDING = 0x31,
-	NWK_SECURITY_STATE_PROCESS         = 0x32,
-	NWK_SECURITY_STATE_WAIT            = 0x33,
-	NWK_SECURITY_STATE_CONFIRM         = 0x34,
 };
 
+typedef struct NwkSecurityReplay_t {
+	uint16_t src;
+	uint32_t counter;       /* Highest counter accepted from src */
+	uint8_t mask;           /* Bit i set if (counter - i - 1) was accepted */
+	uint8_t keyId;          /* Key of the last frame accepted from src */
+	uint8_t received   : 1; /* Until the first frame from src, counter is
+	                           the lowest one accepted */
+	uint8_t referenced : 1; /* Used since the clock hand passed */
+} NwkSecurityReplay_t;
+
+typedef struct NwkSecurityKey_t {
+	uint8_t id;
+	uint8_t type;
+	uint16_t addr;    /* Group or peer address */
+	uint8_t users;    /* Replay windows whose last frame used the key */
+	uint8_t key[NWK_SECURITY_KEY_SIZE];
+} NwkSecurityKey_t;
+
 /*- Variables --------------------------------------------------------------*/
-static uint8_t nwkSecurityActiveFrames;
-static NwkFrame_t *nwkSecurityActiveFrame;
-static uint8_t nwkSecuritySize;
-static uint8_t nwkSecurityOffset;
-static bool nwkSecurityEncrypt;
-static uint32_t nwkSecurityVector[4];
+static NwkFrameQueue_t nwkSecurityQueue;
+static uint32_t nwkSecurityFrameCounter;
+/* Counter blocks A0..An, encrypted in one batch */
+static uint8_t nwkSecurityStream[NWK_SECURITY_STREAM_BLOCKS *
+		NWK_SECURITY_BLOCK_SIZE];
+static NwkSecurityReplay_t nwkSecurityReplayTable[
+	NWK_SECURITY_REPLAY_TABLE_SIZE];
+/* Hash index over src. Every bucket is a chain of windows linked through
+ * nwkSecurityReplayNext, unused windows are linked into the free list. */
+static uint8_t nwkSecurityReplayBuckets[NWK_SECURITY_REPLAY_HASH_SIZE];
+static uint8_t nwkSecurityReplayNext[NWK_SECURITY_REPLAY_TABLE_SIZE];
+static uint8_t nwkSecurityReplayFreeHead;
+/* Position of the second-chance sweep used to find a window to reuse when
+ * the table is full */
+static uint8_t nwkSecurityReplayClockHand;
+static NwkSecurityKey_t nwkSecurityKeys[NWK_SECURITY_KEYS_AMOUNT];
+/* Network key used for frames without a group or link key, never NULL */
+static NwkSecurityKey_t *nwkSecurityActiveKey;
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -76,15 +123,478 @@ static uint32_t nwkSecurityVector[4];
 *****************************************************************************/
 void nwkSecurityInit(void)
 {
-	nwkSecurityActiveFrames = 0;
-	nwkSecurityActiveFrame = NULL;
+	nwkSecurityFrameCounter = 0;
+	nwkFrameQueueInit(&nwkSecurityQueue);
+
+	for (uint16_t i = 0; i < NWK_SECURITY_REPLAY_HASH_SIZE; i++) {
+		nwkSecurityReplayBuckets[i] = NWK_SECURITY_REPLAY_END;
+	}
+
+	nwkSecurityReplayFreeHead = NWK_SECURITY_REPLAY_END;
+
+	for (uint8_t i = NWK_SECURITY_REPLAY_TABLE_SIZE; i > 0; i--) {
+		nwkSecurityReplayTable[i - 1].src = NWK_BROADCAST_ADDR;
+		nwkSecurityReplayNext[i - 1] = nwkSecurityReplayFreeHead;
+		nwkSecurityReplayFreeHead = i - 1;
+	}
+
+	nwkSecurityReplayClockHand = 0;
+
+	for (uint8_t i = 0; i < NWK_SECURITY_KEYS_AMOUNT; i++) {
+		nwkSecurityKeys[i].type = NWK_SECURITY_KEY_NONE;
+	}
+
+	/* Network key 0, all zeros until NWK_SetSecurityKey() is called */
+	nwkSecurityActiveKey = &nwkSecurityKeys[0];
+	nwkSecurityActiveKey->id = 0;
+	nwkSecurityActiveKey->type = NWK_SECURITY_KEY_NETWORK;
+	nwkSecurityActiveKey->users = 0;
+	memset(nwkSecurityActiveKey->key, 0, NWK_SECURITY_KEY_SIZE);
 }
 
 /*************************************************************************//**
+*  @brief Replaces the value of the active network key
 *****************************************************************************/
 void NWK_SetSecurityKey(uint8_t *key)
 {
-	memcpy((uint8_t *)nwkIb.key, key, NWK_SECURITY_KEY_SIZE);
+	memcpy(nwkSecurityActiveKey->key, key, NWK_SECURITY_KEY_SIZE);
+}
+
+/*************************************************************************//**
+*  @return The key table entry with ID @a id, or NULL if there is none
+*****************************************************************************/
+static NwkSecurityKey_t *nwkSecurityKeyFind(uint8_t id)
+{
+	for (uint8_t i = 0; i < NWK_SECURITY_KEYS_AMOUNT; i++) {
+		if (NWK_SECURITY_KEY_NONE != nwkSecurityKeys[i].type &&
+				id == nwkSecurityKeys[i].id) {
+			return &nwkSecurityKeys[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*************************************************************************//**
+*  @brief Adds a key to the key table, or replaces the key with the same ID.
+*  Frames carry the ID of the key they are secured with, so both ends have
+*  to use the same ID for a key.
+*  @param[in] id ID of the key
+*  @param[in] type Type of the key
+*  @param[in] addr Group address for group keys, address of the peer for
+*  link keys, ignored for network keys
+*  @param[in] key Key value
+*  @return @c false if the table is full, or if the active network key would
+*  change type
+*****************************************************************************/
+bool NWK_AddSecurityKey(uint8_t id, NWK_SecurityKeyType_t type,
+		uint16_t addr, uint8_t *key)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	if (NWK_SECURITY_KEY_NONE == type) {
+		return false;
+	}
+
+	if (entry == nwkSecurityActiveKey && NWK_SECURITY_KEY_NETWORK != type) {
+		return false;
+	}
+
+	if (NULL == entry) {
+		for (uint8_t i = 0; i < NWK_SECURITY_KEYS_AMOUNT; i++) {
+			if (NWK_SECURITY_KEY_NONE == nwkSecurityKeys[i].type) {
+				entry = &nwkSecurityKeys[i];
+				break;
+			}
+		}
+	}
+
+	if (NULL == entry) {
+		return false;
+	}
+
+	/* Windows might still refer to a key which was removed and is added
+	 * again */
+	if (NWK_SECURITY_KEY_NONE == entry->type) {
+		entry->users = 0;
+
+		for (uint8_t i = 0; i < NWK_SECURITY_REPLAY_TABLE_SIZE; i++) {
+			NwkSecurityReplay_t *replay = &nwkSecurityReplayTable[i];
+
+			if (NWK_BROADCAST_ADDR != replay->src &&
+					replay->received &&
+					id == replay->keyId) {
+				entry->users++;
+			}
+		}
+	}
+
+	entry->id = id;
+	entry->type = type;
+	entry->addr = addr;
+	memcpy(entry->key, key, NWK_SECURITY_KEY_SIZE);
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Removes the key with ID @a id from the key table
+*  @return @c false if there is no such key, or if it is the active network
+*  key
+*****************************************************************************/
+bool NWK_RemoveSecurityKey(uint8_t id)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	if (NULL == entry || entry == nwkSecurityActiveKey) {
+		return false;
+	}
+
+	entry->type = NWK_SECURITY_KEY_NONE;
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Makes the network key with ID @a id the one used for outgoing
+*  frames. Frames secured with any key in the table are still accepted.
+*  @return @c false if there is no network key with this ID
+*****************************************************************************/
+bool NWK_SetActiveSecurityKey(uint8_t id)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	if (NULL == entry || NWK_SECURITY_KEY_NETWORK != entry->type) {
+		return false;
+	}
+
+	nwkSecurityActiveKey = entry;
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @return The ID of the active network key
+*****************************************************************************/
+uint8_t NWK_ActiveSecurityKey(void)
+{
+	return nwkSecurityActiveKey->id;
+}
+
+/*************************************************************************//**
+*  @return The type of the key with ID @a id, NWK_SECURITY_KEY_NONE if there
+*  is no such key
+*****************************************************************************/
+NWK_SecurityKeyType_t NWK_SecurityKeyType(uint8_t id)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	if (NULL == entry) {
+		return NWK_SECURITY_KEY_NONE;
+	}
+
+	return (NWK_SecurityKeyType_t)entry->type;
+}
+
+/*************************************************************************//**
+*  @brief Copies the value of the key with ID @a id, e.g. to store the
+*  network key after a key switch
+*  @param[out] key Key value
+*  @return @c false if there is no such key
+*****************************************************************************/
+bool NWK_SecurityKey(uint8_t id, uint8_t *key)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	if (NULL == entry) {
+		return false;
+	}
+
+	memcpy(key, entry->key, NWK_SECURITY_KEY_SIZE);
+
+	return true;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static inline uint8_t nwkSecurityReplayHash(uint16_t src)
+{
+	return (uint16_t)(src * 40503u) >> (16 - NWK_SECURITY_REPLAY_HASH_BITS);
+}
+
+/*************************************************************************//**
+*  @return The replay window of @a src, or NULL if there is none
+*****************************************************************************/
+static NwkSecurityReplay_t *nwkSecurityReplayFind(uint16_t src)
+{
+	for (uint8_t i = nwkSecurityReplayBuckets[nwkSecurityReplayHash(src)];
+			NWK_SECURITY_REPLAY_END != i;
+			i = nwkSecurityReplayNext[i]) {
+		if (src == nwkSecurityReplayTable[i].src) {
+			return &nwkSecurityReplayTable[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*************************************************************************//**
+*  @brief Records @a keyId as the key of the last frame accepted through
+*  @a replay, or no key if @a received is @c false, and keeps the count of
+*  the windows using each key up to date
+*****************************************************************************/
+static void nwkSecurityReplaySetKey(NwkSecurityReplay_t *replay,
+		bool received, uint8_t keyId)
+{
+	NwkSecurityKey_t *entry;
+
+	if (replay->received && (entry = nwkSecurityKeyFind(replay->keyId))) {
+		entry->users--;
+	}
+
+	if (received && (entry = nwkSecurityKeyFind(keyId))) {
+		entry->users++;
+	}
+
+	replay->received = received;
+	replay->keyId = keyId;
+}
+
+/*************************************************************************//**
+*  @brief Selects the key for an outgoing frame: the group key for multicast
+*  frames, the link key of the destination for unicast frames and the active
+*  network key if there is neither. With NWK_TX_CONTROL_PEER_KEY, a unicast
+*  frame is secured with the network key of the last frame received from the
+*  destination instead, so that a peer which missed a key switch can read it.
+*****************************************************************************/
+static NwkSecurityKey_t *nwkSecurityTxKey(NwkFrame_t *frame)
+{
+	NwkFrameHeader_t *header = &frame->header;
+	uint8_t type = header->nwkFcf.multicast ? NWK_SECURITY_KEY_GROUP :
+			NWK_SECURITY_KEY_LINK;
+
+	if (!header->nwkFcf.multicast &&
+			(frame->tx.control & NWK_TX_CONTROL_PEER_KEY)) {
+		NwkSecurityReplay_t *replay =
+				nwkSecurityReplayFind(header->nwkDstAddr);
+		NwkSecurityKey_t *entry;
+
+		if (replay && replay->received &&
+				(entry = nwkSecurityKeyFind(replay->keyId)) &&
+				NWK_SECURITY_KEY_NETWORK == entry->type) {
+			return entry;
+		}
+	}
+
+	for (uint8_t i = 0; i < NWK_SECURITY_KEYS_AMOUNT; i++) {
+		if (type == nwkSecurityKeys[i].type &&
+				header->nwkDstAddr == nwkSecurityKeys[i].addr) {
+			return &nwkSecurityKeys[i];
+		}
+	}
+
+	return nwkSecurityActiveKey;
+}
+
+/*************************************************************************//**
+*  @return The key with ID @a id if it may secure a frame with @a header, or
+*  NULL otherwise. Group and link keys are bound to their group and peer.
+*****************************************************************************/
+static NwkSecurityKey_t *nwkSecurityRxKey(NwkFrameHeader_t *header,
+		uint8_t id)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	if (NULL == entry) {
+		return NULL;
+	}
+
+	if (NWK_SECURITY_KEY_GROUP == entry->type) {
+		if (!header->nwkFcf.multicast ||
+				header->nwkDstAddr != entry->addr) {
+			return NULL;
+		}
+	} else if (NWK_SECURITY_KEY_LINK == entry->type) {
+		if (header->nwkFcf.multicast ||
+				header->nwkSrcAddr != entry->addr ||
+				header->nwkDstAddr != nwkIb.addr) {
+			return NULL;
+		}
+	}
+
+	return entry;
+}
+
+/*************************************************************************//**
+*  @brief Sets the counter used for the next outgoing secured frame. A nonce
+*  must never be used twice with the same key, so a device which does not
+*  keep running should store the counter and restore it after a reset.
+*****************************************************************************/
+void NWK_SetSecurityFrameCounter(uint32_t counter)
+{
+	nwkSecurityFrameCounter = counter;
+}
+
+/*************************************************************************//**
+*  @return The counter used for the next outgoing secured frame
+*****************************************************************************/
+uint32_t NWK_SecurityFrameCounter(void)
+{
+	return nwkSecurityFrameCounter;
+}
+
+/*************************************************************************//**
+*  @brief Unlinks the window @a i from its bucket and moves it to the free
+*  list
+*****************************************************************************/
+static void nwkSecurityReplayRemove(uint8_t i)
+{
+	NwkSecurityReplay_t *replay = &nwkSecurityReplayTable[i];
+	uint8_t *link = &nwkSecurityReplayBuckets[
+			nwkSecurityReplayHash(replay->src)];
+
+	while (*link != i) {
+		link = &nwkSecurityReplayNext[*link];
+	}
+
+	*link = nwkSecurityReplayNext[i];
+
+	nwkSecurityReplaySetKey(replay, false, 0);
+	replay->src = NWK_BROADCAST_ADDR;
+
+	nwkSecurityReplayNext[i] = nwkSecurityReplayFreeHead;
+	nwkSecurityReplayFreeHead = i;
+}
+
+/*************************************************************************//**
+*  @brief Creates the replay window of @a src. When the table is full, a
+*  window is reused with a second-chance sweep, which spares the windows
+*  used since the last pass of the hand once.
+*  @return The window, or NULL if the table is full and @a evict is
+*  @c false
+*****************************************************************************/
+static NwkSecurityReplay_t *nwkSecurityReplayNew(uint16_t src, bool evict)
+{
+	NwkSecurityReplay_t *replay;
+	uint8_t i, bucket;
+
+	if (NWK_SECURITY_REPLAY_END == nwkSecurityReplayFreeHead) {
+		if (!evict) {
+			return NULL;
+		}
+
+		for (;;) {
+			i = nwkSecurityReplayClockHand;
+			replay = &nwkSecurityReplayTable[i];
+
+			if (++nwkSecurityReplayClockHand ==
+					NWK_SECURITY_REPLAY_TABLE_SIZE) {
+				nwkSecurityReplayClockHand = 0;
+			}
+
+			if (!replay->referenced) {
+				break;
+			}
+
+			replay->referenced = 0;
+		}
+
+		nwkSecurityReplayRemove(i);
+	}
+
+	i = nwkSecurityReplayFreeHead;
+	nwkSecurityReplayFreeHead = nwkSecurityReplayNext[i];
+
+	replay = &nwkSecurityReplayTable[i];
+	replay->src = src;
+	replay->received = 0;
+	replay->referenced = 1;
+
+	bucket = nwkSecurityReplayHash(src);
+	nwkSecurityReplayNext[i] = nwkSecurityReplayBuckets[bucket];
+	nwkSecurityReplayBuckets[bucket] = i;
+
+	return replay;
+}
+
+/*************************************************************************//**
+*  @brief Looks up the key of the last frame accepted from the peer @a addr
+*  @param[out] id ID of the key
+*  @return @c false if no frame from the peer has been accepted
+*****************************************************************************/
+bool nwkSecurityPeerKey(uint16_t addr, uint8_t *id)
+{
+	NwkSecurityReplay_t *replay = nwkSecurityReplayFind(addr);
+
+	if (NULL == replay || !replay->received ||
+			NWK_BROADCAST_ADDR == addr) {
+		return false;
+	}
+
+	*id = replay->keyId;
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @return @c true if the last frame accepted from any peer was secured with
+*  the key with ID @a id
+*****************************************************************************/
+bool nwkSecurityKeyInUse(uint8_t id)
+{
+	NwkSecurityKey_t *entry = nwkSecurityKeyFind(id);
+
+	return entry && entry->users > 0;
+}
+
+/*************************************************************************//**
+*  @brief Creates the replay window of the peer @a addr, which refuses frames
+*  with a counter lower than @a counter. With
+*  NWK_SECURITY_REJECT_UNKNOWN_PEERS this is the only way to create a
+*  window, and frames from sources without one are refused.
+*  @return @c false if the table is full, no window is evicted for the peer
+*****************************************************************************/
+bool NWK_AddSecurityPeer(uint16_t addr, uint32_t counter)
+{
+	NwkSecurityReplay_t *replay;
+
+	if (NWK_BROADCAST_ADDR == addr) {
+		return false;
+	}
+
+	replay = nwkSecurityReplayFind(addr);
+
+	if (NULL == replay) {
+		replay = nwkSecurityReplayNew(addr, false);
+	}
+
+	if (NULL == replay) {
+		return false;
+	}
+
+	nwkSecurityReplaySetKey(replay, false, 0);
+	replay->counter = counter;
+	replay->mask = 0;
+	replay->referenced = 1;
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Removes the replay window of the peer @a addr
+*  @return @c false if there is none
+*****************************************************************************/
+bool NWK_RemoveSecurityPeer(uint16_t addr)
+{
+	NwkSecurityReplay_t *replay = nwkSecurityReplayFind(addr);
+
+	if (NULL == replay || NWK_BROADCAST_ADDR == addr) {
+		return false;
+	}
+
+	nwkSecurityReplayRemove(replay - nwkSecurityReplayTable);
+
+	return true;
 }
 
 /*************************************************************************//**
@@ -97,135 +607,338 @@ void nwkSecurityProcess(NwkFrame_t *frame, bool encrypt)
 		frame->state = NWK_SECURITY_STATE_DECRYPT_PENDING;
 	}
 
-	++nwkSecurityActiveFrames;
+	nwkFrameEnqueue(&nwkSecurityQueue, frame);
 }
 
 /*************************************************************************//**
 *****************************************************************************/
-static void nwkSecurityStart(void)
+static void nwkSecurityXor(uint8_t *dst, uint8_t *src, uint8_t size)
 {
-	NwkFrameHeader_t *header = &nwkSecurityActiveFrame->header;
-
-	nwkSecurityVector[0] = header->nwkSeq;
-	nwkSecurityVector[1]
-		= ((uint32_t)header->nwkDstAddr <<
-			16) | header->nwkDstEndpoint;
-	nwkSecurityVector[2]
-		= ((uint32_t)header->nwkSrcAddr <<
-			16) | header->nwkSrcEndpoint;
-	nwkSecurityVector[3]
-		= ((uint32_t)header->macDstPanId <<
-			16) | *(uint8_t *)&header->nwkFcf;
-
-	if (NWK_SECURITY_STATE_DECRYPT_PENDING ==
-			nwkSecurityActiveFrame->state) {
-		nwkSecurityActiveFrame->size -= NWK_SECURITY_MIC_SIZE;
+	for (uint8_t i = 0; i < size; i++) {
+		dst[i] ^= src[i];
 	}
+}
 
-	nwkSecuritySize = nwkFramePayloadSize(nwkSecurityActiveFrame);
-	nwkSecurityOffset = 0;
-	nwkSecurityEncrypt
-		= (NWK_SECURITY_STATE_ENCRYPT_PENDING ==
-			nwkSecurityActiveFrame->state);
+/*************************************************************************//**
+*  @brief Builds the CCM* nonce: the PAN ID and the originator address in
+*  place of the extended source address, the frame counter from the
+*  auxiliary header @a aux and the security level. The key ID is not part
+*  of the nonce, but it is authenticated with the auxiliary header.
+*****************************************************************************/
+static void nwkSecurityNonce(NwkFrame_t *frame, uint8_t *aux, uint8_t *nonce)
+{
+	NwkFrameHeader_t *header = &frame->header;
 
-	nwkSecurityActiveFrame->state = NWK_SECURITY_STATE_PROCESS;
+	memset(nonce, 0, 4);
+	nonce[4] = header->macDstPanId >> 8;
+	nonce[5] = header->macDstPanId;
+	nonce[6] = header->nwkSrcAddr >> 8;
+	nonce[7] = header->nwkSrcAddr;
+	memcpy(&nonce[8], &aux[1], sizeof(uint32_t));
+	nonce[12] = NWK_SECURITY_LEVEL;
 }
 
 /*************************************************************************//**
+*  @brief Computes the CCM* authentication tag over the authenticated data
+*  @a auth of @a authSize (at most 14) bytes and @a size bytes of @a text.
+*  The blocks are chained, so they are encrypted one at a time.
+*  @param[out] mac Tag in the first NWK_SECURITY_MIC_SIZE bytes
 *****************************************************************************/
-void SYS_EncryptConf(void)
+static void nwkSecurityMac(uint8_t *key, uint8_t *nonce, uint8_t *auth,
+		uint8_t authSize, uint8_t *text, uint8_t size, uint8_t *mac)
 {
-	uint8_t *vector = (uint8_t *)nwkSecurityVector;
-	uint8_t *text = &nwkSecurityActiveFrame->payload[nwkSecurityOffset];
-	uint8_t block;
+	uint8_t block = NWK_SECURITY_BLOCK_SIZE;
 
-	block
-		= (nwkSecuritySize <
-			NWK_SECURITY_BLOCK_SIZE) ? nwkSecuritySize :
-			NWK_SECURITY_BLOCK_SIZE;
+	/* B0 */
+	mac[0] = 0x40 | (((NWK_SECURITY_MIC_SIZE - 2) / 2) << 3) |
+			(NWK_SECURITY_LENGTH_SIZE - 1);
+	memcpy(&mac[1], nonce, NWK_SECURITY_NONCE_SIZE);
+	mac[14] = 0;
+	mac[15] = size;
+	SYS_EncryptBlocks(mac, 1, key);
 
-	for (uint8_t i = 0; i < block; i++) {
-		text[i] ^= vector[i];
+	/* The length of the authenticated data followed by the data */
+	mac[1] ^= authSize;
+	nwkSecurityXor(&mac[2], auth, authSize);
+	SYS_EncryptBlocks(mac, 1, key);
 
-		if (nwkSecurityEncrypt) {
-			vector[i] = text[i];
-		} else {
-			vector[i] ^= text[i];
+	for (uint8_t offset = 0; offset < size; offset += block) {
+		if (size - offset < block) {
+			block = size - offset;
 		}
+
+		nwkSecurityXor(mac, &text[offset], block);
+		SYS_EncryptBlocks(mac, 1, key);
 	}
+}
 
-	nwkSecurityOffset += block;
-	nwkSecuritySize -= block;
+/*************************************************************************//**
+*  @brief En/decrypts @a size bytes of @a text and the tag @a mic in CCM*
+*  counter mode. The counter blocks are independent, so all of them are
+*  encrypted in one batch.
+*****************************************************************************/
+static void nwkSecurityCtr(uint8_t *key, uint8_t *nonce, uint8_t *text,
+		uint8_t size, uint8_t *mic)
+{
+	uint8_t blocks = (size + NWK_SECURITY_BLOCK_SIZE - 1) /
+			NWK_SECURITY_BLOCK_SIZE + 1;
+	uint8_t *a = nwkSecurityStream;
 
-	if (nwkSecuritySize > 0) {
-		nwkSecurityActiveFrame->state = NWK_SECURITY_STATE_PROCESS;
-	} else {
-		nwkSecurityActiveFrame->state = NWK_SECURITY_STATE_CONFIRM;
+	for (uint8_t i = 0; i < blocks; i++, a += NWK_SECURITY_BLOCK_SIZE) {
+		a[0] = NWK_SECURITY_LENGTH_SIZE - 1;
+		memcpy(&a[1], nonce, NWK_SECURITY_NONCE_SIZE);
+		a[14] = 0;
+		a[15] = i;
 	}
+
+	SYS_EncryptBlocks(nwkSecurityStream, blocks, key);
+
+	nwkSecurityXor(mic, nwkSecurityStream, NWK_SECURITY_MIC_SIZE);
+	nwkSecurityXor(text, &nwkSecurityStream[NWK_SECURITY_BLOCK_SIZE],
+			size);
 }
 
 /*************************************************************************//**
+*  @brief Reads the frame counter from the auxiliary header @a aux
 *****************************************************************************/
-static bool nwkSecurityProcessMic(void)
+static uint32_t nwkSecurityCounter(uint8_t *aux)
 {
-	uint8_t *mic = &nwkSecurityActiveFrame->payload[nwkSecurityOffset];
-	uint32_t vmic = nwkSecurityVector[0] ^ nwkSecurityVector[1] ^
-			nwkSecurityVector[2] ^ nwkSecurityVector[3];
-	uint32_t tmic;
+	return ((uint32_t)aux[1] << 24) | ((uint32_t)aux[2] << 16) |
+			((uint32_t)aux[3] << 8) | aux[4];
+}
 
-	if (nwkSecurityEncrypt) {
-		memcpy(mic, (uint8_t *)&vmic, NWK_SECURITY_MIC_SIZE);
-		nwkSecurityActiveFrame->size += NWK_SECURITY_MIC_SIZE;
+/*************************************************************************//**
+*  @brief Checks @a counter against the replay window of @a src. Frames from
+*  unknown sources pass, as the window is only created once a frame from
+*  the source has been authenticated, unless
+*  NWK_SECURITY_REJECT_UNKNOWN_PEERS is defined.
+*  @return @c true if the counter has not been accepted before and is not
+*  older than the window
+*****************************************************************************/
+static bool nwkSecurityReplayCheck(uint16_t src, uint32_t counter)
+{
+	NwkSecurityReplay_t *replay = nwkSecurityReplayFind(src);
+	uint32_t age;
+
+	if (NULL == replay) {
+#ifdef NWK_SECURITY_REJECT_UNKNOWN_PEERS
+		return false;
+#else
+		return true;
+#endif
+	}
+
+	if (!replay->received) {
+		return counter >= replay->counter;
+	}
+
+	if (counter > replay->counter) {
 		return true;
+	}
+
+	age = replay->counter - counter;
+
+	if (0 == age || age > NWK_SECURITY_REPLAY_WINDOW) {
+		return false;
+	}
+
+	return 0 == (replay->mask & (1 << (age - 1)));
+}
+
+/*************************************************************************//**
+*  @brief Records @a counter and the key @a keyId of an authenticated frame
+*  from @a src. When the table is full, a window which has not been used
+*  recently is reused.
+*****************************************************************************/
+static void nwkSecurityReplayAccept(uint16_t src, uint32_t counter,
+		uint8_t keyId)
+{
+	NwkSecurityReplay_t *replay = nwkSecurityReplayFind(src);
+	uint32_t shift;
+
+	if (NULL == replay) {
+		replay = nwkSecurityReplayNew(src, true);
+	}
+
+	if (!replay->received) {
+		replay->counter = counter;
+		replay->mask = 0;
+	} else if (counter > replay->counter) {
+		shift = counter - replay->counter;
+
+		if (shift > NWK_SECURITY_REPLAY_WINDOW) {
+			replay->mask = 0;
+		} else {
+			replay->mask = (replay->mask << shift) |
+					(1 << (shift - 1));
+		}
+
+		replay->counter = counter;
 	} else {
-		memcpy((uint8_t *)&tmic, mic, NWK_SECURITY_MIC_SIZE);
-		return vmic == tmic;
+		replay->mask |= 1 << (replay->counter - counter - 1);
 	}
+
+	nwkSecurityReplaySetKey(replay, true, keyId);
+	replay->referenced = 1;
 }
 
 /*************************************************************************//**
-*  @brief Security Module task handler
+*  @brief Collects the authenticated data of @a frame: the network header,
+*  which is not changed by the routers, and the auxiliary header @a aux
 *****************************************************************************/
-void nwkSecurityTaskHandler(void)
+static uint8_t nwkSecurityAuth(NwkFrame_t *frame, uint8_t *aux,
+		uint8_t *auth)
 {
-	NwkFrame_t *frame = NULL;
+	NwkFrameHeader_t header = frame->header;
+
+	/* Set on multicast frames delivered by unicast to a group member */
+	header.nwkFcf.linkLocal = 0;
+	/* Set by every hop */
+	header.nwkFcf.txPower = 0;
+
+	memcpy(auth, &header.nwkFcf, NWK_SECURITY_AUTH_HEADER_SIZE);
+	memcpy(&auth[NWK_SECURITY_AUTH_HEADER_SIZE], aux,
+			NWK_SECURITY_HEADER_SIZE);
 
-	if (0 == nwkSecurityActiveFrames) {
-		return;
+	return NWK_SECURITY_AUTH_HEADER_SIZE + NWK_SECURITY_HEADER_SIZE;
+}
+
+/*************************************************************************//**
+*  @brief Prepends the auxiliary header to the payload of @a frame, encrypts
+*  the payload and appends the encrypted tag
+*  @return @c false if the secured frame would not fit, the frame is then
+*  left unchanged
+*****************************************************************************/
+static bool nwkSecurityEncryptFrame(NwkFrame_t *frame)
+{
+	NwkSecurityKey_t *key = nwkSecurityTxKey(frame);
+	uint8_t size = nwkFramePayloadSize(frame);
+	uint8_t *aux = frame->payload;
+	uint8_t nonce[NWK_SECURITY_NONCE_SIZE];
+	uint8_t auth[NWK_SECURITY_BLOCK_SIZE];
+	uint8_t mac[NWK_SECURITY_BLOCK_SIZE];
+	uint8_t authSize;
+
+	if (frame->size + NWK_SECURITY_HEADER_SIZE + NWK_SECURITY_MIC_SIZE >
+			NWK_FRAME_MAX_PAYLOAD_SIZE - 2 /*crc*/) {
+		return false;
 	}
 
-	if (nwkSecurityActiveFrame) {
-		if (NWK_SECURITY_STATE_CONFIRM ==
-				nwkSecurityActiveFrame->state) {
-			bool micStatus = nwkSecurityProcessMic();
+	memmove(aux + NWK_SECURITY_HEADER_SIZE, aux, size);
+	aux[0] = key->id;
+	aux[1] = nwkSecurityFrameCounter >> 24;
+	aux[2] = nwkSecurityFrameCounter >> 16;
+	aux[3] = nwkSecurityFrameCounter >> 8;
+	aux[4] = nwkSecurityFrameCounter;
+	nwkSecurityFrameCounter++;
 
-			if (nwkSecurityEncrypt) {
-				nwkTxEncryptConf(nwkSecurityActiveFrame);
-			} else {
-				nwkRxDecryptConf(nwkSecurityActiveFrame,
-						micStatus);
-			}
+	frame->payload += NWK_SECURITY_HEADER_SIZE;
+	frame->size += NWK_SECURITY_HEADER_SIZE;
 
-			nwkSecurityActiveFrame = NULL;
-			--nwkSecurityActiveFrames;
-		} else if (NWK_SECURITY_STATE_PROCESS ==
-				nwkSecurityActiveFrame->state) {
-			nwkSecurityActiveFrame->state = NWK_SECURITY_STATE_WAIT;
-			SYS_EncryptReq((uint32_t *)nwkSecurityVector,
-					(uint32_t *)nwkIb.key);
-		}
+	nwkSecurityNonce(frame, aux, nonce);
+	authSize = nwkSecurityAuth(frame, aux, auth);
+	nwkSecurityMac(key->key, nonce, auth, authSize, frame->payload, size,
+			mac);
+	nwkSecurityCtr(key->key, nonce, frame->payload, size, mac);
 
-		return;
+	memcpy(&frame->payload[size], mac, NWK_SECURITY_MIC_SIZE);
+	frame->size += NWK_SECURITY_MIC_SIZE;
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Decrypts the payload of @a frame and checks its tag. Frames with
+*  an unknown key and replayed frames are dropped before any block is
+*  encrypted, and the replay window is only updated once the tag has been
+*  verified.
+*  @return @c true if the frame is authentic and has not been seen before
+*****************************************************************************/
+static bool nwkSecurityDecryptFrame(NwkFrame_t *frame)
+{
+	uint8_t size = nwkFramePayloadSize(frame);
+	uint8_t *aux = frame->payload;
+	uint8_t nonce[NWK_SECURITY_NONCE_SIZE];
+	uint8_t auth[NWK_SECURITY_BLOCK_SIZE];
+	uint8_t mac[NWK_SECURITY_BLOCK_SIZE];
+	uint8_t mic[NWK_SECURITY_MIC_SIZE];
+	uint8_t authSize;
+	uint8_t diff = 0;
+	uint32_t counter;
+	NwkSecurityKey_t *key;
+
+	if (size < NWK_SECURITY_HEADER_SIZE + NWK_SECURITY_MIC_SIZE) {
+		return false;
 	}
 
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		if (NWK_SECURITY_STATE_ENCRYPT_PENDING == frame->state ||
-				NWK_SECURITY_STATE_DECRYPT_PENDING ==
-				frame->state) {
-			nwkSecurityActiveFrame = frame;
-			nwkSecurityStart();
+	if (NULL == (key = nwkSecurityRxKey(&frame->header, aux[0]))) {
+		return false;
+	}
+
+	counter = nwkSecurityCounter(aux);
+
+	if (!nwkSecurityReplayCheck(frame->header.nwkSrcAddr, counter)) {
+		return false;
+	}
+
+	size -= NWK_SECURITY_HEADER_SIZE + NWK_SECURITY_MIC_SIZE;
+	frame->payload += NWK_SECURITY_HEADER_SIZE;
+	frame->size -= NWK_SECURITY_MIC_SIZE;
+	memcpy(mic, &frame->payload[size], NWK_SECURITY_MIC_SIZE);
+
+	nwkSecurityNonce(frame, aux, nonce);
+	nwkSecurityCtr(key->key, nonce, frame->payload, size, mic);
+	authSize = nwkSecurityAuth(frame, aux, auth);
+	nwkSecurityMac(key->key, nonce, auth, authSize, frame->payload, size,
+			mac);
+
+	/* Compared without an early exit, so the timing reveals nothing */
+	for (uint8_t i = 0; i < NWK_SECURITY_MIC_SIZE; i++) {
+		diff |= mac[i] ^ mic[i];
+	}
+
+	if (0 != diff) {
+		return false;
+	}
+
+	nwkSecurityReplayAccept(frame->header.nwkSrcAddr, counter, key->id);
+
+	return true;
+}
+
+/*************************************************************************//**
+*  @brief Checks if there are frames to process
+*****************************************************************************/
+bool nwkSecurityPending(void)
+{
+	return NULL != nwkSecurityQueue.head;
+}
+
+/*************************************************************************//**
+*  @brief Security Module task handler. Processes up to
+*  NWK_SECURITY_PASS_LIMIT frames per call. As the Tx module runs first, the
+*  next frame is encrypted while the radio sends the previous one.
+*****************************************************************************/
+void nwkSecurityTaskHandler(void)
+{
+	NwkFrame_t *frame;
+
+	for (uint8_t i = 0; i < NWK_SECURITY_PASS_LIMIT; i++) {
+		if (NULL == (frame = nwkSecurityQueue.head)) {
 			return;
 		}
+
+		nwkFrameDequeue(frame);
+
+		if (NWK_SECURITY_STATE_ENCRYPT_PENDING == frame->state) {
+			if (nwkSecurityEncryptFrame(frame)) {
+				nwkTxEncryptConf(frame);
+			} else {
+				nwkTxConfirm(frame, NWK_ERROR_STATUS);
+			}
+		} else {
+			nwkRxDecryptConf(frame, nwkSecurityDecryptFrame(frame));
+		}
 	}
 }
 
@@ -52,10 +52,10 @@
 #include "nwkRoute.h"
 #include "nwkCommand.h"
 #include "nwkSecurity.h"
+#include "nwkTxPower.h"
 
 /*- Definitions ------------------------------------------------------------*/
-#define NWK_TX_ACK_WAIT_TIMER_INTERVAL    50 /* ms */
-#define NWK_TX_DELAY_TIMER_INTERVAL       10 /* ms */
+#define NWK_TX_DELAY_INTERVAL             10 /* ms */
 #define NWK_TX_DELAY_JITTER_MASK          0x07
 
 /*- Types ------------------------------------------------------------------*/
@@ -70,14 +70,16 @@ enum {
 	NWK_TX_STATE_CONFIRM    = 0x17,
 };
 
+#define NWK_TX_STATES_AMOUNT   8
+
 /*- Prototypes -------------------------------------------------------------*/
-static void nwkTxAckWaitTimerHandler(SYS_Timer_t *timer);
-static void nwkTxDelayTimerHandler(SYS_Timer_t *timer);
+static void nwkTxTimerHandler(SYS_Timer_t *timer);
 
 /*- Variables --------------------------------------------------------------*/
 static NwkFrame_t *nwkTxPhyActiveFrame;
-static SYS_Timer_t nwkTxAckWaitTimer;
-static SYS_Timer_t nwkTxDelayTimer;
+static SYS_Timer_t nwkTxTimer;
+static NWK_TxStatistics_t nwkTxStatistics;
+static NwkFrameQueue_t nwkTxQueues[NWK_TX_STATES_AMOUNT];
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -88,13 +90,116 @@ void nwkTxInit(void)
 {
 	nwkTxPhyActiveFrame = NULL;
 
-	nwkTxAckWaitTimer.interval = NWK_TX_ACK_WAIT_TIMER_INTERVAL;
-	nwkTxAckWaitTimer.mode = SYS_TIMER_INTERVAL_MODE;
-	nwkTxAckWaitTimer.handler = nwkTxAckWaitTimerHandler;
+	for (uint8_t i = 0; i < NWK_TX_STATES_AMOUNT; i++) {
+		nwkFrameQueueInit(&nwkTxQueues[i]);
+	}
+
+	nwkTxTimer.mode = SYS_TIMER_INTERVAL_MODE;
+	nwkTxTimer.handler = nwkTxTimerHandler;
+
+	NWK_ResetTxStatistics();
+}
+
+/*************************************************************************//**
+*  @brief Returns the statistics of frames handed to the PHY layer since the
+*  last reset
+*****************************************************************************/
+NWK_TxStatistics_t *NWK_TxStatistics(void)
+{
+	return &nwkTxStatistics;
+}
+
+/*************************************************************************//**
+*  @brief Clears the transmission statistics
+*****************************************************************************/
+void NWK_ResetTxStatistics(void)
+{
+	nwkTxStatistics.frames = 0;
+	nwkTxStatistics.channelAccessFailures = 0;
+	nwkTxStatistics.noAcks = 0;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static inline NwkFrameQueue_t *nwkTxQueue(uint8_t state)
+{
+	return &nwkTxQueues[state - NWK_TX_STATE_ENCRYPT];
+}
+
+/*************************************************************************//**
+*  @brief Sets the @a state of a @a frame and moves it to the queue of that
+*  state
+*****************************************************************************/
+static void nwkTxSetState(NwkFrame_t *frame, uint8_t state)
+{
+	frame->state = state;
+	nwkFrameEnqueue(nwkTxQueue(state), frame);
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static inline bool nwkTxExpired(NwkFrame_t *frame, uint16_t time)
+{
+	return (int16_t)(frame->tx.timeout - time) <= 0;
+}
 
-	nwkTxDelayTimer.interval = NWK_TX_DELAY_TIMER_INTERVAL;
-	nwkTxDelayTimer.mode = SYS_TIMER_INTERVAL_MODE;
-	nwkTxDelayTimer.handler = nwkTxDelayTimerHandler;
+/*************************************************************************//**
+*  @brief Arms the timer for the earliest deadline of the frames waiting for
+*  a delay or an acknowledgement
+*****************************************************************************/
+static void nwkTxTimerUpdate(void)
+{
+	uint16_t time = SYS_TimerTime();
+	NwkFrame_t *ack = nwkTxQueue(NWK_TX_STATE_WAIT_ACK)->head;
+	NwkFrame_t *first = nwkTxQueue(NWK_TX_STATE_WAIT_DELAY)->head;
+
+	if (NULL == first || (ack &&
+			(int16_t)(ack->tx.timeout - first->tx.timeout) < 0)) {
+		first = ack;
+	}
+
+	SYS_TimerStop(&nwkTxTimer);
+
+	if (NULL == first) {
+		return;
+	}
+
+	if (nwkTxExpired(first, time)) {
+		nwkTxTimer.interval = 0;
+	} else {
+		nwkTxTimer.interval = (uint16_t)(first->tx.timeout - time);
+	}
+
+	SYS_TimerStart(&nwkTxTimer);
+}
+
+/*************************************************************************//**
+*  @brief Makes a @a frame wait in @a state until the time reaches @a
+*  deadline. The queues of the waiting states are kept ordered by deadline,
+*  so that only the frames which expire have to be visited.
+*****************************************************************************/
+static void nwkTxWait(NwkFrame_t *frame, uint8_t state, uint16_t deadline)
+{
+	NwkFrameQueue_t *queue = nwkTxQueue(state);
+	NwkFrame_t *prev;
+
+	nwkFrameDequeue(frame);
+
+	frame->state = state;
+	frame->tx.timeout = deadline;
+
+	/* Deadlines mostly come in order, so the search starts from the end */
+	for (prev = queue->tail; prev; prev = prev->prev) {
+		if ((int16_t)(prev->tx.timeout - deadline) <= 0) {
+			break;
+		}
+	}
+
+	nwkFrameInsert(queue, prev, frame);
+
+	if (NULL == prev) {
+		nwkTxTimerUpdate();
+	}
 }
 
 /*************************************************************************//**
@@ -104,14 +209,14 @@ void nwkTxFrame(NwkFrame_t *frame)
 	NwkFrameHeader_t *header = &frame->header;
 
 	if (frame->tx.control & NWK_TX_CONTROL_ROUTING) {
-		frame->state = NWK_TX_STATE_DELAY;
+		nwkTxSetState(frame, NWK_TX_STATE_DELAY);
 	} else {
   #ifdef NWK_ENABLE_SECURITY
 		if (header->nwkFcf.security) {
-			frame->state = NWK_TX_STATE_ENCRYPT;
+			nwkTxSetState(frame, NWK_TX_STATE_ENCRYPT);
 		} else
   #endif
-		frame->state = NWK_TX_STATE_DELAY;
+		nwkTxSetState(frame, NWK_TX_STATE_DELAY);
 	}
 
 	frame->tx.status = NWK_SUCCESS_STATUS;
@@ -153,7 +258,7 @@ void nwkTxBroadcastFrame(NwkFrame_t *frame)
 		return;
 	}
 
-	newFrame->state = NWK_TX_STATE_DELAY;
+	nwkTxSetState(newFrame, NWK_TX_STATE_DELAY);
 	newFrame->size = frame->size;
 	newFrame->tx.status = NWK_SUCCESS_STATUS;
 	newFrame->tx.timeout = (rand() & NWK_TX_DELAY_JITTER_MASK) + 1;
@@ -172,16 +277,16 @@ void nwkTxBroadcastFrame(NwkFrame_t *frame)
 bool nwkTxAckReceived(NWK_DataInd_t *ind)
 {
 	NwkCommandAck_t *command = (NwkCommandAck_t *)ind->data;
-	NwkFrame_t *frame = NULL;
+	NwkFrame_t *frame;
 
 	if (sizeof(NwkCommandAck_t) != ind->size) {
 		return false;
 	}
 
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		if (NWK_TX_STATE_WAIT_ACK == frame->state &&
-				frame->header.nwkSeq == command->seq) {
-			frame->state = NWK_TX_STATE_CONFIRM;
+	for (frame = nwkTxQueue(NWK_TX_STATE_WAIT_ACK)->head; frame;
+			frame = frame->next) {
+		if (frame->header.nwkSeq == command->seq) {
+			nwkTxSetState(frame, NWK_TX_STATE_CONFIRM);
 			frame->tx.control = command->control;
 			return true;
 		}
@@ -192,31 +297,30 @@ bool nwkTxAckReceived(NWK_DataInd_t *ind)
 
 /*************************************************************************//**
 *****************************************************************************/
-static void nwkTxAckWaitTimerHandler(SYS_Timer_t *timer)
+static void nwkTxTimerHandler(SYS_Timer_t *timer)
 {
-	NwkFrame_t *frame = NULL;
-	bool restart = false;
+	uint16_t time = SYS_TimerTime();
+	NwkFrame_t *frame;
 
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		if (NWK_TX_STATE_WAIT_ACK == frame->state) {
-			restart = true;
-
-			if (0 == --frame->tx.timeout) {
-				nwkTxConfirm(frame, NWK_NO_ACK_STATUS);
-			}
-		}
+	while (NULL != (frame = nwkTxQueue(NWK_TX_STATE_WAIT_ACK)->head) &&
+			nwkTxExpired(frame, time)) {
+		nwkTxConfirm(frame, NWK_NO_ACK_STATUS);
 	}
 
-	if (restart) {
-		SYS_TimerStart(timer);
+	while (NULL != (frame = nwkTxQueue(NWK_TX_STATE_WAIT_DELAY)->head) &&
+			nwkTxExpired(frame, time)) {
+		nwkTxSetState(frame, NWK_TX_STATE_SEND);
 	}
+
+	nwkTxTimerUpdate();
+	(void)timer;
 }
 
 /*************************************************************************//**
 *****************************************************************************/
 void nwkTxConfirm(NwkFrame_t *frame, uint8_t status)
 {
-	frame->state = NWK_TX_STATE_CONFIRM;
+	nwkTxSetState(frame, NWK_TX_STATE_CONFIRM);
 	frame->tx.status = status;
 }
 
@@ -226,33 +330,11 @@ void nwkTxConfirm(NwkFrame_t *frame, uint8_t status)
 *****************************************************************************/
 void nwkTxEncryptConf(NwkFrame_t *frame)
 {
-	frame->state = NWK_TX_STATE_DELAY;
+	nwkTxSetState(frame, NWK_TX_STATE_DELAY);
 }
 
 #endif
 
-/*************************************************************************//**
-*****************************************************************************/
-static void nwkTxDelayTimerHandler(SYS_Timer_t *timer)
-{
-	NwkFrame_t *frame = NULL;
-	bool restart = false;
-
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		if (NWK_TX_STATE_WAIT_DELAY == frame->state) {
-			restart = true;
-
-			if (0 == --frame->tx.timeout) {
-				frame->state = NWK_TX_STATE_SEND;
-			}
-		}
-	}
-
-	if (restart) {
-		SYS_TimerStart(timer);
-	}
-}
-
 /*************************************************************************//**
 *****************************************************************************/
 static uint8_t nwkTxConvertPhyStatus(uint8_t status)
@@ -276,92 +358,112 @@ static uint8_t nwkTxConvertPhyStatus(uint8_t status)
 *****************************************************************************/
 void PHY_DataConf(uint8_t status)
 {
+	if (UINT16_MAX != nwkTxStatistics.frames) {
+		nwkTxStatistics.frames++;
+
+		if (PHY_STATUS_CHANNEL_ACCESS_FAILURE == status) {
+			nwkTxStatistics.channelAccessFailures++;
+		} else if (PHY_STATUS_NO_ACK == status) {
+			nwkTxStatistics.noAcks++;
+		}
+	}
+
 	nwkTxPhyActiveFrame->tx.status = nwkTxConvertPhyStatus(status);
-	nwkTxPhyActiveFrame->state = NWK_TX_STATE_SENT;
+
+#ifdef NWK_ENABLE_TX_POWER_CONTROL
+	if (nwkTxPowerFrameSent(nwkTxPhyActiveFrame, status)) {
+		nwkTxSetState(nwkTxPhyActiveFrame, NWK_TX_STATE_SEND);
+	} else
+#endif
+	nwkTxSetState(nwkTxPhyActiveFrame, NWK_TX_STATE_SENT);
 	nwkTxPhyActiveFrame = NULL;
 	nwkIb.lock--;
 }
 
+/*************************************************************************//**
+*  @brief Checks if there are frames to process. Frames waiting for a delay or
+*  an acknowledgement are left to the timer.
+*****************************************************************************/
+bool nwkTxPending(void)
+{
+	if (nwkTxQueue(NWK_TX_STATE_SEND)->head && NULL == nwkTxPhyActiveFrame) {
+		return true;
+	}
+
+	return nwkTxQueue(NWK_TX_STATE_ENCRYPT)->head ||
+			nwkTxQueue(NWK_TX_STATE_DELAY)->head ||
+			nwkTxQueue(NWK_TX_STATE_SENT)->head ||
+			nwkTxQueue(NWK_TX_STATE_CONFIRM)->head;
+}
+
 /*************************************************************************//**
 *  @brief Tx Module task handler
 *****************************************************************************/
 void nwkTxTaskHandler(void)
 {
-	NwkFrame_t *frame = NULL;
+	NwkFrame_t *frame, *next;
 
-	while (NULL != (frame = nwkFrameNext(frame))) {
-		switch (frame->state) {
 #ifdef NWK_ENABLE_SECURITY
-		case NWK_TX_STATE_ENCRYPT:
-		{
-			nwkSecurityProcess(frame, true);
-		}
-		break;
+	for (frame = nwkTxQueue(NWK_TX_STATE_ENCRYPT)->head; frame;
+			frame = next) {
+		next = frame->next;
+		nwkSecurityProcess(frame, true);
+	}
 #endif
 
-		case NWK_TX_STATE_DELAY:
-		{
-			if (frame->tx.timeout > 0) {
-				frame->state = NWK_TX_STATE_WAIT_DELAY;
-				SYS_TimerStart(&nwkTxDelayTimer);
-			} else {
-				frame->state = NWK_TX_STATE_SEND;
-			}
-		}
-		break;
-
-		case NWK_TX_STATE_SEND:
-		{
-			if (NULL == nwkTxPhyActiveFrame) {
-				nwkTxPhyActiveFrame = frame;
-				frame->state = NWK_TX_STATE_WAIT_CONF;
-				PHY_DataReq(&(frame->size));
-				nwkIb.lock++;
-			}
+	for (frame = nwkTxQueue(NWK_TX_STATE_DELAY)->head; frame;
+			frame = next) {
+		next = frame->next;
+
+		if (frame->tx.timeout > 0) {
+			nwkTxWait(frame, NWK_TX_STATE_WAIT_DELAY,
+					SYS_TimerTime() + frame->tx.timeout *
+					NWK_TX_DELAY_INTERVAL);
+		} else {
+			nwkTxSetState(frame, NWK_TX_STATE_SEND);
 		}
-		break;
+	}
 
-		case NWK_TX_STATE_WAIT_CONF:
-			break;
+	frame = nwkTxQueue(NWK_TX_STATE_SEND)->head;
+
+	if (frame && NULL == nwkTxPhyActiveFrame) {
+		nwkTxPhyActiveFrame = frame;
+		nwkTxSetState(frame, NWK_TX_STATE_WAIT_CONF);
+#ifdef NWK_ENABLE_TX_POWER_CONTROL
+		nwkTxPowerPrepareTx(frame);
+#else
+		/* A forwarded frame carries the level of the previous hop */
+		frame->header.nwkFcf.txPower = 0;
+#endif
+		PHY_DataReq(&(frame->size));
+		nwkIb.lock++;
+	}
 
-		case NWK_TX_STATE_SENT:
-		{
-			if (NWK_SUCCESS_STATUS == frame->tx.status) {
-				if (frame->header.nwkSrcAddr == nwkIb.addr &&
-						frame->header.nwkFcf.
-						ackRequest) {
-					frame->state = NWK_TX_STATE_WAIT_ACK;
-					frame->tx.timeout = NWK_ACK_WAIT_TIME /
-							NWK_TX_ACK_WAIT_TIMER_INTERVAL
-							+ 1;
-					SYS_TimerStart(&nwkTxAckWaitTimer);
-				} else {
-					frame->state = NWK_TX_STATE_CONFIRM;
-				}
-			} else {
-				frame->state = NWK_TX_STATE_CONFIRM;
-			}
+	for (frame = nwkTxQueue(NWK_TX_STATE_SENT)->head; frame;
+			frame = next) {
+		next = frame->next;
+
+		if (NWK_SUCCESS_STATUS == frame->tx.status &&
+				frame->header.nwkSrcAddr == nwkIb.addr &&
+				frame->header.nwkFcf.ackRequest) {
+			nwkTxWait(frame, NWK_TX_STATE_WAIT_ACK,
+					SYS_TimerTime() + NWK_ACK_WAIT_TIME);
+		} else {
+			nwkTxSetState(frame, NWK_TX_STATE_CONFIRM);
 		}
-		break;
+	}
 
-		case NWK_TX_STATE_WAIT_ACK:
-			break;
+	for (frame = nwkTxQueue(NWK_TX_STATE_CONFIRM)->head; frame;
+			frame = next) {
+		next = frame->next;
 
-		case NWK_TX_STATE_CONFIRM:
-		{
 #ifdef NWK_ENABLE_ROUTING
-			nwkRouteFrameSent(frame);
+		nwkRouteFrameSent(frame);
 #endif
-			if (NULL == frame->tx.confirm) {
-				nwkFrameFree(frame);
-			} else {
-				frame->tx.confirm(frame);
-			}
-		}
-		break;
-
-		default:
-			break;
+		if (NULL == frame->tx.confirm) {
+			nwkFrameFree(frame);
+		} else {
+			frame->tx.confirm(frame);
 		}
 	}
 }
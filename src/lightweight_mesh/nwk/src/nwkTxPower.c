@@ -0,0 +1,214 @@
+/**
+ * \file nwkTxPower.c
+ *
+ * \brief Per-link transmit power control implementation
+ *
+ * The transmit power is adapted for every neighbour separately. The RSSI of the
+ * frames received from a neighbour tells how much margin the link has. Every
+ * frame carries the power level it was sent with, so the RSSI is scaled to
+ * the highest level, and the margin of our own level follows from the path
+ * loss alone. The neighbour lowering its power therefore does not make us
+ * raise ours, and the two ends of a link do not chase each other. While the
+ * margin one level lower is still large and frames get through, the power is
+ * lowered one level at a time. When a frame is not acknowledged on the MAC
+ * level, the power is raised by several levels at once and the frame is sent
+ * again. The level that failed becomes the lower limit for the link, which is
+ * relaxed again after a long run of successful transmissions.
+ *
+ * Power levels are the values of the TX_PWR field of the transceiver, where
+ * 0x00 is the highest and 0x0f the lowest output power.
+ */
+
+/*- Includes ---------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "phy.h"
+#include "sysConfig.h"
+#include "nwk.h"
+#include "nwkFrame.h"
+#include "nwkTxPower.h"
+
+#ifdef NWK_ENABLE_TX_POWER_CONTROL
+
+/*- Definitions ------------------------------------------------------------*/
+#define NWK_TX_POWER_UNKNOWN_ADDR       0xffff
+#define NWK_TX_POWER_NO_LIMIT           (NWK_TX_POWER_MIN + 1)
+#define NWK_TX_POWER_RELAX_LIMIT        255
+
+/*- Variables --------------------------------------------------------------*/
+/* Output power below the one of NWK_TX_POWER_MAX for every level (in dB).
+ * The AT86RF231, AT86RF233 and ATmega256RFR2 differ by less than 1 dB. */
+static const uint8_t nwkTxPowerAttenuation[NWK_TX_POWER_MIN + 1] = {
+	0, 0, 1, 1, 2, 2, 3, 4, 5, 6, 7, 8, 10, 12, 16, 21
+};
+static NWK_TxPowerTableEntry_t nwkTxPowerTable[NWK_TX_POWER_TABLE_SIZE];
+static uint8_t nwkTxPowerNextEntry;
+static uint8_t nwkTxPowerLevel;
+
+/*- Implementations --------------------------------------------------------*/
+
+/*************************************************************************//**
+*  @brief Initializes the Tx Power module
+*****************************************************************************/
+void nwkTxPowerInit(void)
+{
+	for (uint8_t i = 0; i < NWK_TX_POWER_TABLE_SIZE; i++) {
+		nwkTxPowerTable[i].addr = NWK_TX_POWER_UNKNOWN_ADDR;
+	}
+
+	nwkTxPowerNextEntry = 0;
+	nwkTxPowerLevel = NWK_TX_POWER_MAX;
+	PHY_SetTxPower(nwkTxPowerLevel);
+}
+
+/*************************************************************************//**
+*  @brief Returns a pointer to the transmit power table
+*****************************************************************************/
+NWK_TxPowerTableEntry_t *NWK_TxPowerTable(void)
+{
+	return nwkTxPowerTable;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static NWK_TxPowerTableEntry_t *nwkTxPowerFindEntry(uint16_t addr)
+{
+	for (uint8_t i = 0; i < NWK_TX_POWER_TABLE_SIZE; i++) {
+		if (nwkTxPowerTable[i].addr == addr) {
+			return &nwkTxPowerTable[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+static void nwkTxPowerSetLevel(uint8_t level)
+{
+	if (level != nwkTxPowerLevel) {
+		nwkTxPowerLevel = level;
+		PHY_SetTxPower(level);
+	}
+}
+
+/*************************************************************************//**
+*****************************************************************************/
+void nwkTxPowerFrameReceived(NwkFrame_t *frame)
+{
+	NWK_TxPowerTableEntry_t *entry;
+	uint16_t addr = frame->header.macSrcAddr;
+	int8_t rssi = frame->rx.rssi +
+			nwkTxPowerAttenuation[frame->header.nwkFcf.txPower];
+
+	if (NWK_TX_POWER_UNKNOWN_ADDR == addr) {
+		return;
+	}
+
+	entry = nwkTxPowerFindEntry(addr);
+
+	if (entry) {
+		entry->rssi = (int8_t)(((int16_t)entry->rssi * 3 + rssi) / 4);
+		return;
+	}
+
+	entry = &nwkTxPowerTable[nwkTxPowerNextEntry];
+
+	if (++nwkTxPowerNextEntry == NWK_TX_POWER_TABLE_SIZE) {
+		nwkTxPowerNextEntry = 0;
+	}
+
+	entry->addr = addr;
+	entry->level = NWK_TX_POWER_MAX;
+	entry->limit = NWK_TX_POWER_NO_LIMIT;
+	entry->successes = 0;
+	entry->rssi = rssi;
+}
+
+/*************************************************************************//**
+*  @brief Sets the transmit power required to reach the next hop of the
+*  @a frame
+*****************************************************************************/
+void nwkTxPowerPrepareTx(NwkFrame_t *frame)
+{
+	NWK_TxPowerTableEntry_t *entry = NULL;
+
+	if (NWK_BROADCAST_ADDR != frame->header.macDstAddr) {
+		entry = nwkTxPowerFindEntry(frame->header.macDstAddr);
+	}
+
+	nwkTxPowerSetLevel(entry ? entry->level : NWK_TX_POWER_MAX);
+	frame->header.nwkFcf.txPower = nwkTxPowerLevel;
+}
+
+/*************************************************************************//**
+*  @return The margin of the link to @a entry when sent at @a level (in dB)
+*****************************************************************************/
+static int8_t nwkTxPowerMargin(NWK_TxPowerTableEntry_t *entry, uint8_t level)
+{
+	return entry->rssi - nwkTxPowerAttenuation[level] - PHY_RSSI_BASE_VAL;
+}
+
+/*************************************************************************//**
+*  @brief Updates the power level of the link after a transmission
+*  @return @c true if the frame should be sent again at a higher power level
+*****************************************************************************/
+bool nwkTxPowerFrameSent(NwkFrame_t *frame, uint8_t status)
+{
+	NWK_TxPowerTableEntry_t *entry;
+
+	if (NWK_BROADCAST_ADDR == frame->header.macDstAddr) {
+		return false;
+	}
+
+	if (NULL == (entry = nwkTxPowerFindEntry(frame->header.macDstAddr))) {
+		return false;
+	}
+
+	if (PHY_STATUS_NO_ACK == status) {
+		if (NWK_TX_POWER_MAX == entry->level) {
+			return false;
+		}
+
+		entry->limit = entry->level;
+		entry->level = (entry->level > NWK_TX_POWER_STEP_UP) ?
+				entry->level - NWK_TX_POWER_STEP_UP : NWK_TX_POWER_MAX;
+		entry->successes = 0;
+
+		return true;
+	}
+
+	if (PHY_STATUS_SUCCESS != status) {
+		return false;
+	}
+
+	if (nwkTxPowerMargin(entry, entry->level) < NWK_TX_POWER_MARGIN) {
+		if (entry->level > NWK_TX_POWER_MAX) {
+			entry->level--;
+		}
+
+		entry->successes = 0;
+		return false;
+	}
+
+	if (++entry->successes == NWK_TX_POWER_RELAX_LIMIT) {
+		if (entry->limit < NWK_TX_POWER_NO_LIMIT) {
+			entry->limit++;
+		}
+
+		entry->successes = 0;
+	}
+
+	if (entry->successes >= NWK_TX_POWER_STEP_DOWN_COUNT &&
+			entry->level + 1 < entry->limit &&
+			nwkTxPowerMargin(entry, entry->level + 1) >=
+			NWK_TX_POWER_MARGIN) {
+		entry->level++;
+		entry->successes = 0;
+	}
+
+	return false;
+}
+
+#endif /* NWK_ENABLE_TX_POWER_CONTROL */
@@ -38,6 +38,7 @@
 #include <stdbool.h>
 #include "phy.h"
 #include "sal.h"
+#include "sysConfig.h"
 #include "trx_access.h"
 #include "delay.h"
 #include "at86rf231.h"
@@ -56,14 +57,19 @@ typedef enum {
 /*- Prototypes -------------------------------------------------------------*/
 static void phyWriteRegister(uint8_t reg, uint8_t value);
 static uint8_t phyReadRegister(uint8_t reg);
-static void phyWaitState(uint8_t state);
 static void phyTrxSetState(uint8_t state);
 static void phySetRxState(void);
+static void phyTxStart(void);
 
 /*- Variables --------------------------------------------------------------*/
 static PhyState_t phyState = PHY_STATE_INITIAL;
 static uint8_t phyRxBuffer[128];
 static bool phyRxState;
+static PHY_RadioStateHandler_t phyRadioStateHandler;
+/* Reading IRQ_STATUS clears it, so flags seen by PHY_TaskPending() are kept */
+static uint8_t phyIrqStatus;
+/* Frame waiting for the transceiver to become ready, NULL if none */
+static uint8_t *phyTxData;
 
 /*- Implementations --------------------------------------------------------*/
 
@@ -74,6 +80,7 @@ void PHY_Init(void)
 	trx_spi_init();
 	PhyReset();
 	phyRxState = false;
+	phyTxData = NULL;
 	phyState = PHY_STATE_IDLE;
 
 	do {phyWriteRegister(TRX_STATE_REG, TRX_CMD_TRX_OFF);
@@ -85,6 +92,11 @@ void PHY_Init(void)
 			(1 << IRQ_MASK_MODE));
 
 	phyWriteRegister(TRX_CTRL_2_REG, (1 << RX_SAFE_MODE));
+
+	/* Retransmissions are done by the transceiver in TX_ARET_ON */
+	phyWriteRegister(XAH_CTRL_0_REG,
+			(PHY_MAX_FRAME_RETRIES << MAX_FRAME_RETRES) |
+			(PHY_MAX_CSMA_RETRIES << MAX_CSMA_RETRES));
 }
 
 /*************************************************************************//**
@@ -136,6 +148,15 @@ void PHY_SetTxPower(uint8_t txPower)
 	phyWriteRegister(PHY_TX_PWR_REG, reg | txPower);
 }
 
+/*************************************************************************//**
+*  @brief Sets a handler which is called on every change of the transceiver
+*  state, e.g. for energy accounting
+*****************************************************************************/
+void PHY_SetRadioStateHandler(PHY_RadioStateHandler_t handler)
+{
+	phyRadioStateHandler = handler;
+}
+
 /*************************************************************************//**
 *****************************************************************************/
 void PHY_Sleep(void)
@@ -143,6 +164,10 @@ void PHY_Sleep(void)
 	phyTrxSetState(TRX_CMD_TRX_OFF);
 	TRX_SLP_TR_HIGH();
 	phyState = PHY_STATE_SLEEP;
+
+	if (phyRadioStateHandler) {
+		phyRadioStateHandler(PHY_RADIO_STATE_SLEEP);
+	}
 }
 
 /*************************************************************************//**
@@ -152,27 +177,22 @@ void PHY_Wakeup(void)
 	TRX_SLP_TR_LOW();
 	phySetRxState();
 	phyState = PHY_STATE_IDLE;
+
+	/* The AES key is lost in sleep, but the SAL skips loading it again */
+	sal_aes_restart();
 }
 
 /*************************************************************************//**
+*  @brief Queues @a data for transmission. The frame is sent as soon as the
+*  transceiver is not receiving or acknowledging a frame.
 *****************************************************************************/
 void PHY_DataReq(uint8_t *data)
 {
-	phyTrxSetState(TRX_CMD_TX_ARET_ON);
-
-	phyReadRegister(IRQ_STATUS_REG);
-
-	/* size of the buffer is sent as first byte of the data
-	 * and data starts from second byte.
-	 */
-	data[0] += 2;
-	trx_frame_write(data, (data[0] - 1) /* length value*/);
-
-	phyState = PHY_STATE_TX_WAIT_END;
+	phyTxData = data;
 
-	TRX_SLP_TR_HIGH();
-	TRX_TRIG_DELAY();
-	TRX_SLP_TR_LOW();
+	if (PHY_STATE_IDLE == phyState) {
+		phyTxStart();
+	}
 }
 
 /*************************************************************************//**
@@ -208,6 +228,15 @@ void PHY_EncryptReq(uint8_t *text, uint8_t *key)
 	sal_aes_read(text);
 }
 
+/*************************************************************************//**
+*  @brief Encrypts @a blocks independent blocks of @a text in place
+*****************************************************************************/
+void PHY_EncryptBlocksReq(uint8_t *text, uint8_t blocks, uint8_t *key)
+{
+	sal_aes_setup(key, AES_MODE_ECB, AES_DIR_ENCRYPT);
+	sal_aes_exec_blocks(text, blocks);
+}
+
 /*************************************************************************//**
 *****************************************************************************/
 int8_t PHY_EdReq(void)
@@ -245,14 +274,6 @@ static uint8_t phyReadRegister(uint8_t reg)
 	return value;
 }
 
-/*************************************************************************//**
-*****************************************************************************/
-static void phyWaitState(uint8_t state)
-{
-	while (state != (phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK)) {
-	}
-}
-
 /*************************************************************************//**
 *****************************************************************************/
 static void phySetRxState(void)
@@ -260,6 +281,7 @@ static void phySetRxState(void)
 	phyTrxSetState(TRX_CMD_TRX_OFF);
 
 	phyReadRegister(IRQ_STATUS_REG);
+	phyIrqStatus = 0;
 
 	if (phyRxState) {
 		phyTrxSetState(TRX_CMD_RX_AACK_ON);
@@ -277,6 +299,53 @@ static void phyTrxSetState(uint8_t state)
 	do { phyWriteRegister(TRX_STATE_REG,
 			     state); } while (state !=
 			(phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK));
+
+	if (phyRadioStateHandler) {
+		if (TRX_CMD_TRX_OFF == state) {
+			phyRadioStateHandler(PHY_RADIO_STATE_TRX_OFF);
+		} else if (TRX_CMD_TX_ARET_ON == state) {
+			phyRadioStateHandler(PHY_RADIO_STATE_BUSY_TX);
+		} else {
+			phyRadioStateHandler(PHY_RADIO_STATE_RX_ON);
+		}
+	}
+}
+
+/*************************************************************************//**
+*  @brief Sends the pending frame, unless a frame is being received or
+*  acknowledged or waits to be read, in which case this is retried from
+*  PHY_TaskHandler()
+*****************************************************************************/
+static void phyTxStart(void)
+{
+	uint8_t *data = phyTxData;
+	uint8_t status = phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK;
+
+	phyIrqStatus |= phyReadRegister(IRQ_STATUS_REG);
+
+	if (TRX_STATUS_BUSY_RX_AACK == status ||
+			(phyIrqStatus & (1 << TRX_END))) {
+		return;
+	}
+
+	phyTxData = NULL;
+
+	phyTrxSetState(TRX_CMD_TX_ARET_ON);
+
+	phyReadRegister(IRQ_STATUS_REG);
+	phyIrqStatus = 0;
+
+	/* size of the buffer is sent as first byte of the data
+	 * and data starts from second byte.
+	 */
+	data[0] += 2;
+	trx_frame_write(data, (data[0] - 1) /* length value*/);
+
+	phyState = PHY_STATE_TX_WAIT_END;
+
+	TRX_SLP_TR_HIGH();
+	TRX_TRIG_DELAY();
+	TRX_SLP_TR_LOW();
 }
 
 /*************************************************************************//**
@@ -290,6 +359,20 @@ void PHY_SetIEEEAddr(uint8_t *ieee_addr)
 	}
 }
 
+/*************************************************************************//**
+*****************************************************************************/
+bool PHY_TaskPending(void)
+{
+	if (PHY_STATE_SLEEP == phyState) {
+		return false;
+	}
+
+	phyIrqStatus |= phyReadRegister(IRQ_STATUS_REG);
+
+	return (phyIrqStatus & (1 << TRX_END)) ||
+			(NULL != phyTxData && PHY_STATE_IDLE == phyState);
+}
+
 /*************************************************************************//**
 *****************************************************************************/
 void PHY_TaskHandler(void)
@@ -298,7 +381,11 @@ void PHY_TaskHandler(void)
 		return;
 	}
 
-	if (phyReadRegister(IRQ_STATUS_REG) & (1 << TRX_END)) {
+	phyIrqStatus |= phyReadRegister(IRQ_STATUS_REG);
+
+	if (phyIrqStatus & (1 << TRX_END)) {
+		phyIrqStatus &= ~(1 << TRX_END);
+
 		if (PHY_STATE_IDLE == phyState) {
 			PHY_DataInd_t ind;
 			uint8_t size;
@@ -316,14 +403,16 @@ void PHY_TaskHandler(void)
 			ind.lqi  = phyRxBuffer[size + 1];
 			ind.rssi = rssi + PHY_RSSI_BASE_VAL;
 			PHY_DataInd(&ind);
-
-			phyWaitState(TRX_STATUS_RX_AACK_ON);
 		} else if (PHY_STATE_TX_WAIT_END == phyState) {
 			uint8_t status
 				= (phyReadRegister(TRX_STATE_REG) >>
 					TRAC_STATUS) & 7;
 
-			if (TRAC_STATUS_SUCCESS == status) {
+			/* The frame was acknowledged, the frame pending bit is
+			 * unused */
+			if (TRAC_STATUS_SUCCESS == status ||
+					TRAC_STATUS_SUCCESS_DATA_PENDING ==
+					status) {
 				status = PHY_STATUS_SUCCESS;
 			} else if (TRAC_STATUS_CHANNEL_ACCESS_FAILURE ==
 					status) {
@@ -340,6 +429,10 @@ void PHY_TaskHandler(void)
 			PHY_DataConf(status);
 		}
 	}
+
+	if (NULL != phyTxData && PHY_STATE_IDLE == phyState) {
+		phyTxStart();
+	}
 }
 
 #endif /* PHY_AT86RF231 */
@@ -69,6 +69,16 @@ enum {
     PHY_STATUS_ERROR                  = 3,
 };
 
+enum {
+    PHY_RADIO_STATE_SLEEP   = 0,
+    PHY_RADIO_STATE_TRX_OFF = 1,
+    PHY_RADIO_STATE_RX_ON   = 2,
+    PHY_RADIO_STATE_BUSY_TX = 3,
+    PHY_RADIO_STATES_AMOUNT = 4,
+};
+
+typedef void (*PHY_RadioStateHandler_t)(uint8_t state);
+
 /*- Prototypes -------------------------------------------------------------*/
 void PHY_Init(void);
 void PHY_SetRxState(bool rx);
@@ -76,16 +86,19 @@ void PHY_SetChannel(uint8_t channel);
 void PHY_SetPanId(uint16_t panId);
 void PHY_SetShortAddr(uint16_t addr);
 void PHY_SetTxPower(uint8_t txPower);
+void PHY_SetRadioStateHandler(PHY_RadioStateHandler_t handler);
 void PHY_Sleep(void);
 void PHY_Wakeup(void);
 void PHY_DataReq(uint8_t* data);
 void PHY_DataConf(uint8_t status);
 void PHY_DataInd(PHY_DataInd_t* ind);
 void PHY_TaskHandler(void);
+bool PHY_TaskPending(void);
 void PHY_SetIEEEAddr(uint8_t* ieee_addr);
 uint16_t PHY_RandomReq(void);
 
 void PHY_EncryptReq(uint8_t* text, uint8_t* key);
+void PHY_EncryptBlocksReq(uint8_t* text, uint8_t blocks, uint8_t* key);
 
 int8_t PHY_EdReq(void);
 
@@ -39,46 +39,69 @@
 #include "at86rf233.h"
 #include "delay.h"
 #include "sal.h"
+#include "sysConfig.h"
 #include "trx_access.h"
 #include <stdbool.h>
 
 /*- Definitions ------------------------------------------------------------*/
 #define PHY_CRC_SIZE 2
+/* CCA_ED_DONE doubles as AWAKE_END when leaving P_ON or SLEEP */
+#define PHY_IRQ_MASK ((1 << PLL_LOCK) | (1 << CCA_ED_DONE) | (1 << TRX_END))
 
 /*- Types ------------------------------------------------------------------*/
 typedef enum {
     PHY_STATE_INITIAL,
     PHY_STATE_IDLE,
     PHY_STATE_SLEEP,
+    PHY_STATE_WAKEUP,
+    PHY_STATE_TX_WAIT_PLL,
     PHY_STATE_TX_WAIT_END,
+    PHY_STATE_TX_CONF,
 } PhyState_t;
 
 /*- Prototypes -------------------------------------------------------------*/
 static void phyWriteRegister(uint8_t reg, uint8_t value);
 static uint8_t phyReadRegister(uint8_t reg);
-static void phyWaitState(uint8_t state);
+static void phyInterruptHandler(void);
+static void phyClearIrqStatus(uint8_t irq);
+static uint8_t phyTakeIrqStatus(void);
+static void phyWaitIrq(uint8_t irq);
+static void phyWaitWakeup(void);
+static void phyWakeupDone(void);
+static void phyWaitIdle(void);
 static void phyTrxSetState(uint8_t state);
 static void phySetRxState(void);
+static void phyTxStart(void);
+static void phyTxTrigger(void);
+static uint8_t phyTxStatus(void);
 
 /*- Variables --------------------------------------------------------------*/
 static PhyState_t phyState = PHY_STATE_INITIAL;
 static uint8_t phyRxBuffer[128];
 static bool phyRxState;
+static PHY_RadioStateHandler_t phyRadioStateHandler;
+/* Collected by the transceiver interrupt, as reading IRQ_STATUS clears it */
+static volatile uint8_t phyIrqStatus;
+/* Frame waiting for the transceiver to become ready, NULL if none */
+static uint8_t* phyTxData;
+/* Result of a transmission completed by phyWaitIdle(), for PHY_DataConf() */
+static uint8_t phyTxConfStatus;
 
 /*- Implementations --------------------------------------------------------*/
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
+ *  @brief Resets the transceiver and starts the transition to TRX_OFF. The
+ *  transition completes on AWAKE_END in PHY_TaskHandler(), requests made
+ *  until then are applied afterwards.
+ *****************************************************************************/
 void PHY_Init(void) {
     trx_spi_init();
     PhyReset();
-    phyRxState = false;
-    phyState   = PHY_STATE_IDLE;
+    phyRxState   = false;
+    phyTxData    = NULL;
+    phyIrqStatus = 0;
 
-    do {
-        phyWriteRegister(TRX_STATE_REG, TRX_CMD_TRX_OFF);
-    } while (TRX_STATUS_TRX_OFF !=
-             (phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK));
+    trx_irq_init((FUNC_PTR)phyInterruptHandler);
 
     phyWriteRegister(TRX_CTRL_1_REG,
                      (1 << TX_AUTO_CRC_ON) | (3 << SPI_CMD_MODE) |
@@ -86,13 +109,36 @@ void PHY_Init(void) {
 
     phyWriteRegister(TRX_CTRL_2_REG,
                      (1 << RX_SAFE_MODE) | (1 << OQPSK_SCRAM_EN));
+
+    /* Acknowledgements and retransmissions are left to TX_ARET and RX_AACK */
+    phyWriteRegister(XAH_CTRL_0_REG,
+                     (PHY_MAX_FRAME_RETRIES << MAX_FRAME_RETRES) |
+                         (PHY_MAX_CSMA_RETRIES << MAX_CSMA_RETRES));
+
+    phyWriteRegister(IRQ_MASK_REG, PHY_IRQ_MASK);
+
+    phyState = PHY_STATE_WAKEUP;
+    phyWriteRegister(TRX_STATE_REG, TRX_CMD_TRX_OFF);
+
+    /* AWAKE_END is lost if the transceiver reached TRX_OFF before the
+     * interrupt was unmasked */
+    if (TRX_STATUS_TRX_OFF ==
+        (phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK)) {
+        phyState = PHY_STATE_IDLE;
+    }
+
+    ENABLE_TRX_IRQ();
 }
 
 /*************************************************************************/ /**
                                                                              *****************************************************************************/
 void PHY_SetRxState(bool rx) {
     phyRxState = rx;
-    phySetRxState();
+
+    /* Applied when the transceiver is awake or the transmission is done */
+    if (PHY_STATE_IDLE == phyState) {
+        phySetRxState();
+    }
 }
 
 /*************************************************************************/ /**
@@ -132,40 +178,45 @@ void PHY_SetTxPower(uint8_t txPower) {
     phyWriteRegister(PHY_TX_PWR_REG, reg | txPower);
 }
 
+/*************************************************************************/ /**
+                                                                             *****************************************************************************/
+void PHY_SetRadioStateHandler(PHY_RadioStateHandler_t handler) {
+    phyRadioStateHandler = handler;
+}
+
 /*************************************************************************/ /**
                                                                              *****************************************************************************/
 void PHY_Sleep(void) {
     phyTrxSetState(TRX_CMD_TRX_OFF);
+    phyClearIrqStatus(PHY_IRQ_MASK);
     TRX_SLP_TR_HIGH();
     phyState = PHY_STATE_SLEEP;
+
+    if (phyRadioStateHandler) {
+        phyRadioStateHandler(PHY_RADIO_STATE_SLEEP);
+    }
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
+ *  @brief Starts waking the transceiver up. The receiver is turned on from
+ *  PHY_TaskHandler() once AWAKE_END signals that TRX_OFF has been reached.
+ *****************************************************************************/
 void PHY_Wakeup(void) {
+    phyState = PHY_STATE_WAKEUP;
     TRX_SLP_TR_LOW();
-    phySetRxState();
-    phyState = PHY_STATE_IDLE;
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
+ *  @brief Queues @a data for transmission. The frame is sent as soon as the
+ *  transceiver is awake and not receiving or acknowledging a frame, and the
+ *  transmission is started when the PLL has locked.
+ *****************************************************************************/
 void PHY_DataReq(uint8_t* data) {
-    phyTrxSetState(TRX_CMD_TX_ARET_ON);
-
-    phyReadRegister(IRQ_STATUS_REG);
-
-    /* size of the buffer is sent as first byte of the data
-     * and data starts from second byte.
-     */
-    data[0] += 2;
-    trx_frame_write(data, (data[0] - 1) /* length value*/);
-
-    phyState = PHY_STATE_TX_WAIT_END;
+    phyTxData = data;
 
-    TRX_SLP_TR_HIGH();
-    TRX_TRIG_DELAY();
-    TRX_SLP_TR_LOW();
+    if (PHY_STATE_IDLE == phyState) {
+        phyTxStart();
+    }
 }
 
 /*************************************************************************/ /**
@@ -174,7 +225,12 @@ uint16_t PHY_RandomReq(void) {
     uint16_t rnd = 0;
     uint8_t rndValue;
 
+    phyWaitIdle();
+
+    phyTrxSetState(TRX_CMD_TRX_OFF);
+    phyClearIrqStatus(1 << PLL_LOCK);
     phyTrxSetState(TRX_CMD_RX_ON);
+    phyWaitIrq(1 << PLL_LOCK);
 
     for (uint8_t i = 0; i < 16; i += 2) {
         delay_us(RANDOM_NUMBER_UPDATE_INTERVAL);
@@ -190,6 +246,8 @@ uint16_t PHY_RandomReq(void) {
 /*************************************************************************/ /**
                                                                              *****************************************************************************/
 void PHY_EncryptReq(uint8_t* text, uint8_t* key) {
+    phyWaitWakeup();
+
     sal_aes_setup(key, AES_MODE_ECB, AES_DIR_ENCRYPT);
 #if (SAL_TYPE == AT86RF2xx)
     sal_aes_wrrd(text, NULL);
@@ -200,14 +258,32 @@ void PHY_EncryptReq(uint8_t* text, uint8_t* key) {
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
+ *  @brief Encrypts @a blocks independent blocks of @a text in place
+ *****************************************************************************/
+void PHY_EncryptBlocksReq(uint8_t* text, uint8_t blocks, uint8_t* key) {
+    phyWaitWakeup();
+
+    sal_aes_setup(key, AES_MODE_ECB, AES_DIR_ENCRYPT);
+    sal_aes_exec_blocks(text, blocks);
+}
+
+/*************************************************************************/ /**
+ *  @brief Measures the energy on the current channel. The result is needed
+ *  right away, so this waits for PLL_LOCK and CCA_ED_DONE, but on the flags
+ *  collected by the interrupt rather than on the transceiver registers.
+ *****************************************************************************/
 int8_t PHY_EdReq(void) {
     uint8_t ed;
 
+    phyWaitIdle();
+
+    phyTrxSetState(TRX_CMD_TRX_OFF);
+    phyClearIrqStatus((1 << PLL_LOCK) | (1 << CCA_ED_DONE));
     phyTrxSetState(TRX_CMD_RX_ON);
-    phyWriteRegister(PHY_ED_LEVEL_REG, 0);
+    phyWaitIrq(1 << PLL_LOCK);
 
-    while (0 == (phyReadRegister(IRQ_STATUS_REG) & (1 << CCA_ED_DONE))) {}
+    phyWriteRegister(PHY_ED_LEVEL_REG, 0);
+    phyWaitIrq(1 << CCA_ED_DONE);
 
     ed = (int8_t)phyReadRegister(PHY_ED_LEVEL_REG);
 
@@ -233,17 +309,99 @@ static uint8_t phyReadRegister(uint8_t reg) {
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
-static void phyWaitState(uint8_t state) {
-    while (state != (phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK)) {}
+ *  @brief Transceiver interrupt, collects the interrupt flags
+ *****************************************************************************/
+static void phyInterruptHandler(void) {
+    phyIrqStatus |= phyReadRegister(IRQ_STATUS_REG) & PHY_IRQ_MASK;
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
+ *  @brief Discards the interrupt flags @a irq raised so far, the others are
+ *  kept for PHY_TaskHandler()
+ *****************************************************************************/
+static void phyClearIrqStatus(uint8_t irq) {
+    ENTER_TRX_CRITICAL_REGION();
+    phyIrqStatus |= phyReadRegister(IRQ_STATUS_REG) & PHY_IRQ_MASK;
+    phyIrqStatus &= ~irq;
+    LEAVE_TRX_CRITICAL_REGION();
+}
+
+/*************************************************************************/ /**
+ *  @return The interrupt flags raised since the last call, which are cleared
+ *****************************************************************************/
+static uint8_t phyTakeIrqStatus(void) {
+    uint8_t irq;
+
+    ENTER_TRX_CRITICAL_REGION();
+    irq          = phyIrqStatus;
+    phyIrqStatus = 0;
+    LEAVE_TRX_CRITICAL_REGION();
+
+    return irq;
+}
+
+/*************************************************************************/ /**
+ *  @brief Waits for the interrupt flag @a irq and clears it. Only used by
+ *  the requests which have to return a result right away.
+ *****************************************************************************/
+static void phyWaitIrq(uint8_t irq) {
+    while (0 == (phyIrqStatus & irq)) {}
+
+    ENTER_TRX_CRITICAL_REGION();
+    phyIrqStatus &= ~irq;
+    LEAVE_TRX_CRITICAL_REGION();
+}
+
+/*************************************************************************/ /**
+ *  @brief Completes a pending wake-up for the requests which need the
+ *  transceiver right away
+ *****************************************************************************/
+static void phyWaitWakeup(void) {
+    if (PHY_STATE_WAKEUP == phyState) {
+        phyWaitIrq(1 << CCA_ED_DONE);
+        phyWakeupDone();
+    }
+}
+
+/*************************************************************************/ /**
+ *  @brief Restores the receiver state once AWAKE_END has been handled. The
+ *  AES key is lost in sleep, but the SAL skips loading it again, so it is
+ *  written back while the transceiver is in TRX_OFF.
+ *****************************************************************************/
+static void phyWakeupDone(void) {
+    phyState = PHY_STATE_IDLE;
+    sal_aes_restart();
+    phySetRxState();
+}
+
+/*************************************************************************/ /**
+ *  @brief Completes a pending wake-up or transmission for the requests which
+ *  need the transceiver right away, so that they do not abort the
+ *  transmission. Its PHY_DataConf() is left to PHY_TaskHandler().
+ *****************************************************************************/
+static void phyWaitIdle(void) {
+    phyWaitWakeup();
+
+    if (PHY_STATE_TX_WAIT_PLL == phyState) {
+        phyWaitIrq(1 << PLL_LOCK);
+        phyTxTrigger();
+    }
+
+    if (PHY_STATE_TX_WAIT_END == phyState) {
+        phyWaitIrq(1 << TRX_END);
+        phyTxConfStatus = phyTxStatus();
+        phySetRxState();
+        phyState = PHY_STATE_TX_CONF;
+    }
+}
+
+/*************************************************************************/ /**
+ *  @brief Switches to the receive state. The frame buffer is protected until
+ *  it is read, so the TRX_END of a frame not read yet is kept.
+ *****************************************************************************/
 static void phySetRxState(void) {
     phyTrxSetState(TRX_CMD_TRX_OFF);
-
-    phyReadRegister(IRQ_STATUS_REG);
+    phyClearIrqStatus(PHY_IRQ_MASK & ~(1 << TRX_END));
 
     if (phyRxState) {
         phyTrxSetState(TRX_CMD_RX_AACK_ON);
@@ -251,16 +409,85 @@ static void phySetRxState(void) {
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
+ *  @brief Commands the transceiver to @a state without waiting for it.
+ *  FORCE_TRX_OFF takes effect within a microsecond, which is less than the
+ *  next SPI access takes. The PLL states are reached when PLL_LOCK is
+ *  raised.
+ *****************************************************************************/
 static void phyTrxSetState(uint8_t state) {
-    do {
-        phyWriteRegister(TRX_STATE_REG, TRX_CMD_FORCE_TRX_OFF);
-    } while (TRX_STATUS_TRX_OFF !=
-             (phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK));
+    phyWriteRegister(TRX_STATE_REG, TRX_CMD_FORCE_TRX_OFF);
 
-    do {
+    if (TRX_CMD_TRX_OFF != state) {
         phyWriteRegister(TRX_STATE_REG, state);
-    } while (state != (phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK));
+    }
+
+    if (phyRadioStateHandler) {
+        if (TRX_CMD_TRX_OFF == state) {
+            phyRadioStateHandler(PHY_RADIO_STATE_TRX_OFF);
+        } else if (TRX_CMD_TX_ARET_ON == state) {
+            phyRadioStateHandler(PHY_RADIO_STATE_BUSY_TX);
+        } else {
+            phyRadioStateHandler(PHY_RADIO_STATE_RX_ON);
+        }
+    }
+}
+
+/*************************************************************************/ /**
+ *  @brief Loads the pending frame and switches to TX_ARET_ON, unless a frame
+ *  is being received or acknowledged or waits to be read, in which case this
+ *  is retried from PHY_TaskHandler()
+ *****************************************************************************/
+static void phyTxStart(void) {
+    uint8_t* data = phyTxData;
+    uint8_t status = phyReadRegister(TRX_STATUS_REG) & TRX_STATUS_MASK;
+
+    if (TRX_STATUS_BUSY_RX_AACK == status || (phyIrqStatus & (1 << TRX_END))) {
+        return;
+    }
+
+    phyTxData = NULL;
+
+    phyTrxSetState(TRX_CMD_TRX_OFF);
+    phyClearIrqStatus(PHY_IRQ_MASK);
+
+    /* size of the buffer is sent as first byte of the data
+     * and data starts from second byte.
+     */
+    data[0] += 2;
+    trx_frame_write(data, (data[0] - 1) /* length value*/);
+
+    phyState = PHY_STATE_TX_WAIT_PLL;
+    phyTrxSetState(TRX_CMD_TX_ARET_ON);
+}
+
+/*************************************************************************/ /**
+ *  @brief Starts the transmission once the PLL has locked
+ *****************************************************************************/
+static void phyTxTrigger(void) {
+    phyState = PHY_STATE_TX_WAIT_END;
+
+    TRX_SLP_TR_HIGH();
+    TRX_TRIG_DELAY();
+    TRX_SLP_TR_LOW();
+}
+
+/*************************************************************************/ /**
+ *  @return The PHY status of the completed transmission
+ *****************************************************************************/
+static uint8_t phyTxStatus(void) {
+    uint8_t status = (phyReadRegister(TRX_STATE_REG) >> TRAC_STATUS) & 7;
+
+    /* The frame was acknowledged, the frame pending bit is unused */
+    if (TRAC_STATUS_SUCCESS == status ||
+        TRAC_STATUS_SUCCESS_DATA_PENDING == status) {
+        return PHY_STATUS_SUCCESS;
+    } else if (TRAC_STATUS_CHANNEL_ACCESS_FAILURE == status) {
+        return PHY_STATUS_CHANNEL_ACCESS_FAILURE;
+    } else if (TRAC_STATUS_NO_ACK == status) {
+        return PHY_STATUS_NO_ACK;
+    } else {
+        return PHY_STATUS_ERROR;
+    }
 }
 
 /*************************************************************************/ /**
@@ -273,14 +500,46 @@ void PHY_SetIEEEAddr(uint8_t* ieee_addr) {
     }
 }
 
+/*************************************************************************/ /**
+                                                                             *****************************************************************************/
+bool PHY_TaskPending(void) {
+    if (PHY_STATE_SLEEP == phyState) {
+        return false;
+    }
+
+    return 0 != phyIrqStatus || PHY_STATE_TX_CONF == phyState ||
+           (NULL != phyTxData && PHY_STATE_IDLE == phyState);
+}
+
 /*************************************************************************/ /**
                                                                              *****************************************************************************/
 void PHY_TaskHandler(void) {
+    uint8_t irq;
+
     if (PHY_STATE_SLEEP == phyState) {
         return;
     }
 
-    if (phyReadRegister(IRQ_STATUS_REG) & (1 << TRX_END)) {
+    irq = phyTakeIrqStatus();
+
+    if (PHY_STATE_WAKEUP == phyState) {
+        if (0 == (irq & (1 << CCA_ED_DONE))) {
+            return;
+        }
+
+        phyWakeupDone();
+    }
+
+    if (PHY_STATE_TX_CONF == phyState) {
+        phyState = PHY_STATE_IDLE;
+        PHY_DataConf(phyTxConfStatus);
+    }
+
+    if (PHY_STATE_TX_WAIT_PLL == phyState && (irq & (1 << PLL_LOCK))) {
+        phyTxTrigger();
+    }
+
+    if (irq & (1 << TRX_END)) {
         if (PHY_STATE_IDLE == phyState) {
             PHY_DataInd_t ind;
             uint8_t size;
@@ -298,21 +557,8 @@ void PHY_TaskHandler(void) {
             ind.lqi  = phyRxBuffer[size + 1];
             ind.rssi = rssi + PHY_RSSI_BASE_VAL;
             PHY_DataInd(&ind);
-
-            phyWaitState(TRX_STATUS_RX_AACK_ON);
         } else if (PHY_STATE_TX_WAIT_END == phyState) {
-            uint8_t status = (phyReadRegister(TRX_STATE_REG) >> TRAC_STATUS) &
-                             7;
-
-            if (TRAC_STATUS_SUCCESS == status) {
-                status = PHY_STATUS_SUCCESS;
-            } else if (TRAC_STATUS_CHANNEL_ACCESS_FAILURE == status) {
-                status = PHY_STATUS_CHANNEL_ACCESS_FAILURE;
-            } else if (TRAC_STATUS_NO_ACK == status) {
-                status = PHY_STATUS_NO_ACK;
-            } else {
-                status = PHY_STATUS_ERROR;
-            }
+            uint8_t status = phyTxStatus();
 
             phySetRxState();
             phyState = PHY_STATE_IDLE;
@@ -320,6 +566,10 @@ void PHY_TaskHandler(void) {
             PHY_DataConf(status);
         }
     }
+
+    if (NULL != phyTxData && PHY_STATE_IDLE == phyState) {
+        phyTxStart();
+    }
 }
 
 #endif /* PHY_AT86RF233 */
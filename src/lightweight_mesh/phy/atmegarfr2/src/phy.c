@@ -37,12 +37,17 @@
 /*- Includes ---------------------------------------------------------------*/
 #include "phy.h"
 #include "atmegarfr2.h"
+#include "compiler.h"
 #include "delay.h"
 #include "sal.h"
+#include "sysConfig.h"
+#include <avr/interrupt.h>
 
 /*- Definitions ------------------------------------------------------------*/
 #define PHY_CRC_SIZE      2
 #define TRX_RPC_REG_VALUE 0xeb
+/* Interrupts which wake the MCU from idle when a frame was received or sent */
+#define PHY_IRQ_MASK      ((1 << RX_END) | (1 << TX_END))
 
 /*- Types ------------------------------------------------------------------*/
 typedef enum {
@@ -56,6 +61,9 @@ typedef enum {
 static void phyTrxSetState(uint8_t state);
 static void phySetChannel(void);
 static void phySetRxState(void);
+static void phyTxStart(void);
+static uint8_t phyIrqStatus(void);
+static void phyClearIrqStatus(uint8_t irq);
 
 /*- Variables --------------------------------------------------------------*/
 static PhyState_t phyState = PHY_STATE_INITIAL;
@@ -63,15 +71,22 @@ static uint8_t phyRxBuffer[128];
 static bool phyRxState;
 static uint8_t phyChannel;
 static uint8_t phyBand;
+static PHY_RadioStateHandler_t phyRadioStateHandler;
+/* Frame waiting for the transceiver to become ready, NULL if none */
+static uint8_t* phyTxData;
+/* RX_END and TX_END taken by their interrupts */
+static volatile uint8_t phyIrqTaken;
 
 void PHY_Init(void) {
     sysclk_enable_peripheral_clock(&TRX_CTRL_0);
 
     TRXPR_REG_s.trxrst = 1;
 
-    phyRxState = false;
-    phyBand    = 0;
-    phyState   = PHY_STATE_IDLE;
+    phyRxState  = false;
+    phyBand     = 0;
+    phyTxData   = NULL;
+    phyState    = PHY_STATE_IDLE;
+    phyIrqTaken = 0;
 
     phyTrxSetState(TRX_CMD_TRX_OFF);
 
@@ -79,6 +94,14 @@ void PHY_Init(void) {
 
     TRX_CTRL_2_REG_s.rxSafeMode = 1;
 
+    /* Acknowledgements and retransmissions are left to TX_ARET and RX_AACK */
+    XAH_CTRL_0_REG_s.maxFrameRetries = PHY_MAX_FRAME_RETRIES;
+    XAH_CTRL_0_REG_s.maxCsmaRetries  = PHY_MAX_CSMA_RETRIES;
+
+    /* The frames are still handled in PHY_TaskHandler(), the interrupts only
+     * wake the MCU from idle */
+    IRQ_MASK_REG = PHY_IRQ_MASK;
+
 #ifdef PHY_ENABLE_RANDOM_NUMBER_GENERATOR
     CSMA_SEED_0_REG = (uint8_t)PHY_RandomReq();
 #endif
@@ -119,30 +142,35 @@ void PHY_SetShortAddr(uint16_t addr) {
 
 void PHY_SetTxPower(uint8_t txPower) { PHY_TX_PWR_REG_s.txPwr = txPower; }
 
+void PHY_SetRadioStateHandler(PHY_RadioStateHandler_t handler) {
+    phyRadioStateHandler = handler;
+}
+
 void PHY_Sleep(void) {
     phyTrxSetState(TRX_CMD_TRX_OFF);
     TRXPR_REG_s.slptr = 1;
     phyState          = PHY_STATE_SLEEP;
+
+    if (phyRadioStateHandler) {
+        phyRadioStateHandler(PHY_RADIO_STATE_SLEEP);
+    }
 }
 
 void PHY_Wakeup(void) {
     TRXPR_REG_s.slptr = 0;
     phySetRxState();
     phyState = PHY_STATE_IDLE;
+
+    /* The AES key is lost in sleep, but the SAL skips loading it again */
+    sal_aes_restart();
 }
 
 void PHY_DataReq(uint8_t* data) {
-    phyTrxSetState(TRX_CMD_TX_ARET_ON);
+    phyTxData = data;
 
-    IRQ_STATUS_REG = IRQ_CLEAR_VALUE;
-
-    TRX_FRAME_BUFFER(0) = data[0] + PHY_CRC_SIZE;
-    for (uint8_t i = 0; i < data[0]; i++) {
-        TRX_FRAME_BUFFER(i + 1) = data[i + 1];
+    if (PHY_STATE_IDLE == phyState) {
+        phyTxStart();
     }
-
-    phyState      = PHY_STATE_TX_WAIT_END;
-    TRX_STATE_REG = TRX_CMD_TX_START;
 }
 
 uint16_t PHY_RandomReq(void) {
@@ -172,6 +200,11 @@ void PHY_EncryptReq(uint8_t* text, uint8_t* key) {
     sal_aes_read(text);
 }
 
+void PHY_EncryptBlocksReq(uint8_t* text, uint8_t blocks, uint8_t* key) {
+    sal_aes_setup(key, AES_MODE_ECB, AES_DIR_ENCRYPT);
+    sal_aes_exec_blocks(text, blocks);
+}
+
 int8_t PHY_EdReq(void) {
     int8_t ed;
 
@@ -201,7 +234,7 @@ static void phySetChannel(void) {
 static void phySetRxState(void) {
     phyTrxSetState(TRX_CMD_TRX_OFF);
 
-    IRQ_STATUS_REG = IRQ_CLEAR_VALUE;
+    phyClearIrqStatus(IRQ_CLEAR_VALUE);
 
     if (phyRxState) {
         phyTrxSetState(TRX_CMD_RX_AACK_ON);
@@ -214,6 +247,67 @@ static void phyTrxSetState(uint8_t state) {
     } while (TRX_STATUS_TRX_OFF != TRX_STATUS_REG_s.trxStatus);
 
     do { TRX_STATE_REG = state; } while (state != TRX_STATUS_REG_s.trxStatus);
+
+    if (phyRadioStateHandler) {
+        if (TRX_CMD_TRX_OFF == state) {
+            phyRadioStateHandler(PHY_RADIO_STATE_TRX_OFF);
+        } else if (TRX_CMD_TX_ARET_ON == state) {
+            phyRadioStateHandler(PHY_RADIO_STATE_BUSY_TX);
+        } else {
+            phyRadioStateHandler(PHY_RADIO_STATE_RX_ON);
+        }
+    }
+}
+
+/* Sends the pending frame, unless a received frame is being acknowledged or
+ * waits to be read, in which case this is retried from PHY_TaskHandler() */
+static void phyTxStart(void) {
+    uint8_t* data = phyTxData;
+
+    if (TRX_STATUS_BUSY_RX_AACK == TRX_STATUS_REG_s.trxStatus ||
+        (phyIrqStatus() & (1 << RX_END))) {
+        return;
+    }
+
+    phyTxData = NULL;
+
+    phyTrxSetState(TRX_CMD_TX_ARET_ON);
+
+    phyClearIrqStatus(IRQ_CLEAR_VALUE);
+
+    TRX_FRAME_BUFFER(0) = data[0] + PHY_CRC_SIZE;
+    for (uint8_t i = 0; i < data[0]; i++) {
+        TRX_FRAME_BUFFER(i + 1) = data[i + 1];
+    }
+
+    phyState      = PHY_STATE_TX_WAIT_END;
+    TRX_STATE_REG = TRX_CMD_TX_START;
+}
+
+/* Pending RX_END and TX_END, whether taken by their interrupts or not */
+static uint8_t phyIrqStatus(void) {
+    return (phyIrqTaken | IRQ_STATUS_REG) & PHY_IRQ_MASK;
+}
+
+static void phyClearIrqStatus(uint8_t irq) {
+    irqflags_t flags = cpu_irq_save();
+
+    IRQ_STATUS_REG = irq;
+    phyIrqTaken &= ~irq;
+
+    cpu_irq_restore(flags);
+}
+
+/* The flags are cleared when the interrupt is served, so they are kept for
+ * PHY_TaskHandler(). They are cleared here too, in case they are not. */
+ISR(TRX24_RX_END_vect) {
+    IRQ_STATUS_REG = 1 << RX_END;
+    phyIrqTaken |= 1 << RX_END;
+}
+
+ISR(TRX24_TX_END_vect) {
+    IRQ_STATUS_REG = 1 << TX_END;
+    phyIrqTaken |= 1 << TX_END;
 }
 
 void PHY_SetIEEEAddr(uint8_t* ieee_addr) {
@@ -228,12 +322,25 @@ void PHY_SetIEEEAddr(uint8_t* ieee_addr) {
     IEEE_ADDR_7_REG     = *ptr_to_reg;
 }
 
+bool PHY_TaskPending(void) {
+    if (PHY_STATE_SLEEP == phyState) {
+        return false;
+    }
+
+    return phyIrqStatus() ||
+           (NULL != phyTxData && PHY_STATE_IDLE == phyState);
+}
+
 void PHY_TaskHandler(void) {
+    uint8_t irq;
+
     if (PHY_STATE_SLEEP == phyState) {
         return;
     }
 
-    if (IRQ_STATUS_REG_s.rxEnd) {
+    irq = phyIrqStatus();
+
+    if (irq & (1 << RX_END)) {
         PHY_DataInd_t ind;
         uint8_t size = TST_RX_LENGTH_REG;
 
@@ -247,16 +354,16 @@ void PHY_TaskHandler(void) {
         ind.rssi = (int8_t)PHY_ED_LEVEL_REG + PHY_RSSI_BASE_VAL;
         PHY_DataInd(&ind);
 
-        while (TRX_STATUS_RX_AACK_ON != TRX_STATUS_REG_s.trxStatus) {}
-
-        IRQ_STATUS_REG_s.rxEnd      = 1;
+        phyClearIrqStatus(1 << RX_END);
         TRX_CTRL_2_REG_s.rxSafeMode = 0;
         TRX_CTRL_2_REG_s.rxSafeMode = 1;
-    } else if (IRQ_STATUS_REG_s.txEnd) {
+    } else if (irq & (1 << TX_END)) {
         if (TRX_STATUS_TX_ARET_ON == TRX_STATUS_REG_s.trxStatus) {
             uint8_t status = TRX_STATE_REG_s.tracStatus;
 
-            if (TRAC_STATUS_SUCCESS == status) {
+            /* The frame was acknowledged, the frame pending bit is unused */
+            if (TRAC_STATUS_SUCCESS == status ||
+                TRAC_STATUS_SUCCESS_DATA_PENDING == status) {
                 status = PHY_STATUS_SUCCESS;
             } else if (TRAC_STATUS_CHANNEL_ACCESS_FAILURE == status) {
                 status = PHY_STATUS_CHANNEL_ACCESS_FAILURE;
@@ -272,7 +379,11 @@ void PHY_TaskHandler(void) {
             PHY_DataConf(status);
         }
 
-        IRQ_STATUS_REG_s.txEnd = 1;
+        phyClearIrqStatus(1 << TX_END);
+    }
+
+    if (NULL != phyTxData && PHY_STATE_IDLE == phyState) {
+        phyTxStart();
     }
 }
 
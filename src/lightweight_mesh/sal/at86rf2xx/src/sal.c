@@ -234,6 +234,19 @@ void sal_aes_read(uint8_t* data) {
     for (i = 0; i < AES_BLOCKSIZE; ++i) { *data++ = AES_STATE; }
 }
 
+/**
+ * @brief En/decrypts consecutive AES blocks in place
+ *
+ * @param[in,out] data    AES blocks to be en/decrypted
+ * @param[in]     blocks  Number of blocks in @p data
+ */
+void sal_aes_exec_blocks(uint8_t* data, uint8_t blocks) {
+    for (; blocks > 0; --blocks, data += AES_BLOCKSIZE) {
+        sal_aes_exec(data);
+        sal_aes_read(data);
+    }
+}
+
 #endif /* ATXMEGA_SAL */
 
 #if (SAL_TYPE == AT86RF2xx)
@@ -256,6 +269,8 @@ void sal_aes_read(uint8_t* data) {
 
 /* True after sal_aes_setup(). */
 static bool setup_flag;
+/* AES_CTRL value of the last sal_aes_setup(), 0xFF before the first. */
+static uint8_t aes_cmd = 0xFF;
 /* True if decryption key is actual and was computed. */
 static bool dec_initialized = false;
 /* Buffer written over SPI to AES unit. */
@@ -293,8 +308,21 @@ void sal_init(void) {}
  * @return  False if some parameter was illegal, true else
  */
 bool sal_aes_setup(uint8_t* key, uint8_t enc_mode, uint8_t dir) {
+    uint8_t cmd;
+    bool reload = false;
+
+    /*
+     * Writing the key costs an SPI transfer of 17 bytes, so it is skipped
+     * when the key already is loaded.
+     */
+    if (key != NULL && last_dir != AES_DIR_VOID &&
+        memcmp(key, enc_key, AES_KEYSIZE) == 0) {
+        key = NULL;
+    }
+
     if (key != NULL) {
         /* Setup key. */
+        reload          = true;
         dec_initialized = false;
 
         last_dir = AES_DIR_VOID;
@@ -323,6 +351,7 @@ bool sal_aes_setup(uint8_t* key, uint8_t enc_mode, uint8_t dir) {
              * If the last operation was decryption, the encryption
              * key must be stored in enc_key, so re-initialize it.
              */
+            reload     = true;
             aes_buf[0] = SR_MASK(SR_AES_MODE, AES_MODE_KEY);
 
             /* Fill in key. */
@@ -338,6 +367,7 @@ bool sal_aes_setup(uint8_t* key, uint8_t enc_mode, uint8_t dir) {
 
     case AES_DIR_DECRYPT:
         if (last_dir != AES_DIR_DECRYPT) {
+            reload     = true;
             aes_buf[0] = SR_MASK(SR_AES_MODE, AES_MODE_KEY);
 
             if (!dec_initialized) {
@@ -397,9 +427,9 @@ bool sal_aes_setup(uint8_t* key, uint8_t enc_mode, uint8_t dir) {
     switch (enc_mode) {
     case AES_MODE_ECB:
     case AES_MODE_CBC: {
-        aes_buf[0] = SR_MASK(SR_AES_MODE, enc_mode) | SR_MASK(SR_AES_DIR, dir);
-        aes_buf[AES_BLOCKSIZE + 1] = SR_MASK(SR_AES_MODE, enc_mode) |
-                                     SR_MASK(SR_AES_DIR, dir) |
+        cmd        = SR_MASK(SR_AES_MODE, enc_mode) | SR_MASK(SR_AES_DIR, dir);
+        aes_buf[0] = cmd;
+        aes_buf[AES_BLOCKSIZE + 1] = cmd |
                                      SR_MASK(SR_AES_REQUEST, AES_REQUEST);
     } break;
 
@@ -407,7 +437,16 @@ bool sal_aes_setup(uint8_t* key, uint8_t enc_mode, uint8_t dir) {
         return (false);
     }
 
-    setup_flag = true;
+    /*
+     * The unit only has to be switched to the new mode if it was left in key
+     * mode or the mode changed. Otherwise the mode is set by the AES_CTRL
+     * mirror written with the next block.
+     */
+    if (reload || cmd != aes_cmd) {
+        setup_flag = true;
+    }
+
+    aes_cmd = cmd;
 
     return (true);
 }
@@ -435,6 +474,12 @@ void sal_aes_restart(void) {
      */
     uint8_t* keyp;
     uint8_t save_cmd;
+
+    /* No key has been loaded yet. */
+    if (last_dir == AES_DIR_VOID) {
+        return;
+    }
+
     if (last_dir == AES_DIR_ENCRYPT) {
         keyp = enc_key;
     } else {
@@ -524,6 +569,30 @@ void sal_aes_read(uint8_t* data) {
     trx_sram_read((AES_BASE_ADDR + RG_AES_STATE_KEY_0), data, AES_BLOCKSIZE);
 }
 
+/**
+ * @brief En/decrypts consecutive AES blocks in place
+ *
+ * Each block is written in the same SPI transfer which reads the result of
+ * the previous block, so n blocks take n + 1 transfers instead of 2n.
+ *
+ * @param[in,out] data    AES blocks to be en/decrypted
+ * @param[in]     blocks  Number of blocks in @p data
+ */
+void sal_aes_exec_blocks(uint8_t* data, uint8_t blocks) {
+    if (blocks == 0) {
+        return;
+    }
+
+    sal_aes_wrrd(data, NULL);
+
+    for (uint8_t i = 1; i < blocks; ++i) {
+        sal_aes_wrrd(data + AES_BLOCKSIZE, data);
+        data += AES_BLOCKSIZE;
+    }
+
+    sal_aes_read(data);
+}
+
 #endif /* AT86RF2xx */
 
 /* EOF */
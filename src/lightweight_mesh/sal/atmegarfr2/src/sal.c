@@ -194,6 +194,12 @@ void sal_init(void) {}
 bool sal_aes_setup(uint8_t* key, uint8_t enc_mode, uint8_t dir) {
     uint8_t i;
 
+    /* The key is only written when it is not loaded already. */
+    if (key != NULL && last_dir != AES_DIR_VOID &&
+        memcmp(key, enc_key, AES_KEYSIZE) == 0) {
+        key = NULL;
+    }
+
     if (key != NULL) {
         /* Setup key. */
         dec_initialized = false;
@@ -291,6 +297,11 @@ void sal_aes_restart(void) {
     uint8_t i;
     uint8_t* keyp;
 
+    /* No key has been loaded yet. */
+    if (last_dir == AES_DIR_VOID) {
+        return;
+    }
+
     if (last_dir == AES_DIR_ENCRYPT) {
         keyp = enc_key;
     } else {
@@ -345,6 +356,19 @@ void sal_aes_read(uint8_t* data) {
     }
 }
 
+/**
+ * @brief En/decrypts consecutive AES blocks in place
+ *
+ * @param[in,out] data    AES blocks to be en/decrypted
+ * @param[in]     blocks  Number of blocks in @p data
+ */
+void sal_aes_exec_blocks(uint8_t* data, uint8_t blocks) {
+    for (; blocks > 0; --blocks, data += AES_BLOCKSIZE) {
+        sal_aes_exec(data);
+        sal_aes_read(data);
+    }
+}
+
 #endif /* AT86RFAx */
 
 /* EOF */
@@ -174,6 +174,20 @@ void sal_init(void);
  */
 void sal_aes_read(uint8_t* data);
 
+/**
+ * @brief En/decrypts consecutive AES blocks in place
+ *
+ * The blocks are processed with the key and mode of the last
+ * sal_aes_setup(). On the AT86RF2xx, the result of each block is read in
+ * the same SPI transfer which writes the next one.
+ *
+ * @param[in,out] data    AES blocks to be en/decrypted
+ * @param[in]     blocks  Number of blocks in @p data
+ *
+ * @ingroup group_SalApi
+ */
+void sal_aes_exec_blocks(uint8_t* data, uint8_t blocks);
+
 #if defined(__DOXYGEN__)
 
 /**
@@ -57,6 +57,17 @@ void sm_init(void);
  */
 void sm_sleep(uint32_t interval);
 
+/**
+ *  \brief Returns a free running timestamp which also advances while the
+ *  device sleeps
+ */
+uint32_t sm_timestamp(void);
+
+/**
+ *  \brief Returns the number of timestamp ticks per second
+ */
+uint32_t sm_timestamp_frequency(void);
+
 #ifdef __cplusplus
 }
 #endif
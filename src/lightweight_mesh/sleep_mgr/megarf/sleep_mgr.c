@@ -39,8 +39,10 @@
  */
 #include "sleep_mgr.h"
 #include "conf_sleepmgr.h"
+#include "delay.h"
 #include "macsc_megarf.h"
 #include "sleepmgr.h"
+#include "sysConfig.h"
 #include "sysclk.h"
 
 #define COMPARE_MODE MACSC_RELATIVE_CMP
@@ -48,18 +50,40 @@
 #ifdef SLEEP_MGR_TIMER_RES
 #define CONFIG_MACSC_HZ (1)
 #else
-#define CONFIG_MACSC_HZ (62500)
+#define CONFIG_MACSC_HZ (32768)
 #endif
 
+/* Rate of the symbol counter when it runs from the 16 MHz crystal */
+#define MACSC_XTAL_HZ (62500)
+
+/* Length of the measurement of the symbol counter rate in sm_init() */
+#define MACSC_CHECK_MS (10)
+
+#if defined(SYS_ENABLE_TICKLESS_TIMER) && CONFIG_MACSC_HZ < 1000
+#error The tickless SYS timer needs a timestamp of at least 1 kHz
+#endif
+
+static bool initialised = false;
+
+/* Ticks of the symbol counter per second, as measured in sm_init() */
+static uint32_t macsc_hz = CONFIG_MACSC_HZ;
+
 static void cmp3_int_cb(void) {
-    /*Disable The MAC Symbol Counter*/
-    macsc_disable();
+    /*The MAC Symbol Counter is kept running as the timestamp source*/
 }
 
 /**
  * \brief This function Initializes the Sleep functions
  */
 void sm_init(void) {
+    /* Both the application and the tickless SYS timer initialise the sleep
+     * functions */
+    if (initialised) {
+        return;
+    }
+
+    initialised = true;
+
     /* Set the sleep mode to initially lock. */
     sleep_set_mode(SLEEP_SMODE_PSAVE);
     sysclk_enable_peripheral_clock(&TCCR2A);
@@ -67,6 +91,20 @@ void sm_init(void) {
     macsc_sleep_clk_enable();
     macsc_set_cmp3_int_cb(cmp3_int_cb);
     macsc_enable_cmp_int(MACSC_CC3);
+    macsc_enable();
+
+    /* SCCKSEL selects the 32.768 kHz RTC, the same clock the counter falls
+     * back to while the transceiver sleeps, so the rate does not change
+     * with the sleep state. The rate is measured against the CPU clock on
+     * every start, in case the counter still runs from the crystal. */
+    const uint32_t start = macsc_read_count();
+    delay_ms(MACSC_CHECK_MS);
+    const uint32_t ticks = macsc_read_count() - start;
+
+    if (ticks * 1000 / MACSC_CHECK_MS >
+        (CONFIG_MACSC_HZ + MACSC_XTAL_HZ) / 2) {
+        macsc_hz = MACSC_XTAL_HZ;
+    }
 }
 
 /**
@@ -79,7 +117,15 @@ void sm_sleep(uint32_t interval) {
     macsc_enable();
     /*Timestamp the current symbol counter value for Comparison*/
     macsc_enable_manual_bts();
-    macsc_use_cmp(COMPARE_MODE, interval * CONFIG_MACSC_HZ, MACSC_CC3);
+    macsc_use_cmp(COMPARE_MODE, interval * macsc_hz, MACSC_CC3);
     sleep_enable();
     sleep_enter();
 }
+
+/**
+ * \brief Returns the MAC Symbol Counter value, which is clocked by the 32 kHz
+ * crystal and keeps counting during sleep
+ */
+uint32_t sm_timestamp(void) { return macsc_read_count(); }
+
+uint32_t sm_timestamp_frequency(void) { return macsc_hz; }
@@ -43,6 +43,31 @@
 #include "sleepmgr.h"
 #include "sysclk.h"
 
+#define RTC_FREQUENCY (1024)
+
+/* Timestamp at the last restart of the RTC */
+static uint32_t rtc_time_base;
+
+/* Overflows of the RTC since the last restart while awake */
+static volatile uint16_t rtc_overflows;
+
+static volatile bool sleeping;
+
+static bool initialised = false;
+
+/**
+ * \brief Lets the RTC count freely at full resolution while awake
+ */
+static void rtc_free_run(void) {
+    RTC.PER  = 0xFFFF;
+    RTC.CNT  = 0;
+    RTC.CTRL = RTC_PRESCALER_DIV1_gc;
+    do {
+    } while (RTC.STATUS & RTC_SYNCBUSY_bm);
+
+    rtc_overflows = 0;
+}
+
 /**
  * \brief This function Initializes the Sleep functions
  */
@@ -50,6 +75,14 @@ void sm_init(void) {
     /* Set the sleep mode to initially lock. */
     enum sleepmgr_mode mode = SLEEPMGR_PSAVE;
 
+    /* Both the application and the tickless SYS timer initialise the sleep
+     * functions, a restart would reset the timestamp */
+    if (initialised) {
+        return;
+    }
+
+    initialised = true;
+
     /* Enable RTC with Internal RCOSC as clock source. */
     sysclk_enable_module(SYSCLK_PORT_GEN, SYSCLK_RTC);
 
@@ -64,12 +97,20 @@ void sm_init(void) {
     /* Initialize the sleep manager, lock initial mode. */
     sleepmgr_init();
     sleepmgr_lock_mode(mode);
+
+    rtc_time_base = 0;
+    rtc_free_run();
 }
 
 /**
  * \brief This function puts the  device to sleep
  */
 void sm_sleep(uint32_t interval) {
+    /* The RTC is prescaled during sleep, so the timestamp is advanced by the
+     * interval instead */
+    rtc_time_base = sm_timestamp() + interval * RTC_FREQUENCY;
+    sleeping      = true;
+
     /* Configure RTC for wakeup at interval period . */
     RTC.PER  = interval - 1;
     RTC.CNT  = 0;
@@ -78,7 +119,32 @@ void sm_sleep(uint32_t interval) {
     } while (RTC.STATUS & RTC_SYNCBUSY_bm);
 
     sleepmgr_enter_sleep();
+
+    sleeping = false;
+    rtc_free_run();
 }
 
+uint32_t sm_timestamp(void) {
+    irqflags_t flags = cpu_irq_save();
+
+    uint16_t count     = RTC.CNT;
+    uint16_t overflows = rtc_overflows;
+
+    /* Account for an overflow which has not been serviced yet */
+    if ((RTC.INTFLAGS & RTC_OVFIF_bm) && count < 0x8000) {
+        overflows++;
+    }
+
+    cpu_irq_restore(flags);
+
+    return rtc_time_base + ((uint32_t)overflows << 16) + count;
+}
+
+uint32_t sm_timestamp_frequency(void) { return RTC_FREQUENCY; }
+
 /* Interrupt Service Routine definitions */
-ISR(RTC_OVF_vect) {}
+ISR(RTC_OVF_vect) {
+    if (!sleeping) {
+        rtc_overflows++;
+    }
+}
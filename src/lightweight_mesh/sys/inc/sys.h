@@ -90,7 +90,8 @@ extern "C" {
 /*- Prototypes -------------------------------------------------------------*/
 
 void SYS_Init(void);
-void SYS_TaskHandler(void);
+bool SYS_TaskHandler(void);
+bool SYS_TaskPending(void);
 
 #ifdef __cplusplus
 }
@@ -61,10 +61,18 @@ extern "C" {
 #define NWK_DUPLICATE_REJECTION_TTL 1000 /* ms */
 #endif
 
+#ifndef NWK_DUPLICATE_REJECTION_HASH_BITS
+#define NWK_DUPLICATE_REJECTION_HASH_BITS 3
+#endif
+
 #ifndef NWK_ROUTE_TABLE_SIZE
 #define NWK_ROUTE_TABLE_SIZE 10
 #endif
 
+#ifndef NWK_ROUTE_HASH_BITS
+#define NWK_ROUTE_HASH_BITS 4
+#endif
+
 #ifndef NWK_ROUTE_DEFAULT_SCORE
 #define NWK_ROUTE_DEFAULT_SCORE 3
 #endif
@@ -85,17 +93,176 @@ extern "C" {
 #define NWK_ROUTE_DISCOVERY_TIMEOUT 1000 /* ms */
 #endif
 
+#ifndef NWK_TX_POWER_TABLE_SIZE
+#define NWK_TX_POWER_TABLE_SIZE 5
+#endif
+
+#ifndef NWK_TX_POWER_MARGIN
+#define NWK_TX_POWER_MARGIN 10 /* dB */
+#endif
+
+#ifndef NWK_TX_POWER_STEP_UP
+#define NWK_TX_POWER_STEP_UP 4
+#endif
+
+#ifndef NWK_TX_POWER_STEP_DOWN_COUNT
+#define NWK_TX_POWER_STEP_DOWN_COUNT 4
+#endif
+
+#ifndef NWK_DATA_REQ_PASS_LIMIT
+#define NWK_DATA_REQ_PASS_LIMIT 4 /* requests per stage and pass */
+#endif
+
+#ifndef NWK_SECURITY_MIC_SIZE
+#define NWK_SECURITY_MIC_SIZE 4 /* bytes, 4, 8 or 16 */
+#endif
+
+#ifndef NWK_SECURITY_PASS_LIMIT
+#define NWK_SECURITY_PASS_LIMIT 2 /* frames per pass */
+#endif
+
+/* One replay window per peer whose frames are received. A peer whose window
+ * was reused for another one is accepted again with any counter, so the
+ * table should hold every peer, or the peers should be registered with
+ * NWK_AddSecurityPeer() and NWK_SECURITY_REJECT_UNKNOWN_PEERS defined. */
+#ifndef NWK_SECURITY_REPLAY_TABLE_SIZE
+#define NWK_SECURITY_REPLAY_TABLE_SIZE 10
+#endif
+
+#ifndef NWK_SECURITY_REPLAY_HASH_BITS
+#define NWK_SECURITY_REPLAY_HASH_BITS 4
+#endif
+
+#ifndef NWK_SECURITY_KEYS_AMOUNT
+#define NWK_SECURITY_KEYS_AMOUNT 4
+#endif
+
+#ifndef NWK_KEY_SWITCH_GRACE_TIME
+#define NWK_KEY_SWITCH_GRACE_TIME 60000 /* ms */
+#endif
+
+/* Longest time the previous key is kept while peers still use it */
+#ifndef NWK_KEY_SWITCH_MAX_GRACE_TIME
+#define NWK_KEY_SWITCH_MAX_GRACE_TIME 86400000ul /* ms */
+#endif
+
+#ifndef NWK_ROUTE_PARENT_TABLE_SIZE
+#define NWK_ROUTE_PARENT_TABLE_SIZE 3
+#endif
+
 /* #define NWK_ENABLE_ROUTING */
 /* #define NWK_ENABLE_SECURITY */
 /* #define NWK_ENABLE_MULTICAST */
 /* #define NWK_ENABLE_ROUTE_DISCOVERY */
 /* #define NWK_ENABLE_SECURE_COMMANDS */
+/* #define NWK_ENABLE_CHANNEL_SWITCH */
+/* #define NWK_ENABLE_KEY_SWITCH */
+/* #define NWK_SECURITY_REJECT_UNKNOWN_PEERS */
+/* #define NWK_ENABLE_TX_POWER_CONTROL */
+/* #define NWK_ENABLE_ROUTE_REPAIR */
+/* #define SYS_ENABLE_TICKLESS_TIMER */
 
 #ifndef SYS_SECURITY_MODE
 #define SYS_SECURITY_MODE 1
 #endif
 
+/* Software block cipher used by SYS_SECURITY_MODE 1 */
+#define SYS_SECURITY_CIPHER_AES  0
+#define SYS_SECURITY_CIPHER_XTEA 1
+
+#ifndef SYS_SECURITY_CIPHER
+#define SYS_SECURITY_CIPHER SYS_SECURITY_CIPHER_AES
+#endif
+
+#ifndef SYS_TASK_BUDGET
+#define SYS_TASK_BUDGET 4 /* rounds per SYS_TaskHandler() call */
+#endif
+
+/* Retries done by the transceiver in TX_ARET mode before PHY_DataConf() */
+#ifndef PHY_MAX_FRAME_RETRIES
+#define PHY_MAX_FRAME_RETRIES 3 /* retransmissions without an ack */
+#endif
+
+#ifndef PHY_MAX_CSMA_RETRIES
+#define PHY_MAX_CSMA_RETRIES 4 /* backoffs on a busy channel, 7 disables CSMA */
+#endif
+
 /*- Sanity checks ----------------------------------------------------------*/
+#if NWK_ROUTE_TABLE_SIZE > 255
+#error NWK_ROUTE_TABLE_SIZE must not be larger than 255
+#endif
+
+#if NWK_ROUTE_HASH_BITS < 1 || NWK_ROUTE_HASH_BITS > 8
+#error NWK_ROUTE_HASH_BITS must be between 1 and 8
+#endif
+
+#if NWK_DUPLICATE_REJECTION_TABLE_SIZE > 255
+#error NWK_DUPLICATE_REJECTION_TABLE_SIZE must not be larger than 255
+#endif
+
+#if NWK_DUPLICATE_REJECTION_HASH_BITS < 1 || \
+    NWK_DUPLICATE_REJECTION_HASH_BITS > 8
+#error NWK_DUPLICATE_REJECTION_HASH_BITS must be between 1 and 8
+#endif
+
+#if NWK_ACK_WAIT_TIME > 30000
+#error NWK_ACK_WAIT_TIME must not be larger than 30000 ms
+#endif
+
+#if NWK_DATA_REQ_PASS_LIMIT < 1 || NWK_DATA_REQ_PASS_LIMIT > 255
+#error NWK_DATA_REQ_PASS_LIMIT must be between 1 and 255
+#endif
+
+#if NWK_SECURITY_MIC_SIZE != 4 && NWK_SECURITY_MIC_SIZE != 8 && \
+    NWK_SECURITY_MIC_SIZE != 16
+#error NWK_SECURITY_MIC_SIZE must be 4, 8 or 16
+#endif
+
+#if NWK_SECURITY_PASS_LIMIT < 1 || NWK_SECURITY_PASS_LIMIT > 255
+#error NWK_SECURITY_PASS_LIMIT must be between 1 and 255
+#endif
+
+#if NWK_SECURITY_REPLAY_TABLE_SIZE < 1 || \
+    NWK_SECURITY_REPLAY_TABLE_SIZE > 255
+#error NWK_SECURITY_REPLAY_TABLE_SIZE must be between 1 and 255
+#endif
+
+#if NWK_SECURITY_REPLAY_HASH_BITS < 1 || NWK_SECURITY_REPLAY_HASH_BITS > 8
+#error NWK_SECURITY_REPLAY_HASH_BITS must be between 1 and 8
+#endif
+
+#if NWK_SECURITY_KEYS_AMOUNT < 1 || NWK_SECURITY_KEYS_AMOUNT > 255
+#error NWK_SECURITY_KEYS_AMOUNT must be between 1 and 255
+#endif
+
+#if defined(NWK_ENABLE_KEY_SWITCH) && !defined(NWK_ENABLE_SECURITY)
+#error NWK_ENABLE_KEY_SWITCH requires NWK_ENABLE_SECURITY
+#endif
+
+#if NWK_KEY_SWITCH_MAX_GRACE_TIME < NWK_KEY_SWITCH_GRACE_TIME
+#error NWK_KEY_SWITCH_MAX_GRACE_TIME must be at least NWK_KEY_SWITCH_GRACE_TIME
+#endif
+
+#if defined(NWK_ENABLE_KEY_SWITCH) && NWK_SECURITY_KEYS_AMOUNT < 2
+#error NWK_ENABLE_KEY_SWITCH requires NWK_SECURITY_KEYS_AMOUNT of at least 2
+#endif
+
+#if SYS_SECURITY_CIPHER != SYS_SECURITY_CIPHER_AES && \
+    SYS_SECURITY_CIPHER != SYS_SECURITY_CIPHER_XTEA
+#error SYS_SECURITY_CIPHER must be SYS_SECURITY_CIPHER_AES or _XTEA
+#endif
+
+#if SYS_TASK_BUDGET < 1 || SYS_TASK_BUDGET > 255
+#error SYS_TASK_BUDGET must be between 1 and 255
+#endif
+
+#if PHY_MAX_FRAME_RETRIES > 15
+#error PHY_MAX_FRAME_RETRIES must not be larger than 15
+#endif
+
+#if PHY_MAX_CSMA_RETRIES > 5 && PHY_MAX_CSMA_RETRIES != 7
+#error PHY_MAX_CSMA_RETRIES must not be larger than 5, except 7
+#endif
 
 #ifdef __cplusplus
 }
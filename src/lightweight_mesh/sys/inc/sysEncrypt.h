@@ -56,8 +56,7 @@ extern "C" {
  */
 
 /*- Prototypes -------------------------------------------------------------*/
-void SYS_EncryptReq(uint32_t* text, uint32_t* key);
-void SYS_EncryptConf(void);
+void SYS_EncryptBlocks(uint8_t* text, uint8_t blocks, uint8_t* key);
 
 #ifdef __cplusplus
 }
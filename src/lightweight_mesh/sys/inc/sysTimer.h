@@ -55,8 +55,9 @@ extern "C" {
  * @{
  */
 
-#define SYS_TIMER_INTERVAL 10ul /* ms */
-#define MS                 1000
+#define SYS_TIMER_INTERVAL  10ul /* ms */
+#define SYS_TIMER_MAX_DELAY 65ul /* ms */
+#define MS                  1000
 
 /*- Types ------------------------------------------------------------------*/
 typedef enum SYS_TimerMode_t {
@@ -80,6 +81,8 @@ void SYS_TimerInit(void);
 void SYS_TimerStart(SYS_Timer_t* timer);
 void SYS_TimerStop(SYS_Timer_t* timer);
 bool SYS_TimerStarted(SYS_Timer_t* timer);
+uint32_t SYS_TimerTime(void);
+bool SYS_TimerPending(void);
 void SYS_TimerTaskHandler(void);
 void SYS_HwExpiry_Cb(void);
 
@@ -63,9 +63,28 @@ void SYS_Init(void) {
 }
 
 /*************************************************************************/ /**
-                                                                             *****************************************************************************/
-void SYS_TaskHandler(void) {
-    PHY_TaskHandler();
-    NWK_TaskHandler();
-    SYS_TimerTaskHandler();
+ *  @brief Checks whether any of the task handlers have work to do
+ *****************************************************************************/
+bool SYS_TaskPending(void) {
+    return PHY_TaskPending() || NWK_TaskPending() || SYS_TimerPending();
+}
+
+/*************************************************************************/ /**
+ *  @brief Runs the PHY, NWK and timer task handlers until there is no more
+ *  work pending, but at most SYS_TASK_BUDGET rounds, so that the application
+ *  still gets to run during bursts.
+ *  @return true if there still is work pending
+ *****************************************************************************/
+bool SYS_TaskHandler(void) {
+    for (uint8_t budget = SYS_TASK_BUDGET; budget > 0; budget--) {
+        PHY_TaskHandler();
+        NWK_TaskHandler();
+        SYS_TimerTaskHandler();
+
+        if (!SYS_TaskPending()) {
+            return false;
+        }
+    }
+
+    return true;
 }
@@ -39,56 +39,260 @@
  */
 
 /*- Includes ---------------------------------------------------------------*/
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include "sysEncrypt.h"
 #include "sysConfig.h"
 #include "phy.h"
 
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#endif
+
 #ifdef NWK_ENABLE_SECURITY
 
+/*- Definitions ------------------------------------------------------------*/
+#define SYS_ENCRYPT_KEY_SIZE   16
+#define SYS_ENCRYPT_BLOCK_SIZE 16
+#define AES_ROUNDS             10
+#define XTEA_CYCLES            32
+
+#if defined(__AVR__)
+#define SBOX(i)                pgm_read_byte(&sysEncryptSbox[i])
+#else
+#define PROGMEM
+#define SBOX(i)                sysEncryptSbox[i]
+#endif
+
+/*- Variables --------------------------------------------------------------*/
+#if SYS_SECURITY_MODE == 1
+static uint8_t sysEncryptKey[SYS_ENCRYPT_KEY_SIZE];
+static bool sysEncryptKeyValid = false;
+
+#if SYS_SECURITY_CIPHER == SYS_SECURITY_CIPHER_AES
+static uint8_t sysEncryptRoundKeys[(AES_ROUNDS + 1) * SYS_ENCRYPT_BLOCK_SIZE];
+
+static const uint8_t sysEncryptSbox[256] PROGMEM = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+#elif SYS_SECURITY_CIPHER == SYS_SECURITY_CIPHER_XTEA
+static uint32_t sysEncryptRoundKeys[XTEA_CYCLES * 2];
+#endif
+#endif
+
 /*- Implementations --------------------------------------------------------*/
 
 #if SYS_SECURITY_MODE == 1
 
+#if SYS_SECURITY_CIPHER == SYS_SECURITY_CIPHER_AES
+
 /*************************************************************************//**
+*  @brief Multiplies @a x by 2 in GF(2^8) without branching on the data
 *****************************************************************************/
-static void xtea(uint32_t text[2], uint32_t const key[4])
+static inline uint8_t sysEncryptXtime(uint8_t x)
 {
-	uint32_t t0 = text[0];
-	uint32_t t1 = text[1];
+	return (uint8_t)((x << 1) ^ (0x1b & -(x >> 7)));
+}
+
+/*************************************************************************//**
+*  @brief Expands @a key into the AES-128 round keys
+*****************************************************************************/
+static void sysEncryptExpandKey(uint8_t *key)
+{
+	uint8_t *rk = sysEncryptRoundKeys;
+	uint8_t rcon = 0x01;
+	uint8_t t0, t1, t2, t3, t;
+
+	memcpy(rk, key, SYS_ENCRYPT_KEY_SIZE);
+
+	for (uint8_t i = SYS_ENCRYPT_KEY_SIZE; i < sizeof(sysEncryptRoundKeys);
+			i += 4) {
+		t0 = rk[i - 4];
+		t1 = rk[i - 3];
+		t2 = rk[i - 2];
+		t3 = rk[i - 1];
+
+		if (0 == (i % SYS_ENCRYPT_KEY_SIZE)) {
+			t = t0;
+			t0 = SBOX(t1) ^ rcon;
+			t1 = SBOX(t2);
+			t2 = SBOX(t3);
+			t3 = SBOX(t);
+			rcon = sysEncryptXtime(rcon);
+		}
+
+		rk[i + 0] = rk[i - 16] ^ t0;
+		rk[i + 1] = rk[i - 15] ^ t1;
+		rk[i + 2] = rk[i - 14] ^ t2;
+		rk[i + 3] = rk[i - 13] ^ t3;
+	}
+}
+
+/*************************************************************************//**
+*  @brief Encrypts one block @a s in place with the cached round keys. The
+*  S-box stays in flash and the rest is computed byte by byte, so no large
+*  tables are needed.
+*****************************************************************************/
+static void sysEncryptBlock(uint8_t *s)
+{
+	const uint8_t *rk = sysEncryptRoundKeys;
+	uint8_t a0, a1, a2, a3, all, t;
+
+	for (uint8_t i = 0; i < SYS_ENCRYPT_BLOCK_SIZE; i++) {
+		s[i] ^= rk[i];
+	}
+
+	for (uint8_t round = 1; round <= AES_ROUNDS; round++) {
+		rk += SYS_ENCRYPT_BLOCK_SIZE;
+
+		for (uint8_t i = 0; i < SYS_ENCRYPT_BLOCK_SIZE; i++) {
+			s[i] = SBOX(s[i]);
+		}
+
+		/* ShiftRows, the state is stored column by column */
+		t = s[1]; s[1] = s[5]; s[5] = s[9]; s[9] = s[13]; s[13] = t;
+		t = s[2]; s[2] = s[10]; s[10] = t;
+		t = s[6]; s[6] = s[14]; s[14] = t;
+		t = s[15]; s[15] = s[11]; s[11] = s[7]; s[7] = s[3]; s[3] = t;
+
+		for (uint8_t c = 0; c < SYS_ENCRYPT_BLOCK_SIZE; c += 4) {
+			a0 = s[c + 0];
+			a1 = s[c + 1];
+			a2 = s[c + 2];
+			a3 = s[c + 3];
+
+			if (round < AES_ROUNDS) {
+				all = a0 ^ a1 ^ a2 ^ a3;
+				a0 ^= all ^ sysEncryptXtime(s[c + 0] ^ s[c + 1]);
+				a1 ^= all ^ sysEncryptXtime(s[c + 1] ^ s[c + 2]);
+				a2 ^= all ^ sysEncryptXtime(s[c + 2] ^ s[c + 3]);
+				a3 ^= all ^ sysEncryptXtime(s[c + 3] ^ s[c + 0]);
+			}
+
+			s[c + 0] = a0 ^ rk[c + 0];
+			s[c + 1] = a1 ^ rk[c + 1];
+			s[c + 2] = a2 ^ rk[c + 2];
+			s[c + 3] = a3 ^ rk[c + 3];
+		}
+	}
+}
+
+#elif SYS_SECURITY_CIPHER == SYS_SECURITY_CIPHER_XTEA
+
+/*************************************************************************//**
+*  @brief Precomputes the XTEA subkeys of @a key, folding the round sums
+*  into them
+*****************************************************************************/
+static void sysEncryptExpandKey(uint8_t *key)
+{
+	uint32_t k[4];
 	uint32_t sum = 0;
 	uint32_t delta = 0x9e3779b9;
 
-	for (uint8_t i = 0; i < 32; i++) {
-		t0 += (((t1 << 4) ^ (t1 >> 5)) + t1) ^ (sum + key[sum & 3]);
+	memcpy(k, key, sizeof(k));
+
+	for (uint8_t i = 0; i < XTEA_CYCLES * 2; i += 2) {
+		sysEncryptRoundKeys[i] = sum + k[sum & 3];
 		sum += delta;
-		t1
-			+= (((t0 <<
-				4) ^
-				(t0 >> 5)) + t0) ^ (sum + key[(sum >> 11) & 3]);
+		sysEncryptRoundKeys[i + 1] = sum + k[(sum >> 11) & 3];
+	}
+}
+
+/*************************************************************************//**
+*  @brief Runs XTEA over the 64 bit @a text, two cycles per iteration
+*****************************************************************************/
+static void xtea(uint32_t text[2])
+{
+	const uint32_t *rk = sysEncryptRoundKeys;
+	uint32_t t0 = text[0];
+	uint32_t t1 = text[1];
+
+	for (uint8_t i = 0; i < XTEA_CYCLES / 2; i++, rk += 4) {
+		t0 += (((t1 << 4) ^ (t1 >> 5)) + t1) ^ rk[0];
+		t1 += (((t0 << 4) ^ (t0 >> 5)) + t0) ^ rk[1];
+		t0 += (((t1 << 4) ^ (t1 >> 5)) + t1) ^ rk[2];
+		t1 += (((t0 << 4) ^ (t0 >> 5)) + t0) ^ rk[3];
 	}
 	text[0] = t0;
 	text[1] = t1;
 }
 
+/*************************************************************************//**
+*  @brief Encrypts one 128 bit block @a s in place by chaining two XTEA
+*  blocks
+*****************************************************************************/
+static void sysEncryptBlock(uint8_t *s)
+{
+	uint32_t t[4];
+
+	memcpy(t, s, sizeof(t));
+	xtea(&t[0]);
+	t[2] ^= t[0];
+	t[3] ^= t[1];
+	xtea(&t[2]);
+	memcpy(s, t, sizeof(t));
+}
+
+#endif
+
 #endif
 
 /*************************************************************************//**
+*  @brief Encrypts @a blocks independent 16 byte blocks of @a text in place
+*  with @a key. The blocks are streamed through the radio's AES engine in
+*  mode 0. In mode 1 they are encrypted in software with the cipher selected
+*  by SYS_SECURITY_CIPHER, and the expanded key is kept until @a key changes.
 *****************************************************************************/
-void SYS_EncryptReq(uint32_t *text, uint32_t *key)
+void SYS_EncryptBlocks(uint8_t *text, uint8_t blocks, uint8_t *key)
 {
 #if SYS_SECURITY_MODE == 0
-	PHY_EncryptReq((uint8_t *)text, (uint8_t *)key);
+	PHY_EncryptBlocksReq(text, blocks, key);
 
 #elif SYS_SECURITY_MODE == 1
-	xtea(&text[0], key);
-	text[2] ^= text[0];
-	text[3] ^= text[1];
-	xtea(&text[2], key);
-#endif
+	if (!sysEncryptKeyValid ||
+			0 != memcmp(sysEncryptKey, key, SYS_ENCRYPT_KEY_SIZE)) {
+		memcpy(sysEncryptKey, key, SYS_ENCRYPT_KEY_SIZE);
+		sysEncryptExpandKey(key);
+		sysEncryptKeyValid = true;
+	}
 
-	SYS_EncryptConf();
+	for (; blocks > 0; blocks--, text += SYS_ENCRYPT_BLOCK_SIZE) {
+		sysEncryptBlock(text);
+	}
+#endif
 }
 
 #endif /* NWK_ENABLE_SECURITY */
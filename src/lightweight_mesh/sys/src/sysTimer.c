@@ -42,25 +42,135 @@
 #include "sysTimer.h"
 #include "common_hw_timer.h"
 #include "compiler.h"
+#include "sysConfig.h"
 #include <stdlib.h>
 
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+#include "sleep_mgr.h"
+#endif
+
 volatile uint8_t SysTimerIrqCount;
 
 static void placeTimer(SYS_Timer_t* timer);
 
 static SYS_Timer_t* timers;
 
+/* Milliseconds since SYS_TimerInit(), advanced by SYS_TimerTaskHandler() */
+static uint32_t sysTimerTime;
+
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+
+/* Timestamp of the sleep manager at the last time the timers were advanced */
+static uint32_t sysTimerStamp;
+
+/* Timestamp ticks which have not made up a whole millisecond yet, multiplied
+ * by 1000 */
+static uint32_t sysTimerFraction;
+
+/**
+ * Returns the milliseconds passed since the last call, measured with the free
+ * running timestamp of the sleep manager.
+ */
+static uint32_t elapsedTime(void) {
+    const uint32_t frequency = sm_timestamp_frequency();
+    const uint32_t stamp     = sm_timestamp();
+    const uint32_t ticks     = stamp - sysTimerStamp;
+    uint32_t elapsed         = ticks / frequency * 1000;
+
+    sysTimerStamp = stamp;
+    sysTimerFraction += ticks % frequency * 1000;
+    elapsed += sysTimerFraction / frequency;
+    sysTimerFraction %= frequency;
+
+    return elapsed;
+}
+
+/**
+ * Brings the timers up to date with the time which has passed without running
+ * the handlers. Timers which have expired are left with a zero timeout and are
+ * handled by the next call to SYS_TimerTaskHandler().
+ */
+static void advanceTimers(void) {
+    uint32_t elapsed = elapsedTime();
+
+    sysTimerTime += elapsed;
+
+    for (SYS_Timer_t* t = timers; t && elapsed; t = t->next) {
+        if (t->timeout > elapsed) {
+            t->timeout -= elapsed;
+            break;
+        }
+
+        elapsed -= t->timeout;
+        t->timeout = 0;
+    }
+
+    if (timers && 0 == timers->timeout) {
+        irqflags_t flags = cpu_irq_save();
+        SysTimerIrqCount++;
+        cpu_irq_restore(flags);
+    }
+}
+
+/**
+ * Programs the hardware timer to expire at the first deadline, or stops it if
+ * there are no timers. The compare is limited to SYS_TIMER_MAX_DELAY, so
+ * deadlines further away are reached in several steps.
+ */
+static void programTimer(void) {
+    uint32_t delay;
+
+    if (NULL == timers) {
+        common_tc_compare_stop();
+        return;
+    }
+
+    delay = timers->timeout;
+
+    if (0 == delay) {
+        irqflags_t flags = cpu_irq_save();
+        SysTimerIrqCount++;
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    if (delay > SYS_TIMER_MAX_DELAY) {
+        delay = SYS_TIMER_MAX_DELAY;
+    }
+
+    common_tc_delay(delay * MS);
+}
+
+#endif /* SYS_ENABLE_TICKLESS_TIMER */
+
 void SYS_TimerInit(void) {
     SysTimerIrqCount = 0;
+    sysTimerTime     = 0;
     set_common_tc_expiry_callback(SYS_HwExpiry_Cb);
     common_tc_init();
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+    sm_init();
+    sysTimerStamp    = sm_timestamp();
+    sysTimerFraction = 0;
+    common_tc_compare_stop();
+#else
     common_tc_delay(SYS_TIMER_INTERVAL * MS);
+#endif
     timers = NULL;
 }
 
 void SYS_TimerStart(SYS_Timer_t* timer) {
     if (!SYS_TimerStarted(timer)) {
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+        advanceTimers();
+        placeTimer(timer);
+
+        if (timers == timer) {
+            programTimer();
+        }
+#else
         placeTimer(timer);
+#endif
     }
 }
 
@@ -79,6 +189,14 @@ void SYS_TimerStop(SYS_Timer_t* timer) {
                 t->next->timeout += timer->timeout;
             }
 
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+            /* The compare is still armed for the deadline of the stopped
+             * timer */
+            if (NULL == prev) {
+                advanceTimers();
+                programTimer();
+            }
+#endif
             break;
         }
 
@@ -95,9 +213,20 @@ bool SYS_TimerStarted(SYS_Timer_t* timer) {
     return false;
 }
 
+bool SYS_TimerPending(void) { return SysTimerIrqCount > 0; }
+
+uint32_t SYS_TimerTime(void) {
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+    advanceTimers();
+#endif
+    return sysTimerTime;
+}
+
 void SYS_TimerTaskHandler(void) {
     uint32_t elapsed;
+#ifndef SYS_ENABLE_TICKLESS_TIMER
     uint8_t cnt;
+#endif
     irqflags_t flags;
 
     if (0 == SysTimerIrqCount) {
@@ -106,12 +235,21 @@ void SYS_TimerTaskHandler(void) {
 
     /* Enter a critical section */
     flags            = cpu_irq_save();
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+    SysTimerIrqCount = 0;
+#else
     cnt              = SysTimerIrqCount;
     SysTimerIrqCount = 0;
+#endif
     /* Leave the critical section */
     cpu_irq_restore(flags);
 
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+    elapsed = elapsedTime();
+#else
     elapsed = cnt * SYS_TIMER_INTERVAL;
+#endif
+    sysTimerTime += elapsed;
 
     while (timers && (timers->timeout <= elapsed)) {
         SYS_Timer_t* timer = timers;
@@ -130,6 +268,10 @@ void SYS_TimerTaskHandler(void) {
     if (timers) {
         timers->timeout -= elapsed;
     }
+
+#ifdef SYS_ENABLE_TICKLESS_TIMER
+    programTimer();
+#endif
 }
 
 static void placeTimer(SYS_Timer_t* timer) {
@@ -166,5 +308,7 @@ static void placeTimer(SYS_Timer_t* timer) {
 
 void SYS_HwExpiry_Cb(void) {
     SysTimerIrqCount++;
+#ifndef SYS_ENABLE_TICKLESS_TIMER
     common_tc_delay(SYS_TIMER_INTERVAL * MS);
+#endif
 }
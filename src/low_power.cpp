@@ -1,8 +1,12 @@
 #include "low_power.hpp"
 
+#include "energy.hpp"
 #include "mesh.hpp"
 #include "sleep_mgr.h"
 
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
 namespace low_power {
 
     void initialize() { sm_init(); }
@@ -10,8 +14,40 @@ namespace low_power {
     void sleep(const uint32_t interval) {
 
         mesh::sleep();
+
+        energy::set_mcu_state(energy::McuState::Sleeping);
         sm_sleep(interval);
+        energy::set_mcu_state(energy::McuState::Active);
+
         mesh::wakeup();
     }
 
+    void idle() {
+#if defined(PHY_AT86RF231)
+        // The radio does not raise an interrupt on frame events, so the MCU
+        // would sleep through received frames until the next system tick
+        return;
+#endif
+
+        cli();
+
+        // The check is done with interrupts disabled, so that work added by
+        // an interrupt after the check will wake us up. The instruction after
+        // sei is always executed before any pending interrupt
+        if (mesh::pending()) {
+            sei();
+            return;
+        }
+
+        energy::set_mcu_state(energy::McuState::Idle);
+
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        energy::set_mcu_state(energy::McuState::Active);
+    }
+
 } // namespace low_power
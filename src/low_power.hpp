@@ -12,6 +12,16 @@ namespace low_power {
      * seconds.
      */
     void sleep(uint32_t interval);
+
+    /**
+     * @brief Halts the MCU in idle mode until the next interrupt, unless the
+     * mesh has work pending. The peripherals and the radio keep running.
+     * Meant to be registered with mesh::set_idle_hook. The AT86RF233 and
+     * the ATmega256RFR2 radios wake the MCU when a frame is received or
+     * sent. The AT86RF231 is polled and does not, so there the MCU is never
+     * halted.
+     */
+    void idle();
 } // namespace low_power
 
 #endif
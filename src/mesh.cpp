@@ -3,9 +3,13 @@
 #include <etl/circular_buffer.h>
 
 #include "board.h"
+#include "nwkRoute.h"
+#include "nwkTx.h"
 #include "phy.h"
 #include "sys.h"
+#include "sysTimer.h"
 
+#include <avr/eeprom.h>
 #include <progmem.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +18,48 @@ namespace mesh {
 
     static char device_name[DEVICE_NAME_LENGTH];
 
+    /**
+     * @brief Bits of the control field in the network layer acknowledgement.
+     * When a channel switch is pending, the new channel is piggybacked on every
+     * acknowledgement so that sleeping devices learn about it. Otherwise the
+     * low bits can carry the transmit slot of the device. The downlink bit
+     * tells the device that a message for it follows the acknowledgement.
+     */
+    constexpr uint8_t ACK_CONTROL_CHANNEL_SWITCH = 1 << 7;
+    constexpr uint8_t ACK_CONTROL_DOWNLINK       = 1 << 6;
+    constexpr uint8_t ACK_CONTROL_SLOT           = 1 << 5;
+    constexpr uint8_t ACK_CONTROL_CHANNEL_MASK   = 0x1F;
+    constexpr uint8_t ACK_CONTROL_SLOT_MASK      = 0x1F;
+
+    /**
+     * @brief The channel the device is currently operating on.
+     */
+    static uint8_t current_channel;
+
+    /**
+     * @brief Channel announced in an acknowledgement, which we move to if
+     * transmissions start to fail. Zero if no channel has been announced.
+     */
+    static uint8_t announced_channel;
+
+    static void channel_switch_handler(uint8_t channel);
+
+    static auto slot_of(uint16_t address) -> uint8_t;
+
+    static void restore_frame_counter();
+
+    static void restore_security_key();
+
+    static void key_switch_handler(uint8_t key_identifier);
+
+    static void reserve_frame_counters();
+
+    static auto send_downlink(uint16_t address) -> bool;
+
+    static void confirm_downlink(uint16_t address,
+                                 uint16_t message_identifier,
+                                 bool delivered);
+
     Address::Address(const uint16_t address_parameter,
                      const Endpoint endpoint_parameter)
         : address(address_parameter), endpoint(endpoint_parameter) {}
@@ -57,6 +103,9 @@ namespace mesh {
         PHY_SetChannel(configuration.channel);
         PHY_SetRxState(true);
 
+        current_channel = configuration.channel;
+        NWK_SetChannelSwitchHandler(channel_switch_handler);
+
         char security_key[sizeof(configuration.security_key)];
         memcpy(security_key,
                configuration.security_key,
@@ -75,9 +124,38 @@ namespace mesh {
         }
 
         NWK_SetSecurityKey((uint8_t*)security_key);
+
+        restore_security_key();
+        NWK_SetKeySwitchHandler(key_switch_handler);
+
+        // Before the first secured frame, so that no counter is used twice
+        restore_frame_counter();
     }
 
-    void update() { SYS_TaskHandler(); }
+    /**
+     * @brief Called by #update when there is no work left, nullptr if none.
+     */
+    static IdleHook idle_hook = nullptr;
+
+    auto update() -> bool {
+        const bool work_left = SYS_TaskHandler();
+
+        reserve_frame_counters();
+
+        if (work_left) {
+            return true;
+        }
+
+        if (idle_hook != nullptr) {
+            idle_hook();
+        }
+
+        return false;
+    }
+
+    void set_idle_hook(IdleHook hook) { idle_hook = hook; }
+
+    auto pending() -> bool { return SYS_TaskPending(); }
 
     // ------------------------------------------------------------------------
     //                                 Listener
@@ -92,6 +170,26 @@ namespace mesh {
         char source_device_name[DEVICE_NAME_LENGTH];
         memcpy(source_device_name, indication->data, DEVICE_NAME_LENGTH);
 
+        if (indication->options & NWK_IND_OPT_ACK_REQUESTED) {
+
+            uint8_t control = 0;
+            uint8_t pending_channel;
+            uint8_t slot;
+
+            if (NWK_ChannelSwitchPending(&pending_channel)) {
+                control = ACK_CONTROL_CHANNEL_SWITCH |
+                          (pending_channel & ACK_CONTROL_CHANNEL_MASK);
+            } else if ((slot = slot_of(indication->srcAddr)) != NO_SLOT) {
+                control = ACK_CONTROL_SLOT | (slot & ACK_CONTROL_SLOT_MASK);
+            }
+
+            if (send_downlink(indication->srcAddr)) {
+                control |= ACK_CONTROL_DOWNLINK;
+            }
+
+            NWK_SetAckControl(control);
+        }
+
         if (receive_callbacks[indication->dstEndpoint - 1] != nullptr) {
             receive_callbacks[indication->dstEndpoint - 1](
                 indication->srcAddr,
@@ -123,22 +221,77 @@ namespace mesh {
         uint8_t data[MAX_TRANSMISSION_PACKET_SIZE + DEVICE_NAME_LENGTH];
 
         NWK_DataReq_t request;
+
+        /**
+         * @brief Whether this is a message from the pending downlinks.
+         */
+        bool downlink;
     };
 
     static etl::circular_buffer<TransmissionPacket, 4> transmission_packets;
 
     static TransmissionCallback transmission_callback;
 
+    /**
+     * @brief Our transmit slot as assigned in the last acknowledgement which
+     * carried one.
+     */
+    static uint8_t slot = NO_SLOT;
+
+    /**
+     * @brief Whether the acknowledgement of our last transmission announced a
+     * downlink message.
+     */
+    static bool downlink_announced = false;
+
     static void internal_transmission_callback(struct NWK_DataReq_t* request) {
 
         if (transmission_packets.empty()) {
             return;
         }
 
-        if (transmission_callback != nullptr) {
+        downlink_announced = false;
+
+        // The control field is only valid if we got an acknowledgement
+        switch (static_cast<TransmissionStatus>(request->status)) {
+        case TransmissionStatus::Success:
+            downlink_announced = (request->control & ACK_CONTROL_DOWNLINK) !=
+                                 0;
+
+            if (request->control & ACK_CONTROL_CHANNEL_SWITCH) {
+                announced_channel = request->control &
+                                    ACK_CONTROL_CHANNEL_MASK;
+            } else if (request->control & ACK_CONTROL_SLOT) {
+                slot = request->control & ACK_CONTROL_SLOT_MASK;
+            }
+            break;
+
+        case TransmissionStatus::NoAck:
+        case TransmissionStatus::ChannelAccessFailure:
+        case TransmissionStatus::PhyNoAck:
+            // The network might have moved to the channel announced earlier,
+            // so we follow it before the failure is reported
+            if (announced_channel != 0 &&
+                announced_channel != current_channel) {
+                set_channel(announced_channel);
+            }
+
+            announced_channel = 0;
+            break;
+
+        default:
+            break;
+        }
 
-            const TransmissionPacket& packet = transmission_packets.front();
+        const TransmissionPacket& packet = transmission_packets.front();
 
+        if (packet.downlink) {
+            confirm_downlink(packet.request.dstAddr,
+                             packet.message_identifier,
+                             request->status == NWK_SUCCESS_STATUS);
+        }
+
+        if (transmission_callback != nullptr) {
             transmission_callback(TransmissionResult{
                 packet.message_identifier,
                 static_cast<TransmissionStatus>(request->status)});
@@ -207,6 +360,543 @@ namespace mesh {
                        data);
     }
 
+    auto pin_route(const uint16_t address) -> bool {
+
+#ifdef NWK_ENABLE_ROUTING
+        NWK_RouteTableEntry_t* entry = NWK_RouteFindEntry(address, 0);
+
+        if (entry == nullptr) {
+            return false;
+        }
+
+        entry->fixed = 1;
+
+        return true;
+#else
+        (void)address;
+        return false;
+#endif
+    }
+
+    // ------------------------------------------------------------------------
+    //                                 Downlink
+    // ------------------------------------------------------------------------
+
+    struct Downlink {
+        uint16_t message_identifier;
+        uint16_t address;
+        Endpoint endpoint;
+        Payload data;
+
+        /**
+         * @brief Whether the message has been sent and waits for its confirm.
+         */
+        bool in_flight;
+    };
+
+    /**
+     * @brief Downlink messages waiting for their recipient to transmit to us.
+     */
+    static etl::vector<Downlink, MAX_PENDING_DOWNLINKS> pending_downlinks;
+
+    auto enqueue_downlink(const uint16_t message_identifier,
+                          const Address& destination_address,
+                          const Payload& data) -> EnqueumentStatus {
+
+        if (pending_downlinks.full()) {
+            return EnqueumentStatus::TransmissionBufferFull;
+        }
+
+        pending_downlinks.push_back(Downlink{message_identifier,
+                                            destination_address.address,
+                                            destination_address.endpoint,
+                                            data,
+                                            false});
+
+        return EnqueumentStatus::Ok;
+    }
+
+    /**
+     * @brief Sends the oldest downlink message pending for @p address, if any.
+     * Called when the device has just transmitted to us and is listening.
+     * The message is kept until it has been delivered.
+     *
+     * @return true if a message was sent.
+     */
+    static auto send_downlink(const uint16_t address) -> bool {
+
+        for (Downlink& downlink : pending_downlinks) {
+
+            if (downlink.address != address) {
+                continue;
+            }
+
+            // Only one message at a time, the next one is sent after the
+            // next transmission of the device
+            if (downlink.in_flight) {
+                return false;
+            }
+
+            // If the transmission buffer is full, the message is kept until
+            // the device transmits to us the next time
+            if (enqueue_direct_transmission(
+                    downlink.message_identifier,
+                    Address(downlink.address, downlink.endpoint),
+                    downlink.data) != EnqueumentStatus::Ok) {
+                return false;
+            }
+
+            transmission_packets.back().downlink = true;
+            downlink.in_flight                   = true;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Removes the downlink message in flight to @p address once it has
+     * been @p delivered. Otherwise it is announced again after the next
+     * transmission of the device.
+     */
+    static void confirm_downlink(const uint16_t address,
+                                 const uint16_t message_identifier,
+                                 const bool delivered) {
+
+        for (Downlink* downlink = pending_downlinks.begin();
+             downlink != pending_downlinks.end();
+             downlink++) {
+
+            if (!downlink->in_flight || downlink->address != address ||
+                downlink->message_identifier != message_identifier) {
+                continue;
+            }
+
+            if (delivered) {
+                pending_downlinks.erase(downlink);
+            } else {
+                downlink->in_flight = false;
+            }
+
+            return;
+        }
+    }
+
+    auto downlink_pending() -> bool { return downlink_announced; }
+
+    // ------------------------------------------------------------------------
+    //                                 Channel
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Periodic timer for evaluating the transmission statistics.
+     */
+    static SYS_Timer_t channel_migration_timer;
+
+    static ChannelMigrationConfiguration channel_migration_configuration;
+
+    /**
+     * @brief Time between the energy measurements of a channel scan (in
+     * milliseconds). One channel is measured per tick, so the receiver only
+     * leaves the current channel for a single measurement at a time.
+     */
+    constexpr uint32_t CHANNEL_SCAN_INTERVAL = 50;
+
+    static SYS_Timer_t channel_scan_timer;
+
+    /**
+     * @brief The next channel to measure, zero if no scan is running.
+     */
+    static uint8_t scan_channel = 0;
+
+    static uint8_t quietest_channel;
+    static int8_t lowest_energy;
+
+    static void channel_switch_handler(const uint8_t channel) {
+
+#ifdef MESH_ENABLE_LOGGING
+        printf_P(PSTR("Switched to channel %d\r\n"), channel);
+#endif
+
+        current_channel   = channel;
+        announced_channel = 0;
+    }
+
+    void set_channel(const uint8_t channel) {
+        PHY_SetChannel(channel);
+        channel_switch_handler(channel);
+    }
+
+    auto channel() -> uint8_t { return current_channel; }
+
+    auto switch_channel(const uint8_t channel, const uint16_t delay) -> bool {
+        return NWK_ChannelSwitchReq(channel, delay);
+    }
+
+    /**
+     * @brief Measures the energy on one channel per tick and moves the
+     * network to the quietest channel when every channel has been measured.
+     * The receiver is back on the current channel between the ticks, frames
+     * sent to us during a measurement are lost.
+     */
+    static void channel_scan_timer_handler(SYS_Timer_t*) {
+
+        if (NWK_ChannelSwitchPending(nullptr)) {
+            SYS_TimerStop(&channel_scan_timer);
+            scan_channel = 0;
+            return;
+        }
+
+        // A measurement would delay the frame being transmitted, so the
+        // channel is measured at the next tick instead
+        if (NWK_Busy()) {
+            return;
+        }
+
+        if (scan_channel != current_channel) {
+            PHY_SetChannel(scan_channel);
+            const int8_t energy = PHY_EdReq();
+            PHY_SetChannel(current_channel);
+
+            if (energy < lowest_energy) {
+                lowest_energy    = energy;
+                quietest_channel = scan_channel;
+            }
+        }
+
+        if (scan_channel++ < LAST_CHANNEL) {
+            return;
+        }
+
+        SYS_TimerStop(&channel_scan_timer);
+        scan_channel = 0;
+
+        if (quietest_channel == current_channel) {
+            return;
+        }
+
+#ifdef MESH_ENABLE_LOGGING
+        printf_P(PSTR("Moving to channel %d\r\n"), quietest_channel);
+#endif
+
+        // If we're out of frame buffers, we'll try again at the next
+        // evaluation
+        (void)switch_channel(quietest_channel,
+                             channel_migration_configuration.switch_delay);
+    }
+
+    static void channel_migration_timer_handler(SYS_Timer_t*) {
+
+        if (scan_channel != 0 || NWK_ChannelSwitchPending(nullptr)) {
+            return;
+        }
+
+        const NWK_TxStatistics_t statistics = *NWK_TxStatistics();
+        NWK_ResetTxStatistics();
+
+        if (statistics.frames <
+            channel_migration_configuration.minimum_transmissions) {
+            return;
+        }
+
+        const uint32_t failures = static_cast<uint32_t>(
+                                      statistics.channelAccessFailures) +
+                                  statistics.noAcks;
+
+        if (failures * 100 <
+            static_cast<uint32_t>(
+                channel_migration_configuration.failure_threshold) *
+                statistics.frames) {
+            return;
+        }
+
+#ifdef MESH_ENABLE_LOGGING
+        printf_P(PSTR("Interference detected (%lu of %u transmissions "
+                      "failed), scanning channels\r\n"),
+                 failures,
+                 statistics.frames);
+#endif
+
+        scan_channel     = FIRST_CHANNEL;
+        quietest_channel = current_channel;
+        lowest_energy    = INT8_MAX;
+
+        channel_scan_timer.interval = CHANNEL_SCAN_INTERVAL;
+        channel_scan_timer.mode     = SYS_TIMER_PERIODIC_MODE;
+        channel_scan_timer.handler  = channel_scan_timer_handler;
+        SYS_TimerStart(&channel_scan_timer);
+    }
+
+    void enable_channel_migration(
+        const ChannelMigrationConfiguration& configuration) {
+
+        channel_migration_configuration = configuration;
+
+        NWK_ResetTxStatistics();
+
+        SYS_TimerStop(&channel_scan_timer);
+        scan_channel = 0;
+
+        SYS_TimerStop(&channel_migration_timer);
+        channel_migration_timer.interval =
+            static_cast<uint32_t>(configuration.evaluation_interval) * 1000;
+        channel_migration_timer.mode    = SYS_TIMER_PERIODIC_MODE;
+        channel_migration_timer.handler = channel_migration_timer_handler;
+        SYS_TimerStart(&channel_migration_timer);
+    }
+
+    // ------------------------------------------------------------------------
+    //                                Security
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Security frame counters reserved at a time. The EEPROM holds the
+     * end of the block in use, so it is written once per block, and after a
+     * reset the rest of the block is skipped rather than a counter used twice,
+     * which would lock us out of the replay protection of the receivers.
+     */
+    constexpr uint32_t FRAME_COUNTER_BLOCK = 256;
+
+    /**
+     * @brief First security frame counter which is not reserved yet.
+     */
+    static uint32_t EEMEM frame_counter_limit_eeprom;
+
+    static uint32_t frame_counter_limit;
+
+    /**
+     * @brief Continues with the first counter after the block reserved before
+     * the reset.
+     */
+    static void restore_frame_counter() {
+        uint32_t frame_counter = eeprom_read_dword(&frame_counter_limit_eeprom);
+
+        // Erased EEPROM reads as all ones
+        if (frame_counter == UINT32_MAX) {
+            frame_counter = 0;
+        }
+
+        NWK_SetSecurityFrameCounter(frame_counter);
+
+        frame_counter_limit = frame_counter;
+        reserve_frame_counters();
+    }
+
+    /**
+     * @brief Reserves the next block of security frame counters in the EEPROM
+     * once half of the current block is used. Half a block is more than
+     * SYS_TASK_BUDGET rounds of #update send, so the counter never passes the
+     * limit between two calls.
+     */
+    static void reserve_frame_counters() {
+
+        if (NWK_SecurityFrameCounter() + FRAME_COUNTER_BLOCK / 2 <
+            frame_counter_limit) {
+            return;
+        }
+
+        frame_counter_limit = NWK_SecurityFrameCounter() + FRAME_COUNTER_BLOCK;
+        eeprom_update_dword(&frame_counter_limit_eeprom, frame_counter_limit);
+    }
+
+    /**
+     * @brief Identifier of the network key in use, #NO_STORED_KEY if the
+     * network has not switched keys since the device was programmed.
+     */
+    static uint8_t EEMEM security_key_identifier_eeprom;
+
+    static uint8_t EEMEM security_key_eeprom[NWK_SECURITY_KEY_SIZE];
+
+    /**
+     * @brief Erased EEPROM reads as all ones.
+     */
+    constexpr uint8_t NO_STORED_KEY = 0xFF;
+
+    /**
+     * @brief Continues with the network key the network switched to before
+     * the reset, instead of the key of the configuration, which the other
+     * devices drop once the grace time of the switch is over.
+     */
+    static void restore_security_key() {
+        const uint8_t key_identifier = eeprom_read_byte(
+            &security_key_identifier_eeprom);
+
+        if (key_identifier == NO_STORED_KEY) {
+            return;
+        }
+
+        uint8_t key[NWK_SECURITY_KEY_SIZE];
+        eeprom_read_block(key, security_key_eeprom, sizeof(key));
+
+        if (!NWK_AddSecurityKey(key_identifier,
+                                NWK_SECURITY_KEY_NETWORK,
+                                0,
+                                key) ||
+            !NWK_SetActiveSecurityKey(key_identifier)) {
+            return;
+        }
+
+        if (key_identifier != 0) {
+            (void)NWK_RemoveSecurityKey(0);
+        }
+    }
+
+    /**
+     * @brief Stores the key the network has switched to. The identifier is
+     * cleared while the key is written, so that a reset in between falls back
+     * to the key of the configuration rather than a mismatched pair.
+     */
+    static void key_switch_handler(const uint8_t key_identifier) {
+        uint8_t key[NWK_SECURITY_KEY_SIZE];
+
+        if (!NWK_SecurityKey(key_identifier, key)) {
+            return;
+        }
+
+        eeprom_update_byte(&security_key_identifier_eeprom, NO_STORED_KEY);
+        eeprom_update_block(key, security_key_eeprom, sizeof(key));
+        eeprom_update_byte(&security_key_identifier_eeprom, key_identifier);
+    }
+
+    auto rotate_security_key(const uint8_t key_identifier,
+                             const uint8_t key[NWK_SECURITY_KEY_SIZE],
+                             const uint16_t delay) -> bool {
+
+        if (key_identifier == NO_STORED_KEY) {
+            return false;
+        }
+
+        return NWK_KeySwitchReq(key_identifier,
+                                const_cast<uint8_t*>(key),
+                                delay);
+    }
+
+    auto add_security_key(const uint8_t key_identifier,
+                          const NWK_SecurityKeyType_t type,
+                          const uint16_t address,
+                          const uint8_t key[NWK_SECURITY_KEY_SIZE]) -> bool {
+        return NWK_AddSecurityKey(key_identifier,
+                                  type,
+                                  address,
+                                  const_cast<uint8_t*>(key));
+    }
+
+    // ------------------------------------------------------------------------
+    //                             Slot Assignment
+    // ------------------------------------------------------------------------
+
+    struct SlotAssignment {
+        uint16_t address;
+        uint8_t slot;
+    };
+
+    /**
+     * @brief Devices which have been assigned a slot. Devices beyond this
+     * amount are not assigned a slot and fall back to their default slot.
+     */
+    static etl::vector<SlotAssignment, 64> slot_assignments;
+
+    /**
+     * @brief Number of devices assigned to each slot.
+     */
+    static uint8_t slot_occupancy[MAX_SLOTS];
+
+    /**
+     * @brief Number of slots to assign, zero if slot assignment is disabled.
+     */
+    static uint8_t slots = 0;
+
+    void enable_slot_assignment(const uint8_t slots_parameter) {
+        slots = slots_parameter > MAX_SLOTS ? MAX_SLOTS : slots_parameter;
+
+        slot_assignments.clear();
+        memset(slot_occupancy, 0, sizeof(slot_occupancy));
+    }
+
+    /**
+     * @return The slot assigned to @p address, assigning the least occupied
+     * slot if the device has not been seen before.
+     */
+    static auto slot_of(const uint16_t address) -> uint8_t {
+
+        if (slots == 0) {
+            return NO_SLOT;
+        }
+
+        for (const SlotAssignment& assignment : slot_assignments) {
+            if (assignment.address == address) {
+                return assignment.slot;
+            }
+        }
+
+        if (slot_assignments.full()) {
+            return NO_SLOT;
+        }
+
+        uint8_t least_occupied_slot = 0;
+
+        for (uint8_t i = 1; i < slots; i++) {
+            if (slot_occupancy[i] < slot_occupancy[least_occupied_slot]) {
+                least_occupied_slot = i;
+            }
+        }
+
+        slot_occupancy[least_occupied_slot]++;
+        slot_assignments.push_back(
+            SlotAssignment{address, least_occupied_slot});
+
+        return least_occupied_slot;
+    }
+
+    auto assigned_slot() -> uint8_t { return slot; }
+
+    // ------------------------------------------------------------------------
+    //                            Energy Reporting
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Periodic timer for sending the energy reports.
+     */
+    static SYS_Timer_t energy_report_timer;
+
+    static Address energy_report_address(0, Endpoint::Endpoint1);
+
+    static void energy_report_timer_handler(SYS_Timer_t*) {
+
+        energy::start_cycle();
+
+        // If the buffer is full, the next report catches up
+        (void)enqueue_energy_report(energy_report_address);
+    }
+
+    void enable_energy_reporting(const energy::CurrentTable& current_table,
+                                 const Address& destination_address,
+                                 const uint16_t interval) {
+
+        energy::initialise(current_table);
+
+        energy_report_address = destination_address;
+
+        SYS_TimerStop(&energy_report_timer);
+        energy_report_timer.interval = static_cast<uint32_t>(interval) * 1000;
+        energy_report_timer.mode     = SYS_TIMER_PERIODIC_MODE;
+        energy_report_timer.handler  = energy_report_timer_handler;
+        SYS_TimerStart(&energy_report_timer);
+    }
+
+    auto enqueue_energy_report(const Address& destination_address)
+        -> EnqueumentStatus {
+
+        Payload report;
+        report.resize(energy::REPORT_SIZE);
+        energy::pack_report(report.data());
+
+        return enqueue_direct_transmission(ENERGY_REPORT_MESSAGE_IDENTIFIER,
+                                           destination_address,
+                                           report);
+    }
+
     // ------------------------------------------------------------------------
     //                              Low Power
     // ------------------------------------------------------------------------
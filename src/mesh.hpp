@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "energy.hpp"
 #include "nwk.h"
 
 #include <etl/vector.h>
@@ -77,7 +78,10 @@ namespace mesh {
         uint8_t channel;
 
         /**
-         * @brief The key the messages will be encrypted with.
+         * @brief The key the messages will be encrypted with. Installed as
+         * network key 0, see #rotate_security_key for how to replace it.
+         * Once the network has switched keys, the key in use is restored
+         * from the EEPROM instead, until the EEPROM is erased.
          */
         char security_key[NWK_SECURITY_KEY_SIZE];
 
@@ -90,15 +94,39 @@ namespace mesh {
 
     /**
      * @brief Initializes a device for the mesh network with the given @p
-     * configuration.
+     * configuration. The security frame counter continues after the last one
+     * reserved in the EEPROM, so that the receivers do not drop our frames as
+     * replays after a reset.
      */
     void initialise(const Configuration& configuration);
 
     /**
      * @brief Updates the network and physical layer, should be called regularly
-     * in the main loop of the applicaiton.
+     * in the main loop of the applicaiton. Pending work is handled for at most
+     * SYS_TASK_BUDGET rounds, so that the application still runs during
+     * bursts of traffic.
+     *
+     * @return true if there is work left, in which case #update should be
+     * called again soon. Otherwise the idle hook is called before returning.
      */
-    void update();
+    auto update() -> bool;
+
+    using IdleHook = void (*)();
+
+    /**
+     * @brief Registers @p hook to be called from #update when neither the
+     * radio, the network layer nor the timers have work pending, e.g.
+     * low_power::idle to halt the MCU until the next interrupt. Pass nullptr
+     * to remove the hook.
+     */
+    void set_idle_hook(IdleHook hook);
+
+    /**
+     * @return true if the radio, the network layer or the timers have work
+     * pending. Has to be checked with interrupts disabled right before
+     * halting the MCU, as the timer interrupt may add work.
+     */
+    [[nodiscard]] auto pending() -> bool;
 
     // ------------------------------------------------------------------------
     //                                 Listener
@@ -189,6 +217,217 @@ namespace mesh {
                                          const Payload& data)
         -> EnqueumentStatus;
 
+    /**
+     * @brief Pins the current route to @p address, so that it is neither
+     * evicted nor discovered again while the device sleeps. A pinned route is
+     * only revalidated when a transmission over it fails.
+     *
+     * @return false if there is no route to @p address.
+     */
+    [[nodiscard]] auto pin_route(uint16_t address) -> bool;
+
+    // ------------------------------------------------------------------------
+    //                                 Downlink
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief How many downlink messages can wait for their recipients.
+     */
+    constexpr uint8_t MAX_PENDING_DOWNLINKS = 4;
+
+    /**
+     * @brief Queues a message for a device which only listens right after its
+     * own transmissions, such as a publisher. The message is held back until
+     * the device transmits to us. Its acknowledgement then tells it to keep
+     * the radio on, and the message is sent. The result of every attempt is
+     * reported to the transmission callback as for
+     * #enqueue_direct_transmission. A message which is not delivered is kept
+     * and announced again after the next transmission of the device.
+     */
+    [[nodiscard]] auto enqueue_downlink(uint16_t message_identifier,
+                                        const Address& destination_address,
+                                        const Payload& data)
+        -> EnqueumentStatus;
+
+    /**
+     * @return true if the acknowledgement of our last transmission announced
+     * that a downlink message is on its way.
+     */
+    [[nodiscard]] auto downlink_pending() -> bool;
+
+    // ------------------------------------------------------------------------
+    //                                 Channel
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief The channel range of the 2.4 GHz band.
+     */
+    constexpr uint8_t FIRST_CHANNEL = 11;
+    constexpr uint8_t LAST_CHANNEL  = 26;
+
+    /**
+     * @brief Changes the channel of this device only.
+     */
+    void set_channel(uint8_t channel);
+
+    /**
+     * @return The channel the device is currently operating on.
+     */
+    [[nodiscard]] auto channel() -> uint8_t;
+
+    /**
+     * @brief Moves the whole network to @p channel. A switch command is
+     * broadcasted and every router changes channel after @p delay seconds,
+     * including this device. Sleeping devices are told about the new channel
+     * in the acknowledgement of their next transmission.
+     *
+     * @return true if the switch command could be queued.
+     */
+    [[nodiscard]] auto switch_channel(uint8_t channel, uint16_t delay) -> bool;
+
+    /**
+     * @brief Thresholds for when the network should be moved away from a
+     * channel with interference.
+     */
+    struct ChannelMigrationConfiguration {
+        /**
+         * @brief How often the transmission statistics are evaluated (in
+         * seconds).
+         */
+        uint16_t evaluation_interval;
+
+        /**
+         * @brief The least amount of transmissions within an evaluation
+         * interval for the statistics to be considered.
+         */
+        uint16_t minimum_transmissions;
+
+        /**
+         * @brief Percentage of transmissions failing with channel access
+         * failure or no acknowledgement before the channel is changed.
+         */
+        uint8_t failure_threshold;
+
+        /**
+         * @brief Time between the switch command and the actual switch (in
+         * seconds). Gives the command time to propagate through the network.
+         */
+        uint16_t switch_delay;
+    };
+
+    /**
+     * @brief Makes this device (normally the base station) monitor the
+     * transmission statistics of the network layer and move the network to the
+     * quietest channel when the failure rate crosses the thresholds in @p
+     * configuration.
+     */
+    void enable_channel_migration(
+        const ChannelMigrationConfiguration& configuration);
+
+    // ------------------------------------------------------------------------
+    //                                Security
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Moves the whole network to a new network key. The key is
+     * broadcasted encrypted with the current key, and every router starts
+     * using it after @p delay seconds, including this device. Frames secured
+     * with the previous key are accepted for NWK_KEY_SWITCH_GRACE_TIME after
+     * the switch, and for as long as a known device still uses it up to
+     * NWK_KEY_SWITCH_MAX_GRACE_TIME, so the network keeps running while the
+     * devices switch. A device which slept through the broadcast is sent the
+     * key on its next uplink, secured with the previous key. Every device
+     * stores the new key in the EEPROM when it switches, so that it keeps
+     * using it after a reset.
+     *
+     * @param key_identifier [in] Identifier of the new key, which has to
+     * differ from the current one and must not belong to a group or link
+     * key. 0xFF is reserved.
+     *
+     * @return true if the switch command could be queued.
+     */
+    [[nodiscard]] auto
+    rotate_security_key(uint8_t key_identifier,
+                        const uint8_t key[NWK_SECURITY_KEY_SIZE],
+                        uint16_t delay) -> bool;
+
+    /**
+     * @brief Adds a key to the key table. Frames secured with a key carry its
+     * identifier, so both ends have to add the key with the same identifier.
+     *
+     * @param type [in] NWK_SECURITY_KEY_LINK for a key securing the unicast
+     * frames to and from @p address, NWK_SECURITY_KEY_GROUP for a key securing
+     * the multicast frames to the group @p address, or
+     * NWK_SECURITY_KEY_NETWORK for a network key, for which @p address is
+     * ignored.
+     *
+     * @return false if the key table is full.
+     */
+    [[nodiscard]] auto
+    add_security_key(uint8_t key_identifier,
+                     NWK_SecurityKeyType_t type,
+                     uint16_t address,
+                     const uint8_t key[NWK_SECURITY_KEY_SIZE]) -> bool;
+
+    // ------------------------------------------------------------------------
+    //                             Slot Assignment
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Maximum number of transmit slots which can be assigned.
+     */
+    constexpr uint8_t MAX_SLOTS = 32;
+
+    /**
+     * @brief Returned by #assigned_slot when no slot has been assigned.
+     */
+    constexpr uint8_t NO_SLOT = 0xFF;
+
+    /**
+     * @brief Makes this device (normally the base station) assign each device
+     * transmitting to it one of @p slots transmit slots, spreading the devices
+     * evenly over the slots. The assignment is piggybacked on the
+     * acknowledgements.
+     */
+    void enable_slot_assignment(uint8_t slots);
+
+    /**
+     * @return The transmit slot assigned to this device by the recipient of its
+     * transmissions, or #NO_SLOT if none has been assigned.
+     */
+    [[nodiscard]] auto assigned_slot() -> uint8_t;
+
+    // ------------------------------------------------------------------------
+    //                            Energy Reporting
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Message identifier of the energy reports in the transmission
+     * callback, which the application should not use for its own messages.
+     */
+    constexpr uint16_t ENERGY_REPORT_MESSAGE_IDENTIFIER = 0xFFFF;
+
+    /**
+     * @brief Starts the energy accounting with the currents of the board in
+     * @p current_table, and sends an energy report (see energy::Report) to @p
+     * destination_address every @p interval seconds. Meant for devices which
+     * stay awake, such as routers, where a cycle spans one interval. A report
+     * which is lost is not sent again, the next one carries the total charge.
+     * Publishers report per publish cycle instead, see
+     * publisher::enable_energy_reporting.
+     */
+    void enable_energy_reporting(const energy::CurrentTable& current_table,
+                                 const Address& destination_address,
+                                 uint16_t interval);
+
+    /**
+     * @brief Queues an energy report with the current estimates for @p
+     * destination_address, sent with #ENERGY_REPORT_MESSAGE_IDENTIFIER.
+     * Requires the energy accounting to have been started.
+     */
+    [[nodiscard]] auto enqueue_energy_report(const Address& destination_address)
+        -> EnqueumentStatus;
+
     // ------------------------------------------------------------------------
     //                              Low Power
     // ------------------------------------------------------------------------
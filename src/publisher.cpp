@@ -7,6 +7,7 @@
 #include <util/delay.h>
 
 #include "low_power.hpp"
+#include "sysTimer.h"
 
 namespace mesh::publisher {
 
@@ -17,6 +18,7 @@ namespace mesh::publisher {
         UpdatingPayload = 0,
         Transmitting,
         WaitingForTransmitAcknowledgement,
+        ReceivingDownlink,
         Sleeping
     };
 
@@ -40,17 +42,137 @@ namespace mesh::publisher {
      */
     static mesh::Address recipient_address(0, Endpoint::Endpoint1);
 
+    /**
+     * @brief Whether the sleep interval is adapted, see
+     * #enable_adaptive_interval.
+     */
+    static bool adaptive_interval = false;
+
+    static AdaptiveIntervalConfiguration adaptive_interval_configuration;
+
+    static BatteryVoltageCallback battery_voltage_callback;
+
+    /**
+     * @brief How many times the sleep interval is currently doubled due to
+     * failed transmissions.
+     */
+    static uint8_t backoff = 0;
+
     /**
      * @brief Called so that the user of the device module can update the
      * payload of the message being transmitted.
      */
     static PayloadUpdateCallback payload_update_callback;
 
+    /**
+     * @brief Used instead of #payload_update_callback in event-driven mode.
+     */
+    static SignificantPayloadUpdateCallback significant_payload_update_callback;
+
+    /**
+     * @brief Maximum number of sleep intervals without a transmission in
+     * event-driven mode.
+     */
+    static uint16_t heartbeat_interval;
+
+    /**
+     * @brief Number of sleep intervals since the last transmission.
+     */
+    static uint16_t intervals_since_transmission = 0;
+
+    /**
+     * @brief The payload of the current sample.
+     */
+    static Payload data;
+
+    /**
+     * @brief Samples waiting to be transmitted when batching is enabled. See
+     * #enable_batching for the format.
+     */
+    static Payload batch;
+
+    /**
+     * @brief How many samples to collect before transmitting, batching is
+     * disabled if this is 1 or less.
+     */
+    static uint8_t samples_per_transmission = 0;
+
+    /**
+     * @brief Seconds slept since the last sample was added to the batch.
+     */
+    static uint32_t seconds_since_last_sample = 0;
+
     /**
      * @brief How long to sleep for (in seconds).
      */
     static uint32_t sleep_interval;
 
+    /**
+     * @brief Our own address, used to derive the default transmit slot.
+     */
+    static uint16_t address;
+
+    /**
+     * @brief Number of transmit slots in the sleep interval, slotted mode is
+     * disabled if this is zero.
+     */
+    static uint8_t slots = 0;
+
+    /**
+     * @brief Length of a transmit slot (in seconds).
+     */
+    static uint16_t slot_length;
+
+    /**
+     * @brief The slot the publish cycles are currently aligned to. All devices
+     * start out in slot 0.
+     */
+    static uint8_t current_slot = 0;
+
+    /**
+     * @brief Called with the downlink messages, downlink is disabled if this
+     * is nullptr.
+     */
+    static ReceiveCallback downlink_callback;
+
+    /**
+     * @brief Limits how long the radio is kept on waiting for a downlink
+     * message.
+     */
+    static SYS_Timer_t downlink_window_timer;
+
+    /**
+     * @brief Whether a downlink message was received since the last
+     * transmission.
+     */
+    static bool got_downlink = false;
+
+    /**
+     * @brief Whether the acknowledgement of the data announced a downlink
+     * message. Taken from the data confirm only, as the energy report is
+     * confirmed later and its acknowledgement does not announce the message
+     * again.
+     */
+    static bool downlink_announced = false;
+
+    /**
+     * @brief Where to send the energy reports.
+     */
+    static Endpoint energy_report_endpoint;
+
+    /**
+     * @brief Publish cycles between the energy reports, reporting is disabled
+     * if this is zero.
+     */
+    static uint16_t energy_report_interval = 0;
+
+    static uint16_t cycles_since_energy_report = 0;
+
+    /**
+     * @brief Whether an energy report is waiting for its acknowledgement.
+     */
+    static bool energy_report_in_flight = false;
+
     /**
      * @brief Called before and after sleep (if registered).
      */
@@ -62,13 +184,79 @@ namespace mesh::publisher {
      */
     static ResetCallback reset_callback;
 
+    /**
+     * @brief After this many publish cycles in a row without an
+     * acknowledgement we assume that the network has moved to another channel
+     * while we were asleep and scan for it.
+     */
+    constexpr uint8_t CHANNEL_SCAN_FAILURE_THRESHOLD = 3;
+
+    /**
+     * @brief Number of publish cycles in a row which failed.
+     */
+    static uint8_t consecutive_failures = 0;
+
+    /**
+     * @brief The channel the current transmission was enqueued on.
+     */
+    static uint8_t transmission_channel;
+
+    /**
+     * @brief Whether we are currently scanning for the network.
+     */
+    static bool scanning = false;
+
+    /**
+     * @brief The channel we were on before the scan started, restored if the
+     * network is not found.
+     */
+    static uint8_t scan_origin_channel;
+
+    /**
+     * @brief The channel currently being tried in the scan.
+     */
+    static uint8_t scan_channel;
+
+    /**
+     * @brief Moves to the next channel of the scan.
+     *
+     * @return false if every channel has been tried.
+     */
+    static auto scan_next_channel() -> bool {
+
+        do { scan_channel++; } while (scan_channel == scan_origin_channel);
+
+        if (scan_channel > mesh::LAST_CHANNEL) {
+            return false;
+        }
+
+        mesh::set_channel(scan_channel);
+
+        return true;
+    }
+
     /**
      * @brief Called when a transmission has completed with or without an error.
      */
     static void transmission_callback(
         const mesh::TransmissionResult transmission_result_parameter) {
+
+        if (transmission_result_parameter.message_identifier ==
+            mesh::ENERGY_REPORT_MESSAGE_IDENTIFIER) {
+
+            // A failed report is sent again in the next cycle
+            if (transmission_result_parameter.status ==
+                mesh::TransmissionStatus::Success) {
+                cycles_since_energy_report = 0;
+            }
+
+            energy_report_in_flight = false;
+            return;
+        }
+
         transmission_result     = transmission_result_parameter;
         got_transmission_result = true;
+        downlink_announced      = mesh::downlink_pending();
     }
 
     void initialise(const mesh::Configuration& configuration,
@@ -84,6 +272,7 @@ namespace mesh::publisher {
         payload_update_callback = payload_update_callback_parameter;
         reset_callback          = reset_callback_parameter;
         sleep_interval          = sleep_interval_parameter;
+        address                 = configuration.address;
 
 #ifndef MESH_ENABLE_LOGGING
         low_power::initialize();
@@ -94,15 +283,396 @@ namespace mesh::publisher {
         sleep_callback = sleep_callback_parameter;
     }
 
-    void update() {
+    void enable_event_driven_mode(
+        SignificantPayloadUpdateCallback
+            significant_payload_update_callback_parameter,
+        const uint16_t heartbeat_interval_parameter) {
+        significant_payload_update_callback =
+            significant_payload_update_callback_parameter;
+        heartbeat_interval = heartbeat_interval_parameter;
+    }
+
+    void enable_adaptive_interval(
+        const AdaptiveIntervalConfiguration& configuration,
+        BatteryVoltageCallback battery_voltage_callback_parameter) {
+        adaptive_interval_configuration = configuration;
+        battery_voltage_callback        = battery_voltage_callback_parameter;
+        adaptive_interval               = true;
+    }
+
+    /**
+     * @brief Updates the backoff after a publish cycle.
+     */
+    static void update_backoff(const bool success) {
+
+        if (success) {
+            if (backoff > 0) {
+                backoff--;
+            }
+        } else if (backoff < adaptive_interval_configuration.maximum_backoff &&
+                   backoff < 32) {
+            backoff++;
+        }
+    }
+
+    /**
+     * @return How long to sleep for (in seconds) until the next publish cycle.
+     */
+    static auto next_sleep_interval() -> uint32_t {
+
+        if (!adaptive_interval) {
+            return sleep_interval;
+        }
+
+        const AdaptiveIntervalConfiguration& configuration =
+            adaptive_interval_configuration;
+
+        // Use 64 bits to not overflow with long intervals and many doublings
+        uint64_t interval = static_cast<uint64_t>(sleep_interval) << backoff;
+
+        if (battery_voltage_callback != nullptr &&
+            configuration.full_battery_voltage >
+                configuration.low_battery_voltage &&
+            configuration.low_battery_factor > 1) {
+
+            const uint16_t voltage = battery_voltage_callback();
+
+            // The factor is interpolated in 1/16 steps between 1 at full
+            // battery and the low battery factor
+            uint32_t factor = 16;
+
+            if (voltage <= configuration.low_battery_voltage) {
+                factor = configuration.low_battery_factor * 16;
+            } else if (voltage < configuration.full_battery_voltage) {
+                factor += static_cast<uint32_t>(
+                              configuration.low_battery_factor - 1) *
+                          16 * (configuration.full_battery_voltage - voltage) /
+                          (configuration.full_battery_voltage -
+                           configuration.low_battery_voltage);
+            }
+
+            interval = interval * factor / 16;
+        }
+
+        if (interval > configuration.maximum_sleep_interval) {
+            interval = configuration.maximum_sleep_interval;
+        }
+
+        return static_cast<uint32_t>(interval);
+    }
+
+    static void internal_downlink_callback(
+        const uint16_t source_address,
+        const char source_device_name[DEVICE_NAME_LENGTH],
+        uint8_t* data,
+        uint8_t size) {
+
+        got_downlink = true;
+
+        downlink_callback(source_address, source_device_name, data, size);
+    }
+
+    static void downlink_window_timer_handler(SYS_Timer_t*) {
+        // The state machine sees that the timer is no longer running
+    }
+
+    void enable_downlink(const Endpoint endpoint,
+                         ReceiveCallback downlink_callback_parameter,
+                         const uint16_t window) {
+
+        downlink_callback = downlink_callback_parameter;
+        mesh::register_listener(endpoint, internal_downlink_callback);
+
+        downlink_window_timer.interval = window;
+        downlink_window_timer.mode     = SYS_TIMER_INTERVAL_MODE;
+        downlink_window_timer.handler  = downlink_window_timer_handler;
+    }
+
+    void enable_energy_reporting(const energy::CurrentTable& current_table,
+                                 const Endpoint endpoint,
+                                 const uint16_t interval) {
+
+        energy::initialise(current_table);
+
+        energy_report_endpoint     = endpoint;
+        energy_report_interval     = interval;
+        cycles_since_energy_report = 0;
+    }
+
+    /**
+     * @brief Enqueues an energy report if one is due.
+     */
+    static void enqueue_energy_report() {
+
+        if (energy_report_interval == 0 || energy_report_in_flight ||
+            cycles_since_energy_report < energy_report_interval) {
+            return;
+        }
+
+        // If the buffer is full, the report is sent in the next cycle
+        energy_report_in_flight =
+            mesh::enqueue_energy_report(
+                mesh::Address(recipient_address.address,
+                              energy_report_endpoint)) ==
+            mesh::EnqueumentStatus::Ok;
+    }
+
+    void enable_slotted_mode(const uint8_t slots_parameter,
+                             const uint16_t slot_length_parameter) {
+        slots        = slots_parameter;
+        slot_length  = slot_length_parameter;
+        current_slot = 0;
+    }
 
-        static Payload data;
+    /**
+     * @return How much longer to sleep (in seconds) to move the next publish
+     * cycle into our slot.
+     */
+    static auto slot_offset() -> uint32_t {
+
+        if (slots == 0) {
+            return 0;
+        }
+
+        uint8_t slot = mesh::assigned_slot();
+
+        if (slot >= slots) {
+            // Multiplicative hashing, so that consecutive addresses end up in
+            // different slots
+            slot = static_cast<uint8_t>(
+                (static_cast<uint16_t>(address * 40503U) >> 8) % slots);
+        }
+
+        const uint8_t slots_ahead = (slot + slots - current_slot) % slots;
+        current_slot              = slot;
+
+        return static_cast<uint32_t>(slots_ahead) * slot_length;
+    }
+
+    void enable_batching(const uint8_t samples_per_transmission_parameter) {
+        samples_per_transmission = samples_per_transmission_parameter;
+        batch.clear();
+    }
+
+    /**
+     * @return Number of bytes needed to encode @p delta in a batch.
+     */
+    static auto delta_size(uint32_t delta) -> uint8_t {
+
+        uint8_t size = 1;
+
+        while (delta >= 0x80) {
+            delta >>= 7;
+            size++;
+        }
+
+        return size;
+    }
+
+    /**
+     * @brief Decodes a delta at @p offset in @p batch_data.
+     *
+     * @return Number of bytes the delta occupied, zero if it is malformed.
+     */
+    static auto decode_delta(const uint8_t* batch_data,
+                             const uint8_t size,
+                             uint16_t offset,
+                             uint32_t& delta) -> uint8_t {
+
+        const uint16_t start = offset;
+        uint8_t shift       = 0;
+
+        delta = 0;
+
+        while (offset < size && shift < 32) {
+
+            const uint8_t byte = batch_data[offset++];
+            delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return offset - start;
+            }
+
+            shift += 7;
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Removes the oldest sample from the batch.
+     */
+    static void drop_oldest_sample() {
+
+        uint32_t delta;
+        const uint8_t offset = 1 + decode_delta(
+                                       batch.data(), batch.size(), 1, delta);
+        const uint8_t end = offset + 1 + batch[offset];
+
+        batch.erase(batch.begin() + 1, batch.begin() + end);
+        batch[0]--;
+    }
+
+    /**
+     * @brief Adds the current sample to the batch.
+     *
+     * @return true if the batch should be transmitted now.
+     */
+    static auto add_to_batch() -> bool {
+
+        const uint8_t overhead = delta_size(seconds_since_last_sample) + 1;
+
+        if (batch.empty()) {
+            batch.push_back(0);
+        }
+
+        if (data.size() > static_cast<size_t>(MAX_BATCH_SIZE - 1 - overhead)) {
+#ifdef MESH_ENABLE_LOGGING
+            printf("Sample too large for batch, truncating\r\n");
+#endif
+            data.resize(MAX_BATCH_SIZE - 1 - overhead);
+        }
+
+        const uint8_t record_size = overhead + data.size();
+
+        while (batch.size() + record_size > MAX_BATCH_SIZE) {
+#ifdef MESH_ENABLE_LOGGING
+            printf("Batch full, dropping oldest sample\r\n");
+#endif
+            drop_oldest_sample();
+        }
+
+        uint32_t delta = seconds_since_last_sample;
+
+        do {
+            batch.push_back((delta & 0x7F) | (delta >= 0x80 ? 0x80 : 0));
+            delta >>= 7;
+        } while (delta != 0);
+
+        batch.push_back(data.size());
+        batch.insert(batch.end(), data.begin(), data.end());
+        batch[0]++;
+
+        seconds_since_last_sample = 0;
+
+        // Transmit if we have enough samples or if the next sample of the same
+        // size would not fit
+        return batch[0] >= samples_per_transmission ||
+               batch.size() + record_size > MAX_BATCH_SIZE;
+    }
+
+    auto unpack_batch(const uint8_t* batch_data,
+                      const uint8_t size,
+                      BatchSampleCallback batch_sample_callback) -> bool {
+
+        if (size == 0) {
+            return false;
+        }
+
+        // The deltas are relative to the previous sample, so we sum them up
+        // first in order to report the age relative to the last sample
+        uint32_t total = 0;
+        uint16_t offset = 1;
+
+        for (uint8_t i = 0; i < batch_data[0]; i++) {
+
+            uint32_t delta;
+            const uint8_t length = decode_delta(batch_data,
+                                                size,
+                                                offset,
+                                                delta);
+
+            if (length == 0 || offset + length >= size) {
+                return false;
+            }
+
+            // The delta of the first sample is relative to a sample which is
+            // not part of this batch
+            if (i != 0) {
+                total += delta;
+            }
+
+            offset += length;
+            offset += 1 + batch_data[offset];
+
+            if (offset > size) {
+                return false;
+            }
+        }
+
+        offset = 1;
+
+        for (uint8_t i = 0; i < batch_data[0]; i++) {
+
+            uint32_t delta;
+            offset += decode_delta(batch_data, size, offset, delta);
+
+            if (i != 0) {
+                total -= delta;
+            }
+
+            const uint8_t sample_size = batch_data[offset++];
+            batch_sample_callback(total, batch_data + offset, sample_size);
+            offset += sample_size;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Updates the payload of the current sample.
+     *
+     * @return false if the sample should be skipped.
+     */
+    static auto update_payload() -> bool {
+
+        data.clear();
+
+        if (significant_payload_update_callback == nullptr) {
+            payload_update_callback(data);
+            return true;
+        }
+
+        const bool significant = significant_payload_update_callback(data);
+
+        intervals_since_transmission++;
+
+        if (!significant && intervals_since_transmission < heartbeat_interval) {
+            return false;
+        }
+
+        intervals_since_transmission = 0;
+
+        return true;
+    }
+
+    void update() {
 
         switch (state) {
 
         case State::UpdatingPayload:
-            data.clear();
-            payload_update_callback(data);
+
+            energy::start_cycle();
+
+            if (cycles_since_energy_report < UINT16_MAX) {
+                cycles_since_energy_report++;
+            }
+
+            if (!update_payload()) {
+#ifdef MESH_ENABLE_LOGGING
+                printf("No significant change, skipping transmission\r\n");
+#endif
+                state = State::Sleeping;
+                break;
+            }
+
+            if (samples_per_transmission > 1 && !add_to_batch()) {
+#ifdef MESH_ENABLE_LOGGING
+                printf("Added sample %d to batch\r\n", batch[0]);
+#endif
+                state = State::Sleeping;
+                break;
+            }
 
             state = State::Transmitting;
 
@@ -110,8 +680,14 @@ namespace mesh::publisher {
 
         case State::Transmitting: {
 
+            transmission_channel = mesh::channel();
+            got_downlink         = false;
+
             const mesh::EnqueumentStatus status =
-                mesh::enqueue_direct_transmission(0, recipient_address, data);
+                mesh::enqueue_direct_transmission(
+                    0,
+                    recipient_address,
+                    samples_per_transmission > 1 ? batch : data);
 
             switch (status) {
 
@@ -134,6 +710,8 @@ namespace mesh::publisher {
 #ifdef MESH_ENABLE_LOGGING
                 printf("Enqueued message\r\n");
 #endif
+                enqueue_energy_report();
+
                 state = State::WaitingForTransmitAcknowledgement;
                 break;
             }
@@ -149,7 +727,9 @@ namespace mesh::publisher {
             // layer timeout timer here as it will be driven by the network
             // layer.
 
-            if (!got_transmission_result) {
+            // The energy report has to be done as well before we can go to
+            // sleep
+            if (!got_transmission_result || energy_report_in_flight) {
                 break;
             }
 
@@ -160,6 +740,15 @@ namespace mesh::publisher {
                 printf("Got ACK on message \r\n");
 #endif
 
+                consecutive_failures = 0;
+                scanning             = false;
+
+                batch.clear();
+
+                // Keep the route over the sleep, so that we don't have to
+                // flood the network with a route discovery when we wake up
+                (void)mesh::pin_route(recipient_address.address);
+
                 break;
 
             default:
@@ -171,18 +760,91 @@ namespace mesh::publisher {
                        static_cast<uint8_t>(transmission_result.status));
 #endif
 
+                got_transmission_result = false;
+
+                // The network layer followed a channel switch announced by
+                // the base station, so we retry on the new channel right away
+                if (mesh::channel() != transmission_channel && !scanning) {
+                    state = State::Transmitting;
+                    break;
+                }
+
+                if (scanning) {
+                    if (scan_next_channel()) {
+                        state = State::Transmitting;
+                        break;
+                    }
+
+                    // The network was not found on any channel, so it might
+                    // be down for the moment
+                    scanning = false;
+                    mesh::set_channel(scan_origin_channel);
+                } else if (++consecutive_failures >=
+                           CHANNEL_SCAN_FAILURE_THRESHOLD) {
+
+                    // We might have slept through a channel switch. Transmit
+                    // on every channel until we get an acknowledgement
+                    consecutive_failures = 0;
+                    scanning             = true;
+                    scan_origin_channel  = mesh::channel();
+                    scan_channel         = mesh::FIRST_CHANNEL - 1;
+
+                    if (scan_next_channel()) {
+                        state = State::Transmitting;
+                        break;
+                    }
+                }
+
                 // The network might be down for the moment. We do a sleep and
                 // then we'll try again
 
                 break;
             }
 
+            if (state != State::WaitingForTransmitAcknowledgement) {
+                break;
+            }
+
+            update_backoff(transmission_result.status ==
+                           mesh::TransmissionStatus::Success);
+
             got_transmission_result = false;
             state                   = State::Sleeping;
 
+            // The downlink message might already have arrived before the
+            // acknowledgement was reported
+            if (transmission_result.status ==
+                    mesh::TransmissionStatus::Success &&
+                downlink_callback != nullptr && downlink_announced &&
+                !got_downlink) {
+
+                SYS_TimerStart(&downlink_window_timer);
+                state = State::ReceivingDownlink;
+            }
+
             break;
 
-        case State::Sleeping:
+        case State::ReceivingDownlink:
+
+            if (!got_downlink && SYS_TimerStarted(&downlink_window_timer)) {
+                break;
+            }
+
+#ifdef MESH_ENABLE_LOGGING
+            if (!got_downlink) {
+                printf("Downlink message did not arrive\r\n");
+            }
+#endif
+
+            SYS_TimerStop(&downlink_window_timer);
+            state = State::Sleeping;
+
+            break;
+
+        case State::Sleeping: {
+
+            const uint32_t interval = next_sleep_interval() + slot_offset();
+
             if (sleep_callback != nullptr) {
                 sleep_callback(SleepStatus::Entering);
             }
@@ -192,19 +854,23 @@ namespace mesh::publisher {
 
             // Have to do it in a loop as _delay_ms expects compile time
             // constant
-            for (size_t i = 0; i < sleep_interval; i++) { _delay_ms(1000); }
+            for (size_t i = 0; i < interval; i++) { _delay_ms(1000); }
 
 #else
-            low_power::sleep(sleep_interval);
+            low_power::sleep(interval);
 #endif
 
+            seconds_since_last_sample += interval;
+
             if (sleep_callback != nullptr) {
                 sleep_callback(SleepStatus::Exiting);
             }
 
             state = State::UpdatingPayload;
 
-            break;
+        }
+
+        break;
         }
 
         mesh::update();
@@ -10,6 +10,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "energy.hpp"
 #include "mesh.hpp"
 
 #include <etl/vector.h>
@@ -18,6 +19,12 @@ namespace mesh::publisher {
 
     using PayloadUpdateCallback = void (*)(Payload& data);
 
+    /**
+     * @brief Same as #PayloadUpdateCallback, but also reports whether the new
+     * data is significant enough to be transmitted.
+     */
+    using SignificantPayloadUpdateCallback = bool (*)(Payload& data);
+
     using ResetCallback = void (*)();
 
     enum class SleepStatus { Entering, Exiting };
@@ -47,6 +54,187 @@ namespace mesh::publisher {
      */
     void register_sleep_callback(SleepCallback sleep_callback);
 
+    /**
+     * @brief Only publishes when the data has changed significantly. The
+     * payload is still updated after every sleep interval, but it is only
+     * transmitted if @p significant_payload_update_callback reports it as
+     * significant. Otherwise the device goes straight back to sleep.
+     *
+     * @param significant_payload_update_callback [in] Replaces the payload
+     * update callback given in #initialise.
+     * @param heartbeat_interval [in] Forces a transmission after this many
+     * sleep intervals without one, so that the device is known to be alive.
+     */
+    void enable_event_driven_mode(
+        SignificantPayloadUpdateCallback significant_payload_update_callback,
+        uint16_t heartbeat_interval);
+
+    /**
+     * @brief Returns the battery voltage in millivolts, normally read with the
+     * ADC driver of the board.
+     */
+    using BatteryVoltageCallback = uint16_t (*)();
+
+    /**
+     * @brief Policy for adapting the sleep interval to the delivery success
+     * and the battery level.
+     */
+    struct AdaptiveIntervalConfiguration {
+        /**
+         * @brief The sleep interval is never made longer than this (in
+         * seconds).
+         */
+        uint32_t maximum_sleep_interval;
+
+        /**
+         * @brief The sleep interval is doubled for every publish cycle in a
+         * row without an acknowledgement, up to this many times. Every
+         * successful cycle halves it again.
+         */
+        uint8_t maximum_backoff;
+
+        /**
+         * @brief At or above this battery voltage (in millivolts) the sleep
+         * interval is not scaled.
+         */
+        uint16_t full_battery_voltage;
+
+        /**
+         * @brief At or below this battery voltage (in millivolts) the sleep
+         * interval is scaled by #low_battery_factor. Between the two voltages
+         * the factor is interpolated linearly.
+         */
+        uint16_t low_battery_voltage;
+
+        /**
+         * @brief How much longer to sleep with a low battery.
+         */
+        uint8_t low_battery_factor;
+    };
+
+    /**
+     * @brief Lengthens the sleep interval given in #initialise when
+     * transmissions fail or the battery runs low, according to @p
+     * configuration.
+     *
+     * @param battery_voltage_callback [in] Read before every sleep, can be
+     * nullptr if the interval should not depend on the battery level.
+     */
+    void
+    enable_adaptive_interval(const AdaptiveIntervalConfiguration& configuration,
+                             BatteryVoltageCallback battery_voltage_callback);
+
+    /**
+     * @brief Spreads the transmissions of the publishers over the sleep
+     * interval so that publishers started at the same time do not contend for
+     * the channel. The interval is divided into @p slots slots of @p
+     * slot_length seconds each, and the sleep after a publish cycle is
+     * lengthened once to move the next cycle into this device's slot.
+     *
+     * The slot is the one assigned by the recipient in the acknowledgements
+     * (see mesh::enable_slot_assignment). Until a slot has been assigned, a
+     * slot derived from the address of the device is used.
+     *
+     * @p slots times @p slot_length should not exceed the sleep interval.
+     */
+    void enable_slotted_mode(uint8_t slots, uint16_t slot_length);
+
+    /**
+     * @brief Lets the recipient send messages back to the publisher. When the
+     * acknowledgement of a transmission announces a downlink message (see
+     * mesh::enqueue_downlink), the radio is kept on for up to @p window
+     * milliseconds before going to sleep, and the message is passed to @p
+     * downlink_callback. Without an announced message the publisher goes to
+     * sleep right away as usual.
+     *
+     * @param endpoint [in] The endpoint the downlink messages are sent to.
+     */
+    void enable_downlink(Endpoint endpoint,
+                         ReceiveCallback downlink_callback,
+                         uint16_t window);
+
+    /**
+     * @brief Starts the energy accounting with the currents of the board in
+     * @p current_table, and sends an energy report (see energy::Report) to
+     * @p endpoint of the recipient every @p interval publish cycles. A cycle
+     * spans from one wake-up to the next.
+     */
+    void enable_energy_reporting(const energy::CurrentTable& current_table,
+                                 Endpoint endpoint,
+                                 uint16_t interval);
+
+    /**
+     * @brief Largest batch which fits in a single secured frame together with
+     * the device name.
+     */
+    constexpr uint8_t MAX_BATCH_SIZE = NWK_MAX_SECURED_PAYLOAD_SIZE -
+                                       DEVICE_NAME_LENGTH;
+
+    /**
+     * @brief Samples the payload after every sleep interval, but only
+     * transmits every @p samples_per_transmission intervals or when the batch
+     * is full. A batch that was not acknowledged is kept and transmitted again
+     * together with the new samples, the oldest samples are dropped if it
+     * runs full.
+     *
+     * The batch is encoded as the number of samples followed by every sample
+     * in the order they were taken:
+     *
+     * | Delta (1-5 bytes) | Size (1 byte) | Data (size bytes) |
+     *
+     * The delta is the number of seconds since the previous sample, encoded
+     * with 7 bits per byte, least significant group first, and the most
+     * significant bit set on every byte except the last. The last sample is
+     * taken right before the transmission. Use #unpack_batch to decode a batch
+     * on the receiving side.
+     */
+    void enable_batching(uint8_t samples_per_transmission);
+
+    using BatchSampleCallback = void (*)(uint32_t age,
+                                         const uint8_t* data,
+                                         uint8_t size);
+
+    /**
+     * @brief Decodes a batch created by a publisher with batching enabled.
+     * @p batch_sample_callback is called for every sample with its age in
+     * seconds relative to the last sample, oldest sample first.
+     *
+     * @return false if the batch is malformed.
+     */
+    [[nodiscard]] auto unpack_batch(const uint8_t* batch,
+                                    uint8_t size,
+                                    BatchSampleCallback batch_sample_callback)
+        -> bool;
+
+    /**
+     * @brief Helper for deciding if a value is significant in event-driven
+     * mode. A value is significant if it differs from the last significant
+     * value by at least the width of the deadband.
+     */
+    template <typename T> struct Deadband {
+        T width;
+        T reference;
+        bool has_reference;
+
+        explicit Deadband(T width_parameter)
+            : width(width_parameter), reference(), has_reference(false) {}
+
+        auto significant(const T value) -> bool {
+
+            const T difference = value > reference ? value - reference
+                                                   : reference - value;
+
+            if (has_reference && difference < width) {
+                return false;
+            }
+
+            reference     = value;
+            has_reference = true;
+
+            return true;
+        }
+    };
+
     /**
      * @brief Updates the state of the publisher and the network layer.
      */
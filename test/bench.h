@@ -0,0 +1,56 @@
+#ifndef TEST_BENCH_H
+#define TEST_BENCH_H
+
+/* Cycle counter and reporting shared by the host benchmarks */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+#define BENCH_UNIT "cycles"
+
+static inline uint64_t bench_cycles(void) {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+
+#define BENCH_UNIT "ns"
+
+static inline uint64_t bench_cycles(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+#endif
+
+/* Calls per round and rounds per measurement */
+#define BENCH_RUNS   1000
+#define BENCH_ROUNDS 10
+
+/* Runs @a statement BENCH_ROUNDS times BENCH_RUNS times and evaluates to the
+ * average cost of one run in the fastest round, which is the least disturbed
+ * by the rest of the host */
+#define BENCH(statement)                                              \
+    ({                                                                \
+        uint64_t bench_best = UINT64_MAX;                             \
+        for (uint32_t bench_round = 0; bench_round < BENCH_ROUNDS;    \
+             bench_round++) {                                         \
+            uint64_t bench_start = bench_cycles();                    \
+            for (uint32_t bench_i = 0; bench_i < BENCH_RUNS;          \
+                 bench_i++) {                                         \
+                statement;                                            \
+            }                                                         \
+            bench_start = bench_cycles() - bench_start;               \
+            if (bench_start < bench_best) {                           \
+                bench_best = bench_start;                             \
+            }                                                         \
+        }                                                             \
+        bench_best / BENCH_RUNS;                                      \
+    })
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+/* Checks shared by the host tests. A failed check is reported and counted,
+ * and the test carries on, so that one run shows every failure. */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(condition)                                                 \
+    do {                                                                 \
+        if (!(condition)) {                                              \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                  \
+        }                                                                \
+    } while (0)
+
+/* Prints the outcome of the checks and returns true if all of them passed */
+static inline bool check_passed(void) {
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return false;
+    }
+
+    printf("All checks passed\n");
+    return true;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef TEST_COMPILER_H
+#define TEST_COMPILER_H
+
+/* Host stand-in for the ASF compiler.h used by the NWK headers */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COMPILER_PACK_SET(alignment) _Pragma("pack(push, 1)")
+#define COMPILER_PACK_RESET()        _Pragma("pack(pop)")
+
+#endif
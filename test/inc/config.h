@@ -0,0 +1,15 @@
+#ifndef MESH_CONFIG_H
+#define MESH_CONFIG_H
+
+/* Configuration of the host tests, used in place of src/config.h */
+
+#include <stdint.h>
+
+#ifndef SYS_SECURITY_MODE
+#define SYS_SECURITY_MODE 1 /* The benchmarks also build mode 0 */
+#endif
+
+#define NWK_SECURITY_MIC_SIZE 8 /* M of the RFC 3610 vectors */
+#define NWK_ENABLE_SECURITY
+
+#endif
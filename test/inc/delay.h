@@ -0,0 +1,10 @@
+#ifndef TEST_DELAY_H
+#define TEST_DELAY_H
+
+/* Host stand-in for the ASF delay.h, implemented by trx_model.c */
+
+#include <stdint.h>
+
+void delay_us(uint32_t delay);
+
+#endif
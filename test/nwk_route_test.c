@@ -0,0 +1,221 @@
+/*
+ * Host test and benchmark of the hash-indexed routing table, built for
+ * tables of 25, 100 and 250 entries. The tests fill the table and check
+ * lookup, insertion, CLOCK eviction (with every entry fixed, too), freeing
+ * and the index rebuild after the table has been changed through
+ * NWK_RouteTable(). The benchmark then measures a lookup that hits and one
+ * that misses on the full table, next to a linear scan of the same table as
+ * the lookup did before the index, and the insertion of a new route that
+ * evicts another one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "check.h"
+#include "nwk.h"
+#include "nwkRoute.h"
+#include "nwk_stubs.h"
+
+/* Spread over the address space like the addresses of a real network, with
+ * routing and non-routing nodes */
+#define DST(i)      ((uint16_t)(0x0001 + (i) * 0x0101))
+#define NEXT_HOP(i) ((uint16_t)(0x4000 + (i)))
+
+static uint16_t entries_found(void) {
+    uint16_t found = 0;
+
+    for (uint16_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++) {
+        if (NEXT_HOP(i) == NWK_RouteNextHop(DST(i), 0)) {
+            found++;
+        }
+    }
+
+    return found;
+}
+
+static void fill_table(void) {
+    nwkRouteInit();
+
+    for (uint16_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++) {
+        nwkRouteUpdateEntry(DST(i), 0, NEXT_HOP(i), 200);
+    }
+}
+
+static void test_insert_and_lookup(void) {
+    NWK_RouteTableEntry_t* entry;
+
+    fill_table();
+
+    CHECK(NWK_ROUTE_TABLE_SIZE == entries_found());
+
+    /* A multicast route to the same address is a different route */
+    CHECK(NULL == NWK_RouteFindEntry(DST(0), 1));
+    CHECK(NWK_ROUTE_UNKNOWN == NWK_RouteNextHop(DST(NWK_ROUTE_TABLE_SIZE), 0));
+
+    /* An update changes the existing entry in place */
+    entry = NWK_RouteFindEntry(DST(1), 0);
+    nwkRouteUpdateEntry(DST(1), 0, 0x1234, 100);
+    CHECK(entry == NWK_RouteFindEntry(DST(1), 0));
+    CHECK(0x1234 == entry->nextHopAddr && 100 == entry->lqi);
+}
+
+static void test_free(void) {
+    NWK_RouteTableEntry_t* entry;
+
+    fill_table();
+
+    entry = NWK_RouteFindEntry(DST(2), 0);
+    NWK_RouteFreeEntry(entry);
+    CHECK(NULL == NWK_RouteFindEntry(DST(2), 0));
+    CHECK(NWK_ROUTE_TABLE_SIZE - 1 == entries_found());
+
+    /* The freed entry is reused before anything is evicted */
+    CHECK(entry == NWK_RouteNewEntry());
+    entry->dstAddr     = DST(2);
+    entry->nextHopAddr = NEXT_HOP(2);
+    CHECK(NWK_ROUTE_TABLE_SIZE == entries_found());
+
+    /* A fixed entry stays */
+    entry        = NWK_RouteFindEntry(DST(3), 0);
+    entry->fixed = 1;
+    nwkRouteRemove(DST(3), 0);
+    CHECK(entry == NWK_RouteFindEntry(DST(3), 0));
+}
+
+static void test_eviction(void) {
+    fill_table();
+
+    /* Every entry was referenced once, the sweep spares each of them once
+     * and then takes the first one */
+    nwkRouteUpdateEntry(DST(NWK_ROUTE_TABLE_SIZE), 0, 0x1234, 200);
+
+    CHECK(0x1234 == NWK_RouteNextHop(DST(NWK_ROUTE_TABLE_SIZE), 0));
+    CHECK(NULL == NWK_RouteFindEntry(DST(0), 0));
+    CHECK(NWK_ROUTE_TABLE_SIZE - 1 == entries_found());
+}
+
+static void test_eviction_all_fixed(void) {
+    NWK_RouteTableEntry_t* table;
+
+    fill_table();
+
+    table = NWK_RouteTable();
+
+    for (uint16_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++) {
+        table[i].fixed = 1;
+    }
+
+    CHECK(NULL == NWK_RouteNewEntry());
+
+    nwkRouteUpdateEntry(DST(NWK_ROUTE_TABLE_SIZE), 0, 0x1234, 200);
+    CHECK(NULL == NWK_RouteFindEntry(DST(NWK_ROUTE_TABLE_SIZE), 0));
+    CHECK(NWK_ROUTE_TABLE_SIZE == entries_found());
+
+    /* The only entry which is not fixed is the one evicted */
+    table = NWK_RouteTable();
+    table[NWK_ROUTE_TABLE_SIZE / 2].fixed = 0;
+
+    nwkRouteUpdateEntry(DST(NWK_ROUTE_TABLE_SIZE), 0, 0x1234, 200);
+    CHECK(0x1234 == NWK_RouteNextHop(DST(NWK_ROUTE_TABLE_SIZE), 0));
+    CHECK(NULL == NWK_RouteFindEntry(DST(NWK_ROUTE_TABLE_SIZE / 2), 0));
+    CHECK(NWK_ROUTE_TABLE_SIZE - 1 == entries_found());
+}
+
+static void test_rebuild(void) {
+    NWK_RouteTableEntry_t* table;
+    NWK_RouteTableEntry_t* entry;
+
+    fill_table();
+
+    /* Changed behind the back of the index: one entry is readdressed, one
+     * is cleared and one becomes a multicast route */
+    entry          = NWK_RouteFindEntry(DST(4), 0);
+    table          = NWK_RouteTable();
+    entry->dstAddr = 0xabcd;
+
+    entry          = &table[0];
+    entry->dstAddr = NWK_ROUTE_UNKNOWN;
+
+    entry            = &table[1];
+    entry->multicast = 1;
+
+    CHECK(NEXT_HOP(4) == NWK_RouteNextHop(0xabcd, 0));
+    CHECK(NULL == NWK_RouteFindEntry(DST(4), 0));
+    CHECK(NEXT_HOP(1) == NWK_RouteNextHop(DST(1), 1));
+    CHECK(NULL == NWK_RouteFindEntry(DST(1), 0));
+
+    /* The cleared entry is free again */
+    CHECK(&table[0] == NWK_RouteNewEntry());
+}
+
+/* Lookup of the table before it was indexed */
+static NWK_RouteTableEntry_t* linear_find(NWK_RouteTableEntry_t* table,
+                                          uint16_t dst,
+                                          uint8_t multicast) {
+    for (uint16_t i = 0; i < NWK_ROUTE_TABLE_SIZE; i++) {
+        if (table[i].dstAddr == dst && table[i].multicast == multicast) {
+            return &table[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void benchmark(void) {
+    NWK_RouteTableEntry_t* table;
+    volatile uint16_t sink;
+    uint16_t n = 0;
+    uint64_t hit, miss, linear_hit, linear_miss, evict, rebuild;
+
+    fill_table();
+
+    hit = BENCH(sink = NWK_RouteNextHop(DST(n), 0);
+                n    = (n + 1) % NWK_ROUTE_TABLE_SIZE);
+    miss = BENCH(sink = NWK_RouteNextHop(DST(n) ^ 0x8000, 0);
+                 n    = (n + 1) % NWK_ROUTE_TABLE_SIZE);
+
+    /* Taking the table marks the index stale, a lookup rebuilds it */
+    rebuild = BENCH(NWK_RouteTable(); sink = NWK_RouteNextHop(DST(0), 0)) -
+              BENCH(sink = NWK_RouteNextHop(DST(0), 0));
+
+    table       = NWK_RouteTable();
+    linear_hit  = BENCH(sink = linear_find(table, DST(n), 0)->nextHopAddr;
+                        n    = (n + 1) % NWK_ROUTE_TABLE_SIZE);
+    linear_miss = BENCH(sink = NULL == linear_find(table, DST(n) ^ 0x8000, 0);
+                        n    = (n + 1) % NWK_ROUTE_TABLE_SIZE);
+
+    /* Every insertion of a new destination evicts one */
+    n     = NWK_ROUTE_TABLE_SIZE;
+    evict = BENCH(nwkRouteUpdateEntry(DST(n), 0, NEXT_HOP(n), 200); n++);
+
+    (void)sink;
+
+    printf("%u entries, %u buckets, in host " BENCH_UNIT ":\n",
+           NWK_ROUTE_TABLE_SIZE,
+           1 << NWK_ROUTE_HASH_BITS);
+    printf("  lookup hit  %5llu (linear scan %5llu)\n",
+           (unsigned long long)hit,
+           (unsigned long long)linear_hit);
+    printf("  lookup miss %5llu (linear scan %5llu)\n",
+           (unsigned long long)miss,
+           (unsigned long long)linear_miss);
+    printf("  insert with eviction %5llu\n", (unsigned long long)evict);
+    printf("  index rebuild %5llu\n", (unsigned long long)rebuild);
+}
+
+int main(void) {
+    test_insert_and_lookup();
+    test_free();
+    test_eviction();
+    test_eviction_all_fixed();
+    test_rebuild();
+
+    if (!check_passed()) {
+        return EXIT_FAILURE;
+    }
+
+    benchmark();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/*
+ * Crypto cost per frame of the NWK Security module: one frame of 16, 64 and
+ * NWK_MAX_SECURED_PAYLOAD_SIZE bytes queued with nwkSecurityProcess() and
+ * handled by one call of nwkSecurityTaskHandler(), for encryption and for
+ * decryption. Built once for each SYS_SECURITY_MODE like sys_encrypt_bench.
+ * Mode 1 is measured in host cycles, with the cost of preparing the frame
+ * subtracted. Mode 0 reports the MCU cycles of the SPI transfers and AES
+ * waits in the transceiver model, without the CCM* work of the MCU itself.
+ * In mode 0 the tag of a decrypted frame does not match, as the
+ * transceiver model does not encrypt, but the same blocks are processed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "nwk.h"
+#include "nwkSecurity.h"
+#include "nwk_stubs.h"
+
+#if SYS_SECURITY_MODE == 0
+#include "trx_model.h"
+#endif
+
+static const uint8_t sizes[] = {16, 64, NWK_MAX_SECURED_PAYLOAD_SIZE};
+
+static uint8_t key[NWK_SECURITY_KEY_SIZE] = {
+    0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+};
+
+static NwkFrame_t plain;
+static NwkFrame_t secured;
+static NwkFrame_t frame;
+
+/* Copies @a source with its payload pointer */
+static void frame_copy(NwkFrame_t* source) {
+    frame         = *source;
+    frame.payload = frame.data + (source->payload - source->data);
+}
+
+static void encrypt(void) {
+    frame_copy(&plain);
+    nwkSecurityProcess(&frame, true);
+    nwkSecurityTaskHandler();
+}
+
+/* The frame counter and replay windows start over, so the same secured frame
+ * is accepted every time */
+static void decrypt_setup(void) {
+    frame_copy(&secured);
+    nwkSecurityInit();
+    NWK_SetSecurityKey(key);
+}
+
+static void decrypt(void) {
+    decrypt_setup();
+    nwkSecurityProcess(&frame, false);
+    nwkSecurityTaskHandler();
+}
+
+int main(void) {
+    printf("SYS_SECURITY_MODE %d\n", SYS_SECURITY_MODE);
+
+    for (size_t i = 0; i < sizeof(sizes); i++) {
+        nwkSecurityInit();
+        NWK_SetSecurityKey(key);
+
+        nwk_stubs_frame_init(&plain, sizes[i]);
+        frame_copy(&plain);
+        nwkSecurityProcess(&frame, true);
+        nwkSecurityTaskHandler();
+        secured         = frame;
+        secured.payload = secured.data + sizeof(NwkFrameHeader_t);
+
+#if SYS_SECURITY_MODE == 0
+        uint32_t encrypted;
+
+        trx_model_reset();
+        encrypt();
+        encrypted = trx_model_cpu_cycles();
+
+        trx_model_reset();
+        decrypt();
+
+        printf("%3u byte payload: %6lu MCU cycles to encrypt, %6lu to "
+               "decrypt\n",
+               sizes[i],
+               (unsigned long)encrypted,
+               (unsigned long)trx_model_cpu_cycles());
+#else
+        uint64_t copy      = BENCH(frame_copy(&plain));
+        uint64_t encrypted = BENCH(encrypt()) - copy;
+        uint64_t decrypted = BENCH(decrypt()) - BENCH(decrypt_setup());
+
+        nwk_stubs_reset();
+        decrypt();
+
+        if (!nwk_stubs.rx_confirmed || !nwk_stubs.rx_status) {
+            printf("The secured frame was not accepted\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("%3u byte payload: %6llu host " BENCH_UNIT " to encrypt, "
+               "%6llu to decrypt\n",
+               sizes[i],
+               (unsigned long long)encrypted,
+               (unsigned long long)decrypted);
+#endif
+    }
+
+    return EXIT_SUCCESS;
+}
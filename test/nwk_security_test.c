@@ -0,0 +1,314 @@
+/*
+ * Host test of the NWK Security module. The CCM* routines are checked
+ * against packet vectors #1 to #6 of RFC 3610 (M = 8, L = 2, 13 byte nonce),
+ * which CCM* shares with CCM when the frame is encrypted and authenticated.
+ * The frame path is checked with the largest secured payload and with one
+ * byte more, which has to be refused without touching the frame. The replay
+ * windows are checked for the second-chance reuse of a full table and for
+ * peers added with NWK_AddSecurityPeer(), and built once more with
+ * NWK_SECURITY_REJECT_UNKNOWN_PEERS and with the table of src/config.h.
+ * After a key switch, a peer which still uses the previous network key has
+ * to be answered with it, and the key stays in use until no window refers
+ * to it.
+ *
+ * The module is included, so its static routines can be called directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "check.h"
+#include "nwkSecurity.c"
+#include "nwk_stubs.h"
+
+#define PEER(i) ((uint16_t)(0x0100 + (i)))
+
+typedef struct {
+    uint8_t nonce[NWK_SECURITY_NONCE_SIZE];
+    uint8_t auth_size;
+    uint8_t packet_size; /* Authenticated data and text, 0x00, 0x01, ... */
+    uint8_t result[40];  /* Encrypted text followed by the encrypted tag */
+} CcmVector;
+
+static const uint8_t vector_key[NWK_SECURITY_KEY_SIZE] = {
+    0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+};
+
+static const CcmVector vectors[] = {
+    /* Packet vector #1 */
+    {{0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00,
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+     8, 31,
+     {
+         0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2,
+         0xf0, 0x66, 0xd0, 0xc2, 0xc0, 0xf9, 0x89, 0x80,
+         0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3, 0x84, 0x17,
+         0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0,
+     }},
+    /* Packet vector #2 */
+    {{0x00, 0x00, 0x00, 0x04, 0x03, 0x02, 0x01,
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+     8, 32,
+     {
+         0x72, 0xc9, 0x1a, 0x36, 0xe1, 0x35, 0xf8, 0xcf,
+         0x29, 0x1c, 0xa8, 0x94, 0x08, 0x5c, 0x87, 0xe3,
+         0xcc, 0x15, 0xc4, 0x39, 0xc9, 0xe4, 0x3a, 0x3b,
+         0xa0, 0x91, 0xd5, 0x6e, 0x10, 0x40, 0x09, 0x16,
+     }},
+    /* Packet vector #3 */
+    {{0x00, 0x00, 0x00, 0x05, 0x04, 0x03, 0x02,
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+     8, 33,
+     {
+         0x51, 0xb1, 0xe5, 0xf4, 0x4a, 0x19, 0x7d, 0x1d,
+         0xa4, 0x6b, 0x0f, 0x8e, 0x2d, 0x28, 0x2a, 0xe8,
+         0x71, 0xe8, 0x38, 0xbb, 0x64, 0xda, 0x85, 0x96,
+         0x57, 0x4a, 0xda, 0xa7, 0x6f, 0xbd, 0x9f, 0xb0,
+         0xc5,
+     }},
+    /* Packet vector #4 */
+    {{0x00, 0x00, 0x00, 0x06, 0x05, 0x04, 0x03,
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+     12, 31,
+     {
+         0xa2, 0x8c, 0x68, 0x65, 0x93, 0x9a, 0x9a, 0x79,
+         0xfa, 0xaa, 0x5c, 0x4c, 0x2a, 0x9d, 0x4a, 0x91,
+         0xcd, 0xac, 0x8c, 0x96, 0xc8, 0x61, 0xb9, 0xc9,
+         0xe6, 0x1e, 0xf1,
+     }},
+    /* Packet vector #5 */
+    {{0x00, 0x00, 0x00, 0x07, 0x06, 0x05, 0x04,
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+     12, 32,
+     {
+         0xdc, 0xf1, 0xfb, 0x7b, 0x5d, 0x9e, 0x23, 0xfb,
+         0x9d, 0x4e, 0x13, 0x12, 0x53, 0x65, 0x8a, 0xd8,
+         0x6e, 0xbd, 0xca, 0x3e, 0x51, 0xe8, 0x3f, 0x07,
+         0x7d, 0x9c, 0x2d, 0x93,
+     }},
+    /* Packet vector #6 */
+    {{0x00, 0x00, 0x00, 0x08, 0x07, 0x06, 0x05,
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+     12, 33,
+     {
+         0x6f, 0xc1, 0xb0, 0x11, 0xf0, 0x06, 0x56, 0x8b,
+         0x51, 0x71, 0xa4, 0x2d, 0x95, 0x3d, 0x46, 0x9b,
+         0x25, 0x70, 0xa4, 0xbd, 0x87, 0x40, 0x5a, 0x04,
+         0x43, 0xac, 0x91, 0xcb, 0x94,
+     }},
+};
+
+static void test_ccm_vectors(void) {
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const CcmVector* vector = &vectors[i];
+        uint8_t key[NWK_SECURITY_KEY_SIZE];
+        uint8_t nonce[NWK_SECURITY_NONCE_SIZE];
+        uint8_t packet[40];
+        uint8_t mac[NWK_SECURITY_BLOCK_SIZE];
+        uint8_t mic[NWK_SECURITY_MIC_SIZE];
+        uint8_t* auth = packet;
+        uint8_t* text = &packet[vector->auth_size];
+        uint8_t size  = vector->packet_size - vector->auth_size;
+
+        memcpy(key, vector_key, sizeof(key));
+        memcpy(nonce, vector->nonce, sizeof(nonce));
+
+        for (uint8_t j = 0; j < vector->packet_size; j++) {
+            packet[j] = j;
+        }
+
+        /* Encryption, as in nwkSecurityEncryptFrame() */
+        nwkSecurityMac(key, nonce, auth, vector->auth_size, text, size, mac);
+        nwkSecurityCtr(key, nonce, text, size, mac);
+
+        CHECK(0 == memcmp(text, vector->result, size));
+        CHECK(0 == memcmp(mac, &vector->result[size], NWK_SECURITY_MIC_SIZE));
+
+        /* Decryption, as in nwkSecurityDecryptFrame() */
+        memcpy(mic, &vector->result[size], NWK_SECURITY_MIC_SIZE);
+        nwkSecurityCtr(key, nonce, text, size, mic);
+        nwkSecurityMac(key, nonce, auth, vector->auth_size, text, size, mac);
+
+        for (uint8_t j = 0; j < size; j++) {
+            CHECK(vector->auth_size + j == text[j]);
+        }
+
+        CHECK(0 == memcmp(mac, mic, NWK_SECURITY_MIC_SIZE));
+    }
+}
+
+static void test_largest_payload(void) {
+    NwkFrame_t frame;
+
+    nwk_stubs_frame_init(&frame, NWK_MAX_SECURED_PAYLOAD_SIZE);
+    nwk_stubs_reset();
+
+    nwkSecurityProcess(&frame, true);
+    nwkSecurityTaskHandler();
+
+    CHECK(nwk_stubs.tx_encrypted);
+    CHECK(!nwk_stubs.tx_confirmed);
+    CHECK(sizeof(NwkFrameHeader_t) + NWK_MAX_PAYLOAD_SIZE == frame.size);
+
+    /* Received as sent, the payload starts with the auxiliary header. The
+     * power level is set by every hop and not authenticated. */
+    frame.payload = frame.data + sizeof(NwkFrameHeader_t);
+    frame.header.nwkFcf.txPower = 0x0f;
+
+    /* Known to the receiver, in case unknown peers are rejected */
+    CHECK(NWK_AddSecurityPeer(frame.header.nwkSrcAddr, 0));
+
+    nwkSecurityProcess(&frame, false);
+    nwkSecurityTaskHandler();
+
+    CHECK(nwk_stubs.rx_confirmed && nwk_stubs.rx_status);
+    CHECK(NWK_MAX_SECURED_PAYLOAD_SIZE == nwkFramePayloadSize(&frame));
+
+    for (uint8_t i = 0; i < NWK_MAX_SECURED_PAYLOAD_SIZE; i++) {
+        CHECK(i == frame.payload[i]);
+    }
+}
+
+static void test_oversized_payload(void) {
+    NwkFrame_t frame;
+    NwkFrame_t copy;
+    uint32_t counter = NWK_SecurityFrameCounter();
+
+    nwk_stubs_frame_init(&frame, NWK_MAX_SECURED_PAYLOAD_SIZE + 1);
+    copy = frame;
+    nwk_stubs_reset();
+
+    nwkSecurityProcess(&frame, true);
+    nwkSecurityTaskHandler();
+
+    CHECK(!nwk_stubs.tx_encrypted);
+    CHECK(nwk_stubs.tx_confirmed && NWK_ERROR_STATUS == nwk_stubs.tx_status);
+    CHECK(copy.size == frame.size && copy.payload == frame.payload);
+    CHECK(0 == memcmp(copy.data, frame.data, sizeof(frame.data)));
+    CHECK(counter == NWK_SecurityFrameCounter());
+}
+
+static void test_replay_clock(void) {
+    nwkSecurityInit();
+
+    for (uint8_t i = 0; i < NWK_SECURITY_REPLAY_TABLE_SIZE; i++) {
+        nwkSecurityReplayAccept(PEER(i), 10, 0);
+    }
+
+    for (uint8_t i = 0; i < NWK_SECURITY_REPLAY_TABLE_SIZE; i++) {
+        CHECK(PEER(i) == nwkSecurityReplayFind(PEER(i))->src);
+    }
+
+    /* Every window has been used, so the hand passes them all once and
+     * then reuses the first one */
+    nwkSecurityReplayAccept(PEER(NWK_SECURITY_REPLAY_TABLE_SIZE), 1, 0);
+    CHECK(NULL == nwkSecurityReplayFind(PEER(0)));
+    CHECK(!nwkSecurityReplayCheck(PEER(NWK_SECURITY_REPLAY_TABLE_SIZE), 1));
+
+    /* Peer 1 is used again and spared, peer 2 makes way for a new one */
+    nwkSecurityReplayAccept(PEER(1), 11, 0);
+    nwkSecurityReplayAccept(PEER(NWK_SECURITY_REPLAY_TABLE_SIZE + 1), 1, 0);
+
+    CHECK(!nwkSecurityReplayCheck(PEER(1), 11));
+    CHECK(!nwkSecurityReplayCheck(PEER(1), 10));
+    CHECK(!nwkSecurityReplayCheck(PEER(3), 10));
+    CHECK(NULL == nwkSecurityReplayFind(PEER(2)));
+}
+
+static void test_replay_peers(void) {
+    nwkSecurityInit();
+
+    CHECK(NWK_AddSecurityPeer(PEER(0), 5));
+    CHECK(!nwkSecurityReplayCheck(PEER(0), 4));
+    CHECK(nwkSecurityReplayCheck(PEER(0), 5));
+
+    nwkSecurityReplayAccept(PEER(0), 5, 0);
+    CHECK(!nwkSecurityReplayCheck(PEER(0), 5));
+    CHECK(nwkSecurityReplayCheck(PEER(0), 6));
+
+    /* No window is evicted for a peer */
+    for (uint8_t i = 1; i < NWK_SECURITY_REPLAY_TABLE_SIZE; i++) {
+        CHECK(NWK_AddSecurityPeer(PEER(i), 0));
+    }
+
+    CHECK(!NWK_AddSecurityPeer(PEER(NWK_SECURITY_REPLAY_TABLE_SIZE), 0));
+    CHECK(NWK_RemoveSecurityPeer(PEER(1)));
+    CHECK(!NWK_RemoveSecurityPeer(PEER(1)));
+    CHECK(!NWK_AddSecurityPeer(NWK_BROADCAST_ADDR, 0));
+    CHECK(NWK_AddSecurityPeer(PEER(NWK_SECURITY_REPLAY_TABLE_SIZE), 0));
+
+#ifdef NWK_SECURITY_REJECT_UNKNOWN_PEERS
+    CHECK(!nwkSecurityReplayCheck(PEER(1), 0));
+#else
+    CHECK(nwkSecurityReplayCheck(PEER(1), 0));
+#endif
+}
+
+static void test_peer_key(void) {
+    uint8_t key[NWK_SECURITY_KEY_SIZE] = {0};
+    NwkFrame_t frame;
+    uint8_t id = 0xff;
+
+    nwkSecurityInit();
+    CHECK(NWK_AddSecurityKey(1, NWK_SECURITY_KEY_NETWORK, 0, key));
+    CHECK(NWK_AddSecurityKey(2, NWK_SECURITY_KEY_GROUP, 0x1234, key));
+    CHECK(NWK_SECURITY_KEY_GROUP == NWK_SecurityKeyType(2));
+    CHECK(NWK_SECURITY_KEY_NONE == NWK_SecurityKeyType(3));
+
+    key[0] = 0xff;
+    CHECK(NWK_SecurityKey(1, key) && 0 == key[0]);
+    CHECK(!NWK_SecurityKey(3, key));
+
+    nwkSecurityReplayAccept(PEER(0), 1, 0);
+    CHECK(nwkSecurityPeerKey(PEER(0), &id) && 0 == id);
+    CHECK(!nwkSecurityPeerKey(PEER(1), &id));
+    CHECK(nwkSecurityKeyInUse(0) && !nwkSecurityKeyInUse(1));
+
+    /* Peer 0 missed the switch to key 1 */
+    CHECK(NWK_SetActiveSecurityKey(1));
+
+    nwk_stubs_frame_init(&frame, 16);
+    frame.header.nwkDstAddr = PEER(0);
+    CHECK(1 == nwkSecurityTxKey(&frame)->id);
+
+    frame.tx.control = NWK_TX_CONTROL_PEER_KEY;
+    CHECK(0 == nwkSecurityTxKey(&frame)->id);
+
+    frame.header.nwkDstAddr = PEER(1);
+    CHECK(1 == nwkSecurityTxKey(&frame)->id);
+
+    /* Only a network key is used, not the group key of a multicast frame */
+    nwkSecurityReplayAccept(PEER(1), 1, 2);
+    CHECK(1 == nwkSecurityTxKey(&frame)->id);
+
+    nwkSecurityReplayAccept(PEER(0), 2, 1);
+    CHECK(!nwkSecurityKeyInUse(0));
+
+    /* The windows are counted again when a removed key is added back */
+    CHECK(nwkSecurityKeyInUse(2));
+    CHECK(NWK_RemoveSecurityKey(2));
+    CHECK(!nwkSecurityKeyInUse(2));
+    CHECK(NWK_AddSecurityKey(2, NWK_SECURITY_KEY_GROUP, 0x1234, key));
+    CHECK(nwkSecurityKeyInUse(2));
+
+    CHECK(NWK_RemoveSecurityPeer(PEER(1)));
+    CHECK(!nwkSecurityKeyInUse(2));
+}
+
+int main(void) {
+    uint8_t key[NWK_SECURITY_KEY_SIZE];
+
+    memcpy(key, vector_key, sizeof(key));
+
+    nwkSecurityInit();
+    NWK_SetSecurityKey(key);
+
+    test_ccm_vectors();
+    test_largest_payload();
+    test_oversized_payload();
+    test_replay_clock();
+    test_replay_peers();
+    test_peer_key();
+
+    return check_passed() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
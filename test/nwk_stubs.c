@@ -0,0 +1,80 @@
+#include <string.h>
+#include "nwk_stubs.h"
+#include "nwkFrame.h"
+#include "nwkRx.h"
+#include "nwkTx.h"
+
+NwkIb_t nwkIb;
+NwkStubs nwk_stubs;
+
+void nwk_stubs_reset(void) {
+    memset(&nwk_stubs, 0, sizeof(nwk_stubs));
+}
+
+/* Secured frame from 0x0001 to 0x0000 with a payload of 0, 1, 2, ... */
+void nwk_stubs_frame_init(NwkFrame_t* frame, uint8_t size) {
+    memset(frame, 0, sizeof(*frame));
+
+    frame->header.macDstPanId     = 0x1234;
+    frame->header.nwkFcf.security = 1;
+    frame->header.nwkSrcAddr      = 0x0001;
+    frame->header.nwkDstAddr      = 0x0000;
+    frame->header.nwkSrcEndpoint  = 1;
+    frame->header.nwkDstEndpoint  = 1;
+
+    frame->payload = frame->data + sizeof(NwkFrameHeader_t);
+    frame->size    = sizeof(NwkFrameHeader_t) + size;
+
+    for (uint8_t i = 0; i < size; i++) {
+        frame->payload[i] = i;
+    }
+}
+
+void nwkFrameQueueInit(NwkFrameQueue_t* queue) {
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+void nwkFrameEnqueue(NwkFrameQueue_t* queue, NwkFrame_t* frame) {
+    frame->queue = queue;
+    queue->head  = frame;
+    queue->tail  = frame;
+}
+
+void nwkFrameDequeue(NwkFrame_t* frame) {
+    nwkFrameQueueInit(frame->queue);
+    frame->queue = NULL;
+}
+
+NwkFrame_t* nwkFrameAlloc(void) {
+    return NULL;
+}
+
+void nwkFrameFree(NwkFrame_t* frame) {
+    (void)frame;
+}
+
+void nwkFrameCommandInit(NwkFrame_t* frame) {
+    (void)frame;
+}
+
+void nwkTxFrame(NwkFrame_t* frame) {
+    (void)frame;
+}
+
+void nwkTxEncryptConf(NwkFrame_t* frame) {
+    (void)frame;
+    nwk_stubs.tx_encrypted = true;
+}
+
+void nwkTxConfirm(NwkFrame_t* frame, uint8_t status) {
+    (void)frame;
+    nwk_stubs.tx_confirmed = true;
+    nwk_stubs.tx_status    = status;
+}
+
+void nwkRxDecryptConf(NwkFrame_t* frame, bool status) {
+    (void)frame;
+    nwk_stubs.rx_confirmed = true;
+    nwk_stubs.rx_status    = status;
+}
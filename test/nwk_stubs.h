@@ -0,0 +1,28 @@
+#ifndef TEST_NWK_STUBS_H
+#define TEST_NWK_STUBS_H
+
+/*
+ * Stand-ins for the NWK modules around the Security and Routing modules. The
+ * frame queue holds one frame, which is all the tests need, and the
+ * confirmations from the Security module are recorded in nwk_stubs. No
+ * frames are allocated, so nothing is ever sent.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nwk.h"
+
+typedef struct {
+    bool tx_encrypted;
+    bool tx_confirmed;
+    uint8_t tx_status;
+    bool rx_confirmed;
+    bool rx_status;
+} NwkStubs;
+
+extern NwkStubs nwk_stubs;
+
+void nwk_stubs_reset(void);
+void nwk_stubs_frame_init(NwkFrame_t* frame, uint8_t size);
+
+#endif
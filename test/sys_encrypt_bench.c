@@ -0,0 +1,83 @@
+/*
+ * Cost of SYS_EncryptBlocks() for 16, 64 and 109 byte payloads, encrypted
+ * in one call as nwkSecurityCtr() does. The benchmark is built once for each
+ * SYS_SECURITY_MODE. Mode 1 is measured with the host cycle counter. In
+ * mode 0 the SAL drives the transceiver model, and the benchmark reports the
+ * cycles an 8 MHz MCU spends on the SPI transfers and the AES waits. Each
+ * size is measured with the key schedule cached and with a new key on every
+ * call.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "sysConfig.h"
+#include "sysEncrypt.h"
+
+#if SYS_SECURITY_MODE == 0
+#include "trx_model.h"
+#endif
+
+#define BLOCK_SIZE 16
+
+static const uint8_t sizes[] = {16, 64, 109};
+
+static uint8_t keys[2][BLOCK_SIZE] = {
+    {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+     0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f},
+    {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+     0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c},
+};
+
+static uint8_t text[7 * BLOCK_SIZE];
+
+#if SYS_SECURITY_MODE == 0
+
+/* Modelled MCU cycles of a call with @a key, after a call with @a previous.
+ * The traffic of the measured call is left in trx_model_stats. */
+static uint32_t model_cycles(uint8_t blocks, uint8_t* previous, uint8_t* key) {
+    SYS_EncryptBlocks(text, blocks, previous);
+
+    trx_model_reset();
+    SYS_EncryptBlocks(text, blocks, key);
+
+    return trx_model_cpu_cycles();
+}
+
+#endif
+
+int main(void) {
+    printf("SYS_SECURITY_MODE %d\n", SYS_SECURITY_MODE);
+
+    for (size_t i = 0; i < sizeof(sizes); i++) {
+        uint8_t blocks = (sizes[i] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+#if SYS_SECURITY_MODE == 0
+        uint32_t rekeyed = model_cycles(blocks, keys[0], keys[1]);
+        uint32_t cached  = model_cycles(blocks, keys[0], keys[0]);
+
+        printf("%3u bytes, %u blocks: %6lu MCU cycles, %6lu with a new key "
+               "(%lu SPI bytes, %lu us AES wait)\n",
+               sizes[i],
+               blocks,
+               (unsigned long)cached,
+               (unsigned long)rekeyed,
+               (unsigned long)trx_model_stats.spi_bytes,
+               (unsigned long)trx_model_stats.wait_us);
+#else
+        uint8_t n        = 0;
+        uint64_t cached  = BENCH(SYS_EncryptBlocks(text, blocks, keys[0]));
+        uint64_t rekeyed = BENCH(
+            SYS_EncryptBlocks(text, blocks, keys[n ^= 1]));
+
+        printf("%3u bytes, %u blocks: %6llu host " BENCH_UNIT
+               ", %6llu with a new key\n",
+               sizes[i],
+               blocks,
+               (unsigned long long)cached,
+               (unsigned long long)rekeyed);
+#endif
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+/*
+ * Host test of SYS_EncryptBlocks() in SYS_SECURITY_MODE 1 with the AES
+ * cipher. The known answers are the AES-128 examples of FIPS-197, appendix
+ * B and appendix C.1. The other checks cover the multi-block call and the
+ * cached key schedule.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "sysConfig.h"
+#include "sysEncrypt.h"
+
+#if SYS_SECURITY_MODE != 1 || SYS_SECURITY_CIPHER != SYS_SECURITY_CIPHER_AES
+#error The known answers are for the software AES backend
+#endif
+
+#define BLOCK_SIZE 16
+
+typedef struct {
+    uint8_t key[BLOCK_SIZE];
+    uint8_t plaintext[BLOCK_SIZE];
+    uint8_t ciphertext[BLOCK_SIZE];
+} AesVector;
+
+static const AesVector vectors[] = {
+    /* FIPS-197 appendix C.1 */
+    {{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f},
+     {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+      0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff},
+     {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+      0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a}},
+    /* FIPS-197 appendix B */
+    {{0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+      0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c},
+     {0x32, 0x43, 0xf6, 0xa8, 0x88, 0x5a, 0x30, 0x8d,
+      0x31, 0x31, 0x98, 0xa2, 0xe0, 0x37, 0x07, 0x34},
+     {0x39, 0x25, 0x84, 0x1d, 0x02, 0xdc, 0x09, 0xfb,
+      0xdc, 0x11, 0x85, 0x97, 0x19, 0x6a, 0x0b, 0x32}},
+};
+
+#define VECTORS_AMOUNT (sizeof(vectors) / sizeof(vectors[0]))
+
+/* Encrypts the plaintext of @a vector alone and checks the result */
+static void check_vector(const AesVector* vector) {
+    uint8_t key[BLOCK_SIZE];
+    uint8_t text[BLOCK_SIZE];
+
+    memcpy(key, vector->key, BLOCK_SIZE);
+    memcpy(text, vector->plaintext, BLOCK_SIZE);
+
+    SYS_EncryptBlocks(text, 1, key);
+
+    CHECK(0 == memcmp(text, vector->ciphertext, BLOCK_SIZE));
+}
+
+static void test_known_answers(void) {
+    for (size_t i = 0; i < VECTORS_AMOUNT; i++) {
+        check_vector(&vectors[i]);
+    }
+}
+
+/* The blocks of one call are independent, each one gives the same result as
+ * when it is encrypted alone */
+static void test_multiple_blocks(void) {
+    uint8_t key[BLOCK_SIZE];
+    uint8_t text[7 * BLOCK_SIZE];
+
+    memcpy(key, vectors[0].key, BLOCK_SIZE);
+
+    for (uint8_t i = 0; i < 7; i++) {
+        memcpy(&text[i * BLOCK_SIZE], vectors[0].plaintext, BLOCK_SIZE);
+    }
+
+    SYS_EncryptBlocks(text, 7, key);
+
+    for (uint8_t i = 0; i < 7; i++) {
+        CHECK(0 == memcmp(&text[i * BLOCK_SIZE],
+                          vectors[0].ciphertext,
+                          BLOCK_SIZE));
+    }
+}
+
+/* The key schedule is cached, so a changed key, even in the same buffer,
+ * has to be noticed */
+static void test_key_change(void) {
+    uint8_t key[BLOCK_SIZE];
+    uint8_t text[BLOCK_SIZE];
+
+    for (size_t i = 0; i < 2 * VECTORS_AMOUNT; i++) {
+        const AesVector* vector = &vectors[i % VECTORS_AMOUNT];
+
+        memcpy(key, vector->key, BLOCK_SIZE);
+        memcpy(text, vector->plaintext, BLOCK_SIZE);
+
+        SYS_EncryptBlocks(text, 1, key);
+
+        CHECK(0 == memcmp(text, vector->ciphertext, BLOCK_SIZE));
+    }
+}
+
+int main(void) {
+    test_known_answers();
+    test_multiple_blocks();
+    test_key_change();
+
+    return check_passed() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
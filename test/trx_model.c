@@ -0,0 +1,49 @@
+#include "trx_model.h"
+#include "phy.h"
+#include "sal.h"
+
+/* Command and address byte in front of every SRAM access */
+#define TRX_MODEL_SRAM_HEADER 2
+
+TrxModelStats trx_model_stats;
+
+void trx_model_reset(void) {
+    trx_model_stats.spi_bytes = 0;
+    trx_model_stats.wait_us   = 0;
+}
+
+/* The MCU is busy for the whole transfer and for every wait */
+uint32_t trx_model_cpu_cycles(void) {
+    uint64_t bits = (uint64_t)trx_model_stats.spi_bytes * 8;
+
+    return bits * TRX_MODEL_CPU_HZ / TRX_MODEL_SPI_HZ +
+           (uint64_t)trx_model_stats.wait_us * (TRX_MODEL_CPU_HZ / 1000000u);
+}
+
+void trx_sram_write(uint8_t addr, uint8_t* data, uint8_t length) {
+    (void)addr;
+    (void)data;
+    trx_model_stats.spi_bytes += TRX_MODEL_SRAM_HEADER + length;
+}
+
+void trx_sram_read(uint8_t addr, uint8_t* data, uint8_t length) {
+    (void)addr;
+    (void)data;
+    trx_model_stats.spi_bytes += TRX_MODEL_SRAM_HEADER + length;
+}
+
+void trx_aes_wrrd(uint8_t addr, uint8_t* idata, uint8_t length) {
+    (void)addr;
+    (void)idata;
+    trx_model_stats.spi_bytes += TRX_MODEL_SRAM_HEADER + length;
+}
+
+void delay_us(uint32_t delay) {
+    trx_model_stats.wait_us += delay;
+}
+
+/* As in the AT86RF233 PHY, which is awake in the benchmark */
+void PHY_EncryptBlocksReq(uint8_t* text, uint8_t blocks, uint8_t* key) {
+    sal_aes_setup(key, AES_MODE_ECB, AES_DIR_ENCRYPT);
+    sal_aes_exec_blocks(text, blocks);
+}
@@ -0,0 +1,27 @@
+#ifndef TEST_TRX_MODEL_H
+#define TEST_TRX_MODEL_H
+
+/*
+ * Model of the AT86RF2xx transceiver access used by the SAL in
+ * SYS_SECURITY_MODE 0. Nothing is encrypted. The model counts the bytes on
+ * the SPI bus and the time the SAL waits for the AES engine, which is what
+ * mode 0 costs the MCU.
+ */
+
+#include <stdint.h>
+
+/* SPI clock of the boards, F_CPU / 2 at 8 MHz */
+#define TRX_MODEL_SPI_HZ 4000000u
+#define TRX_MODEL_CPU_HZ 8000000u
+
+typedef struct {
+    uint32_t spi_bytes;
+    uint32_t wait_us;
+} TrxModelStats;
+
+extern TrxModelStats trx_model_stats;
+
+void trx_model_reset(void);
+uint32_t trx_model_cpu_cycles(void);
+
+#endif